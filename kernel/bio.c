@@ -1,10 +1,16 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers are hashed by (dev, blockno) into NBUCKET chains, each
+// with its own spin lock, so lookups of different blocks don't
+// contend. Each unused buffer records the tick at which it was
+// last released; bget() recycles the unused buffer with the
+// oldest timestamp.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -22,34 +28,63 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
+
+#define NBUCKET 13
+
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;   // chain of bufs hashing here, through next.
+};
 
 struct {
+  // serializes recycling, which is the only path that
+  // holds two bucket locks at once.
   struct spinlock lock;
   struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  initlock(&bcache.lock, "bcache");
+  initticketlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // All buffers start out unused, hashed as (0, 0).
+  bk = bhash(0, 0);
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = 0;
+    b->next = bk->head;
+    bk->head = b;
+  }
+}
+
+// Return the buf in bucket bk caching (dev, blockno), or 0.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
   }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -58,34 +93,83 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct buf *b, *victim, **pp, **vpp;
+  struct bucket *bk, *vbk, *cbk;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    statinc(ST_BHIT);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached.
+  // Only one CPU at a time recycles, so holding bk->lock
+  // while locking other buckets can't deadlock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+
+  // Someone may have cached it while we held no bucket lock.
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    statinc(ST_BHIT);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  statinc(ST_BMISS);
+
   // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Keep the lock on the bucket holding the best candidate
+  // so far, so that the candidate can't be taken from under us.
+  victim = 0;
+  vbk = 0;
+  vpp = 0;
+  for(cbk = bcache.bucket; cbk < bcache.bucket+NBUCKET; cbk++){
+    int found = 0;
+    if(cbk != bk)
+      acquire(&cbk->lock);
+    for(pp = &cbk->head; *pp != 0; pp = &(*pp)->next){
+      b = *pp;
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        vpp = pp;
+        found = 1;
+      }
+    }
+    if(found){
+      if(vbk != 0 && vbk != bk)
+        release(&vbk->lock);
+      vbk = cbk;
+    } else if(cbk != bk){
+      release(&cbk->lock);
     }
   }
-  panic("bget: no buffers");
+  if(victim == 0)
+    panic("bget: no buffers");
+
+  // Move the victim into bk.
+  *vpp = victim->next;
+  if(vbk != bk)
+    release(&vbk->lock);
+  victim->next = bk->head;
+  bk->head = victim;
+
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -111,43 +195,138 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write n locked buffers to disk as one batch: queue them
+// all, notify the device once, then wait for every one.
+void
+bwritev(struct buf **bufs, int n)
+{
+  bwritevat(bufs, 0, n);
+}
+
+// Like bwritev(), but write the contents of bufs[i] to disk
+// block blocknos[i] rather than to its own block. The cache
+// is not updated; the log uses this to install committed
+// blocks straight from the log buffers.
+void
+bwritevat(struct buf **bufs, uint *blocknos, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+    virtio_disk_submit(bufs[i], blocknos ? blocknos[i] : bufs[i]->blockno, 1);
+  }
+  virtio_disk_kick();
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bufs[i]);
+}
+
+// Start reading the n blocks in blocknos[] into the cache,
+// without waiting for them. A later bread() of one of them
+// waits for its read to finish. Cached blocks are skipped.
+void
+breadahead(uint dev, uint *blocknos, int n)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int i, cached, queued = 0;
+
+  for(i = 0; i < n; i++){
+    bk = bhash(dev, blocknos[i]);
+    acquire(&bk->lock);
+    cached = bfind(bk, dev, blocknos[i]) != 0;
+    release(&bk->lock);
+    if(cached)
+      continue;
+
+    b = bget(dev, blocknos[i]);
+    if(b->valid){
+      brelse(b);
+      continue;
+    }
+    b->async = 1;
+    virtio_disk_submit(b, b->blockno, 0);
+    queued++;
+  }
+  if(queued)
+    virtio_disk_kick();
+}
+
+// Finish a read started by breadahead(). Called from the disk
+// interrupt, which releases the buffer on the reader's behalf.
+void
+bdone(struct buf *b)
+{
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  b->valid = 1;
+  releasesleep(&b->lock);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if(b->refcnt == 0)
+    b->lastuse = ticks;
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If no one else holds it, stamp it with the current
+// tick for LRU recycling in bget().
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Release a locked buffer whose bytes are unlikely to be
+// wanted again soon, such as a block copied into the page
+// cache, so that bget() recycles it first.
+void
+bdrop(struct buf *b)
+{
+  struct bucket *bk;
+
+  if(!holdingsleep(&b->lock))
+    panic("bdrop");
+
+  releasesleep(&b->lock);
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if(b->refcnt == 0)
+    b->lastuse = 0;
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
-
@@ -1,12 +1,17 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int async;   // read by breadahead(); the disk interrupt releases it
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint lastuse;     // ticks when refcnt last dropped to 0
+  struct buf *next; // hash bucket chain
+  struct buf *qnext; // virtio_disk: queue of unsent requests, or merged request
+  uint qblock;       // virtio_disk: block to read or write
+  int qwrite;
+  int vq;            // virtio_disk: the virtqueue it went to
   uchar data[BSIZE];
 };
 
@@ -58,18 +58,9 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
-      break;
-    uartputc(c);
-  }
-  release(&cons.lock);
-
-  return i;
+  // uartwrite() copies straight into the UART's ring and
+  // serializes writers itself; it may sleep, so no cons.lock.
+  return uartwrite(user_src, src, n);
 }
 
 //
@@ -81,9 +72,8 @@ consolewrite(int user_src, uint64 src, int n)
 int
 consoleread(int user_dst, uint64 dst, int n)
 {
-  uint target;
-  int c;
-  char cbuf;
+  uint target, m;
+  int c, eol, r;
 
   target = n;
   acquire(&cons.lock);
@@ -98,26 +88,46 @@ consoleread(int user_dst, uint64 dst, int n)
       sleep(&cons.r, &cons.lock);
     }
 
-    c = cons.buf[cons.r++ % INPUT_BUF];
+    c = cons.buf[cons.r % INPUT_BUF];
 
     if(c == C('D')){  // end-of-file
-      if(n < target){
-        // Save ^D for next time, to make sure
-        // caller gets a 0-byte result.
-        cons.r--;
+      if(n == target){
+        // Consume ^D only if it is the first byte, so that
+        // the caller gets a 0-byte result next time.
+        cons.r++;
       }
       break;
     }
 
-    // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
-
-    dst++;
-    --n;
+    // copy the run of input bytes up to a newline, ^D, the
+    // end of the input or the end of cons.buf at once.
+    eol = 0;
+    for(m = 0; m < n && cons.r + m != cons.w; ){
+      c = cons.buf[(cons.r + m) % INPUT_BUF];
+      if(c == C('D'))
+        break;
+      m++;
+      if(c == '\n'){
+        eol = 1;
+        break;
+      }
+      if((cons.r + m) % INPUT_BUF == 0)
+        break;
+    }
+    if(either_copyout(user_dst, dst, &cons.buf[cons.r % INPUT_BUF], m) == -1){
+      // maybe a page that can't be read in under cons.lock.
+      release(&cons.lock);
+      r = uvmtouch(dst, m, 1);
+      acquire(&cons.lock);
+      if(r < 0)
+        break;
+      continue;
+    }
+    cons.r += m;
+    dst += m;
+    n -= m;
 
-    if(c == '\n'){
+    if(eol){
       // a whole line has arrived, return to
       // the user-level read().
       break;
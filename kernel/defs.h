@@ -2,18 +2,27 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct kmem_cache;
+struct mm;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct sysinfo;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bdrop(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            bwritevat(struct buf**, uint*, int);
+void            breadahead(uint, uint*, int);
+void            bdone(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -24,6 +33,13 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execload(struct mm*, char*, char**, uint64*, uint64*);
+void            execname(struct proc*, char*);
+void            textinit(void);
+void            textinval(struct inode*);
+void            textuse(struct inode*, int);
+int             execfault(struct proc*, uint64);
+void            exectouch(uint64, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -31,25 +47,36 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int);
 int             filestat(struct file*, uint64 addr);
+int             filegetdents(struct file*, uint64, int);
 int             filewrite(struct file*, uint64, int n);
+int             filewritev(struct file*, struct iovec*, int);
+int             filesplice(struct file*, struct file*, int);
 
 // fs.c
 void            fsinit(int);
+void            dirinit(struct inode*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   direntget(struct inode*, char*, uint);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
+void            dcache_remove(struct inode*, char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+uint            bfreecount(void);
+void            ireadahead(struct inode*, uint, uint);
+void            ifill(struct inode*, uint, char*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -62,55 +89,117 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void *          kzalloc(void);
+void            kzeroinit(void);
+void            kreclaiminit(void);
+void            kshrinker(char*, int (*)(int));
+int             kreclaimwait(void);
 void            kinit(void);
+void            kaddref(void *);
+int             krefcnt(void *);
+uint64          get_freemem(void);
+void*           bootalloc(uint64);
+uint64          bootmem(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_force(void);
+void            loginfo(struct sysinfo*);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+int             mmapfault(struct mm*, uint64, int);
+void            mmaptouch(uint64, uint64);
+int             mmapfork(struct mm*, struct mm*);
+int             mmapcow(struct mm*, uint64);
+void            mmapexit(struct mm*);
+uint64          mmapbase(struct mm*);
+int             mmapshared(struct mm*, uint64);
+
+// pagecache.c
+void            pcinit(void);
+int             pcread(struct inode*, int, uint64, uint, uint);
+void            pcwrite(struct inode*, uint, char*, uint);
+int             pcpresent(struct inode*, uint);
+void            pcdrop(struct inode*);
 
 // pipe.c
-int             pipealloc(struct file**, struct file**);
+void            pipeinit(void);
+int             pipealloc(struct file**, struct file**, int);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipesplice(struct pipe*, struct file*, int);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
+int             klogread(uint64, int);
 
 // proc.c
+extern int      nprocs;
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             clone(uint64, uint64, uint64);
+int             growproc(int, uint64*);
+struct mm*      mmalloc(struct proc*);
+void            mmswappable(struct mm*);
+int             mmevict(struct mm**, uint64*, uint*, int, int*);
+void            mmput(struct mm*, uint64);
+void            mmlock(struct mm*);
+void            mmunlock(struct mm*);
+void            mmflush(struct mm*);
+void            mmunmap(struct mm*, uint64, uint64);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            killthreads(struct proc*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
 void            procinit(void);
+void            proctabinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
+int             kthread(void (*)(void), char*);
 int             wait(uint64);
+int             join(int, uint64);
+int             spawn(char*, char**, struct file**);
+void            cputime(int);
+void            statinc(int);
+int             waitstatread(uint64, int, int);
 void            wakeup(void*);
 void            yield(void);
+void            preempt(void);
+int             setpriority(int, int);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            cpuinfo(struct sysinfo*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// ucopy.S
+int             ucopyin(char*, char*, uint64);
+int             ucopyinstr(char*, char*, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdinglocks(void);
+void            initticketlock(struct spinlock*, char*);
+int             lockstatread(uint64, int, int);
+int             lockbench(int, int, uint64);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
@@ -118,8 +207,10 @@ void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+int             holdingsleepshared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -139,23 +230,54 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// tracebuf.c
+void            traceinit(void);
+void            tracepush(int, int, uint64);
+int             traceread(uint64, int);
+uint64          tracedrops(void);
+
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapalloc(void);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapout(int);
+int             swapfault(struct mm*, uint64, int);
+void            swapinfo(struct sysinfo*);
+
+// tmpfs.c
+extern uint     tmpmnt;
+void            tmpinit(void);
+int             tmpmount(struct inode*);
+uint            tmpialloc(short);
+void            tmpiload(struct inode*);
+void            tmpiupdate(struct inode*);
+void            tmpitrunc(struct inode*);
+int             tmpreadi(struct inode*, int, uint64, uint, uint);
+int             tmpwritei(struct inode*, int, uint64, uint, uint);
+
 // trap.c
-extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+int             uartwrite(int, uint64, int);
+void            uartputs(const char*, int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
+void            kvmsync(pagetable_t, pagetable_t);
+int             kvmfault(uint64, int);
+void            uvmsync(pagetable_t);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
@@ -167,11 +289,46 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmcowfault(pagetable_t, uint64);
+int             uvmlazyalloc(pagetable_t, uint64, uint64);
+int             uvmfault(pagetable_t, uint64, uint64, int);
+int             mmfault(struct mm*, uint64, int);
+int             uvmevict(pagetable_t, uint64*, uint64, uint64*, uint*, int, int*);
+pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
+uint64          uvmuseraddr(pagetable_t, uint64);
+int             uvmtouch(uint64, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, uint);
+int             futexwake(uint64, int);
+
+// prof.c
+extern uint     profhz;
+void            profinit(void);
+uint64          profctl(uint);
+void            profsample(struct proc*, uint64, uint64, int);
+int             profread(uint64, int);
+
+// timer.c
+extern uint     ticks;
+void            timersinit(void);
+void            timerslice(void);
+int             sleepticks(uint);
+int             timerintr(void);
+uint            uptimeticks(void);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabinfo(struct sysinfo*);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -181,6 +338,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, uint, int);
+void            virtio_disk_kick(void);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
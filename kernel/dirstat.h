@@ -0,0 +1,9 @@
+// getdents(): a directory entry's name with the stat() of
+// the inode it leads to. Needs stat.h and fs.h.
+
+#define NGETDENTS 16   // max entries per getdents()
+
+struct dirstat {
+  char name[DIRSIZ+1];   // nul-terminated
+  struct stat st;
+};
@@ -6,20 +6,139 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+static int markseg(pagetable_t pagetable, uint64 va, uint64 filesz);
+static int textshrink(int n);
 
-int
-exec(char *path, char **argv)
+// Whole pages of program files, shared by every process that
+// runs the program. Each entry holds a reference to its page;
+// a process maps the page read-only, or copy-on-write if the
+// segment is writable. The user programs are linked as a single
+// RWX segment, so sharing is by file page rather than by segment.
+// An inode's pages are dropped whenever the file is written or
+// truncated (textinval()), which can't happen while a process
+// runs it (ip->textrun), since its pages not read in yet must
+// still come from the file it started with.
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint inum;
+    uint off;      // file offset of the page
+    uint64 pa;     // 0 if the entry is free
+  } e[NTEXT];
+  int hand;        // next entry to replace
+} textcache;
+
+#define NELFPH 8   // most loadable segments in a program
+
+// The checked ELF headers of recently run programs: the entry
+// point and the loadable program headers, so that running a
+// program again reads none of them. Dropped along with the
+// text pages by textinval().
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint inum;     // 0 if the entry is free
+    uint64 entry;
+    int nph;
+    struct proghdr ph[NELFPH];
+  } e[NELFCACHE];
+  int hand;        // next entry to replace
+} elfcache;
+
+// Read and check the ELF header of ip and its loadable program
+// headers, at most NELFPH of them, into ph. Sets *entry and
+// *nph. Caller holds ip->lock.
+static int
+elfparse(struct inode *ip, uint64 *entry, struct proghdr *ph, int *nph)
 {
-  char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase;
   struct elfhdr elf;
+  struct proghdr p;
+  int i, off;
+
+  if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
+    return -1;
+  if(elf.magic != ELF_MAGIC)
+    return -1;
+  *nph = 0;
+  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(p)){
+    if(readi(ip, 0, (uint64)&p, off, sizeof(p)) != sizeof(p))
+      return -1;
+    if(p.type != ELF_PROG_LOAD)
+      continue;
+    if(p.memsz < p.filesz)
+      return -1;
+    if(p.vaddr + p.memsz < p.vaddr)
+      return -1;
+    if(p.vaddr % PGSIZE != 0)
+      return -1;
+    // only LOAD headers are kept, so only they count.
+    if(*nph == NELFPH)
+      return -1;
+    ph[(*nph)++] = p;
+  }
+  *entry = elf.entry;
+  return 0;
+}
+
+// Find ip's headers in the ELF cache. Caller holds ip->lock.
+static int
+elfget(struct inode *ip, uint64 *entry, struct proghdr *ph, int *nph)
+{
+  int i;
+
+  acquire(&elfcache.lock);
+  for(i = 0; i < NELFCACHE; i++){
+    if(elfcache.e[i].inum == ip->inum && elfcache.e[i].dev == ip->dev){
+      *entry = elfcache.e[i].entry;
+      *nph = elfcache.e[i].nph;
+      memmove(ph, elfcache.e[i].ph, *nph * sizeof(*ph));
+      release(&elfcache.lock);
+      return 0;
+    }
+  }
+  release(&elfcache.lock);
+  return -1;
+}
+
+// Remember ip's checked headers. Caller holds ip->lock, so that
+// a write can't slip in before textinval() can see them.
+static void
+elfput(struct inode *ip, uint64 entry, struct proghdr *ph, int nph)
+{
+  int i;
+
+  acquire(&elfcache.lock);
+  i = elfcache.hand;
+  elfcache.hand = (elfcache.hand + 1) % NELFCACHE;
+  elfcache.e[i].dev = ip->dev;
+  elfcache.e[i].inum = ip->inum;
+  elfcache.e[i].entry = entry;
+  elfcache.e[i].nph = nph;
+  memmove(elfcache.e[i].ph, ph, nph * sizeof(*ph));
+  release(&elfcache.lock);
+  ip->text = 1;
+}
+
+// Load the program at path into mm, a new address space, with
+// argv on its stack. Sets *entry and *spp to the initial pc and
+// stack pointer and returns argc. On error returns -1, leaving
+// what was loaded for mmput() to free.
+int
+execload(struct mm *mm, char *path, char **argv, uint64 *entry, uint64 *spp)
+{
+  int i, nph;
+  uint64 argc, sz = 0, sp, ustack[MAXARG+1], stackbase, elfentry, len;
   struct inode *ip;
-  struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  struct proghdr phs[NELFPH], ph;
+  pagetable_t pagetable = mm->pagetable;
+  char *stack;
 
   begin_op();
 
@@ -27,43 +146,56 @@ exec(char *path, char **argv)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
-  // Check ELF header
-  if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-  if(elf.magic != ELF_MAGIC)
-    goto bad;
-
-  if((pagetable = proc_pagetable(p)) == 0)
-    goto bad;
+  // Check ELF header, unless it was checked when last run.
+  if(elfget(ip, &elfentry, phs, &nph) < 0){
+    if(elfparse(ip, &elfentry, phs, &nph) < 0)
+      goto bad;
+    elfput(ip, elfentry, phs, nph);
+  }
 
   // Load program into memory.
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
+  for(i = 0; i < nph; i++){
+    ph = phs[i];
+    if(mm->nseg < NSEG){
+      // leave the segment to execfault(): mark the pages
+      // holding file data, and let the rest be zero-filled
+      // lazily like sbrk() memory.
+      struct seg *s = &mm->seg[mm->nseg];
+      if(ph.vaddr + ph.memsz > MAXUVA)
+        goto bad;
+      if(markseg(pagetable, ph.vaddr, ph.filesz) < 0)
+        goto bad;
+      s->va = ph.vaddr;
+      s->memsz = ph.memsz;
+      s->filesz = ph.filesz;
+      s->off = ph.off;
+      s->perm = PTE_R;
+      if(ph.flags & ELF_PROG_FLAG_WRITE)
+        s->perm |= PTE_W;
+      if(ph.flags & ELF_PROG_FLAG_EXEC)
+        s->perm |= PTE_X;
+      mm->nseg++;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
       continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
     sz = sz1;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
     if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  // keep the inode for execfault(); mmput() lets it go. Count
+  // it while ip is locked, so that writers see it.
+  textuse(ip, 1);
+  iunlock(ip);
   end_op();
+  mm->exe = ip;
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
@@ -74,17 +206,21 @@ exec(char *path, char **argv)
   uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
+  // uvmalloc() has just mapped the stack page, so build the
+  // arguments straight into it, as loadseg() loads segments.
+  if((stack = (char*)walkaddr(pagetable, stackbase)) == 0)
+    goto bad;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
       goto bad;
-    sp -= strlen(argv[argc]) + 1;
+    len = strlen(argv[argc]) + 1;
+    sp -= len;
     sp -= sp % 16; // riscv sp must be 16-byte aligned
     if(sp < stackbase)
       goto bad;
-    if(copyout(pagetable, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
+    memmove(stack + (sp - stackbase), argv[argc], len);
     ustack[argc] = sp;
   }
   ustack[argc] = 0;
@@ -94,8 +230,48 @@ exec(char *path, char **argv)
   sp -= sp % 16;
   if(sp < stackbase)
     goto bad;
-  if(copyout(pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
-    goto bad;
+  memmove(stack + (sp - stackbase), ustack, (argc+1)*sizeof(uint64));
+
+  mm->sz = sz;
+  *entry = elfentry;
+  *spp = sp;
+  return argc;
+
+ bad:
+  mm->sz = sz;
+  if(ip){
+    iunlockput(ip);
+    end_op();
+  }
+  return -1;
+}
+
+// Set p's name from the last element of path.
+void
+execname(struct proc *p, char *path)
+{
+  char *s, *last;
+
+  for(last=s=path; *s; s++)
+    if(*s == '/')
+      last = s+1;
+  safestrcpy(p->name, last, sizeof(p->name));
+}
+
+int
+exec(char *path, char **argv)
+{
+  int argc;
+  uint64 entry, sp;
+  struct mm *mm, *oldmm;
+  struct proc *p = myproc();
+
+  if((mm = mmalloc(p)) == 0)
+    return -1;
+  if((argc = execload(mm, path, argv, &entry, &sp)) < 0){
+    mmput(mm, TRAPFRAME);
+    return -1;
+  }
 
   // arguments to user main(argc, argv)
   // argc is returned via the system call return
@@ -103,29 +279,240 @@ exec(char *path, char **argv)
   p->trapframe->a1 = sp;
 
   // Save program name for debugging.
-  for(last=s=path; *s; s++)
-    if(*s == '/')
-      last = s+1;
-  safestrcpy(p->name, last, sizeof(p->name));
-    
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
-  p->trapframe->epc = elf.entry;  // initial program counter = main
+  execname(p, path);
+
+  // Commit to the user image, in a new address space. Other
+  // threads of the old one carry on in it, unless this is the
+  // process they belong to.
+  if(!p->thread && p->mm->ref > 1)
+    killthreads(p);
+  oldmm = p->mm;
+  p->mm = mm;
+  p->pagetable = mm->pagetable;
+  p->trapframe->epc = entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  kvmsync(p->kpagetable, p->pagetable);
+  sfence_vma();  // drop translations of the old image before freeing it
+  mmswappable(mm);
+  mmput(oldmm, p->tfva);
+  p->tfva = TRAPFRAME;
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
+}
 
- bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
-  if(ip){
-    iunlockput(ip);
-    end_op();
+// Mark the pages of a segment that hold file data, from
+// page-aligned va up to va+filesz, to be read in by execfault().
+static int
+markseg(pagetable_t pagetable, uint64 va, uint64 filesz)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = va; a < va + filesz; a += PGSIZE){
+    if((pte = walk(pagetable, a, 1)) == 0)
+      return -1;
+    if((*pte & PTE_V) == 0)
+      *pte = PTE_FILE;
+  }
+  return 0;
+}
+
+void
+textinit(void)
+{
+  initlock(&textcache.lock, "textcache");
+  initlock(&elfcache.lock, "elfcache");
+  kshrinker("textcache", textshrink);
+}
+
+// Shrinker: drop up to n cached pages that no process maps.
+// Returns the number of pages freed.
+static int
+textshrink(int n)
+{
+  int i, freed = 0;
+
+  acquire(&textcache.lock);
+  for(i = 0; i < NTEXT && freed < n; i++){
+    if(textcache.e[i].pa && krefcnt((void*)textcache.e[i].pa) == 1){
+      kfree((void*)textcache.e[i].pa);
+      textcache.e[i].pa = 0;
+      freed++;
+    }
+  }
+  release(&textcache.lock);
+  return freed;
+}
+
+// Return the cached page at file offset off of ip, reading it
+// in if needed, with a reference added for the caller.
+// Returns 0 if out of memory or the file is short.
+static uint64
+textget(struct inode *ip, uint off)
+{
+  int i;
+  uint64 pa;
+  char *mem;
+
+  acquire(&textcache.lock);
+  for(i = 0; i < NTEXT; i++){
+    if(textcache.e[i].pa && textcache.e[i].dev == ip->dev &&
+       textcache.e[i].inum == ip->inum && textcache.e[i].off == off){
+      pa = textcache.e[i].pa;
+      kaddref((void*)pa);
+      release(&textcache.lock);
+      return pa;
+    }
+  }
+  release(&textcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  ilockshared(ip);
+  if(readi(ip, 0, (uint64)mem, off, PGSIZE) != PGSIZE){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  // insert while ip is locked, so that a write to the
+  // file cannot slip in before the page is visible to
+  // textinval().
+  acquire(&textcache.lock);
+  i = textcache.hand;
+  textcache.hand = (textcache.hand + 1) % NTEXT;
+  if(textcache.e[i].pa)
+    kfree((void*)textcache.e[i].pa);
+  textcache.e[i].dev = ip->dev;
+  textcache.e[i].inum = ip->inum;
+  textcache.e[i].off = off;
+  textcache.e[i].pa = (uint64)mem;
+  kaddref(mem);
+  release(&textcache.lock);
+  ip->text = 1;
+  iunlock(ip);
+  return (uint64)mem;
+}
+
+// Count delta more address spaces running ip as their program.
+// A writer holds ip's lock exclusively, so one that sees none
+// can't have one start before it is done.
+void
+textuse(struct inode *ip, int delta)
+{
+  __sync_fetch_and_add(&ip->textrun, delta);
+}
+
+// Drop the cached pages and ELF headers of ip, which is about
+// to change. No process is running the program (ip->textrun).
+// Caller holds ip's sleep-lock.
+void
+textinval(struct inode *ip)
+{
+  int i;
+
+  acquire(&textcache.lock);
+  for(i = 0; i < NTEXT; i++){
+    if(textcache.e[i].pa && textcache.e[i].dev == ip->dev &&
+       textcache.e[i].inum == ip->inum){
+      kfree((void*)textcache.e[i].pa);
+      textcache.e[i].pa = 0;
+    }
+  }
+  release(&textcache.lock);
+
+  acquire(&elfcache.lock);
+  for(i = 0; i < NELFCACHE; i++)
+    if(elfcache.e[i].inum == ip->inum && elfcache.e[i].dev == ip->dev)
+      elfcache.e[i].inum = 0;
+  release(&elfcache.lock);
+  ip->text = 0;
+}
+
+// Handle the first touch of a program page marked by markseg().
+// Whole pages come from the text cache; the last, partial page
+// of a segment is read into a private page.
+// May sleep, so the caller must not hold spinlocks.
+// Returns 0 if the page is now mapped, -1 if va is not such a page.
+int
+execfault(struct proc *p, uint64 va)
+{
+  struct mm *mm;
+  struct seg *s;
+  pte_t *pte;
+  uint64 pa, pgoff, n;
+  int flags;
+  char *mem;
+
+  if(p == 0 || (mm = p->mm) == 0 || mm->exe == 0 || va >= MAXUVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  for(s = mm->seg; s < &mm->seg[mm->nseg]; s++)
+    if(va >= s->va && va < s->va + s->filesz)
+      break;
+  if(s == &mm->seg[mm->nseg])
+    return -1;
+  pte = walk(mm->pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_FILE)) != PTE_FILE)
+    return -1;
+
+  pgoff = va - s->va;
+  n = s->filesz - pgoff;
+  flags = s->perm | PTE_U;
+  if(n >= PGSIZE){
+    if((pa = textget(mm->exe, s->off + pgoff)) == 0)
+      return -1;
+    if(flags & PTE_W)
+      flags = (flags & ~PTE_W) | PTE_COW;
+  } else {
+    if((mem = kzalloc()) == 0)
+      return -1;
+    ilockshared(mm->exe);
+    if(readi(mm->exe, 0, (uint64)mem, s->off + pgoff, n) != n){
+      iunlock(mm->exe);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(mm->exe);
+    pa = (uint64)mem;
+  }
+
+  // another thread may have read the page in meanwhile, or
+  // shrunk the process below it. The page-table page stays.
+  acquire(&mm->lock);
+  if((*pte & (PTE_V|PTE_FILE)) != PTE_FILE){
+    release(&mm->lock);
+    kfree((void*)pa);
+    return 0;
+  }
+  *pte = PA2PTE(pa) | flags | PTE_V;
+  uvmsync(mm->pagetable);
+  release(&mm->lock);
+  return 0;
+}
+
+// Read in the program pages in [va, va+n) before a system call
+// holds inode locks while copying to or from them, since
+// execfault() locks the program's inode.
+void
+exectouch(uint64 va, uint64 n)
+{
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct seg *s;
+  uint64 a, start, end;
+  pte_t *pte;
+
+  if(va + n < va)
+    return;
+  for(s = mm->seg; s < &mm->seg[mm->nseg]; s++){
+    start = va > s->va ? va : s->va;
+    end = va + n < s->va + s->filesz ? va + n : s->va + s->filesz;
+    for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+      pte = walk(mm->pagetable, a, 0);
+      if(pte && (*pte & (PTE_V|PTE_FILE)) == PTE_FILE)
+        execfault(p, a);
+    }
   }
-  return -1;
 }
 
 // Load a program segment into pagetable at virtual address va.
@@ -12,16 +12,29 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
+#include "dirstat.h"
 
 struct devsw devsw[NDEV];
 struct {
     struct spinlock lock;
-    struct file file[NFILE];
+    struct file *file;      // file[nfile], sized by fileinit()
+    int nfile;
+    struct file *freelist;  // files with ref == 0
 } ftable;
 
+// Size the file table by the process table. Called before kinit().
 void
 fileinit(void) {
     initlock(&ftable.lock, "ftable");
+    ftable.nfile = nprocs * 4;
+    if (ftable.nfile < NFILE)
+        ftable.nfile = NFILE;
+    ftable.file = bootalloc(ftable.nfile * sizeof(struct file));
+    for (int i = ftable.nfile - 1; i >= 0; i--) {
+        ftable.file[i].next = ftable.freelist;
+        ftable.freelist = &ftable.file[i];
+    }
 }
 
 // Allocate a file structure.
@@ -30,15 +43,14 @@ filealloc(void) {
     struct file *f;
 
     acquire(&ftable.lock);
-    for (f = ftable.file; f < ftable.file + NFILE; f++) {
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
+    f = ftable.freelist;
+    if (f) {
+        ftable.freelist = f->next;
+        f->next = 0;
+        f->ref = 1;
     }
     release(&ftable.lock);
-    return 0;
+    return f;
 }
 
 // Increment ref count for file f.
@@ -67,6 +79,8 @@ fileclose(struct file *f) {
     ff = *f;
     f->ref = 0;
     f->type = FD_NONE;
+    f->next = ftable.freelist;
+    ftable.freelist = f;
     release(&ftable.lock);
 
     if (ff.type == FD_PIPE) {
@@ -86,7 +100,7 @@ filestat(struct file *f, uint64 addr) {
     struct stat st;
 
     if (f->type == FD_INODE || f->type == FD_DEVICE) {
-        ilock(f->ip);
+        ilockshared(f->ip);
         stati(f->ip, &st);
         iunlock(f->ip);
         if (copyout(p->pagetable, addr, (char *) &st, sizeof(st)) < 0)
@@ -96,6 +110,66 @@ filestat(struct file *f, uint64 addr) {
     return -1;
 }
 
+// Read up to n entries of directory f from f->off on into the
+// array of struct dirstat at user address addr, each with the
+// stat of the inode it names. Returns the number of entries,
+// 0 at the end of the directory.
+//
+// The entries' inodes are referenced while the directory is
+// locked, so none can be freed, and locked one at a time once
+// it is unlocked, so that no lock is taken out of order.
+int
+filegetdents(struct file *f, uint64 addr, int n) {
+    struct proc *p = myproc();
+    struct inode *dp = f->ip, *ips[NGETDENTS];
+    char names[NGETDENTS][DIRSIZ];
+    struct dirent de;
+    struct dirstat ds;
+    int i, nd = 0, r;
+
+    if (f->type != FD_INODE || f->readable == 0 || n < 0)
+        return -1;
+    if (n > NGETDENTS)
+        n = NGETDENTS;
+
+    begin_op();  // for the iput()s
+    // f->off belongs to f: share the inode only if no one
+    // else can be using f, as fileread() does.
+    if (f->ref > 1)
+        ilock(dp);
+    else
+        ilockshared(dp);
+    if (dp->type != T_DIR) {
+        iunlock(dp);
+        end_op();
+        return -1;
+    }
+    while (nd < n && f->off + sizeof(de) <= dp->size) {
+        if (readi(dp, 0, (uint64) &de, f->off, sizeof(de)) != sizeof(de))
+            break;
+        f->off += sizeof(de);
+        if (de.inum == 0)
+            continue;
+        memmove(names[nd], de.name, DIRSIZ);
+        if ((ips[nd] = direntget(dp, de.name, de.inum)) != 0)
+            nd++;
+    }
+    iunlock(dp);
+
+    r = nd;
+    for (i = 0; i < nd; i++) {
+        memset(&ds, 0, sizeof(ds));
+        memmove(ds.name, names[i], DIRSIZ);
+        ilockshared(ips[i]);
+        stati(ips[i], &ds.st);
+        iunlockput(ips[i]);
+        if (r >= 0 && copyout(p->pagetable, addr + i * sizeof(ds), (char *) &ds, sizeof(ds)) < 0)
+            r = -1;
+    }
+    end_op();
+    return r;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -112,9 +186,26 @@ fileread(struct file *f, uint64 addr, int n) {
             return -1;
         r = devsw[f->major].read(1, addr, n);
     } else if (f->type == FD_INODE) {
-        ilock(f->ip);
+        // f->off and the read-ahead state belong to f, which the
+        // inode lock also guards: share the inode only when no
+        // one else can be using f.
+        if (f->ref > 1)
+            ilock(f->ip);
+        else
+            ilockshared(f->ip);
+        int seq = f->off == f->raend;
         if ((r = readi(f->ip, 1, addr, f->off, n)) > 0)
             f->off += r;
+        f->raend = f->off;
+        // Sequential reader: keep NREADAHEAD blocks in flight ahead of it.
+        if (seq && r > 0) {
+            uint start = f->rapos > f->off ? f->rapos : f->off;
+            uint end = f->off + NREADAHEAD * BSIZE;
+            if (start < end) {
+                ireadahead(f->ip, start, end - start);
+                f->rapos = end;
+            }
+        }
         iunlock(f->ip);
     } else {
         panic("fileread");
@@ -123,6 +214,37 @@ fileread(struct file *f, uint64 addr, int n) {
     return r;
 }
 
+// Read from file f into cnt user buffers in turn,
+// stopping at the first one that fills short.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt) {
+    int i, r, tot = 0;
+
+    if (f->readable == 0)
+        return -1;
+    for (i = 0; i < cnt; i++) {
+        if (iov[i].len == 0)
+            continue;
+        if ((r = fileread(f, iov[i].base, iov[i].len)) < 0)
+            return tot > 0 ? tot : -1;
+        tot += r;
+        if (r < iov[i].len)
+            break;
+    }
+    return tot;
+}
+
+// Move n bytes from inode file in to pipe out without
+// copying them through user space.
+int
+filesplice(struct file *in, struct file *out, int n) {
+    if (in->readable == 0 || out->writable == 0)
+        return -1;
+    if (in->type != FD_INODE || out->type != FD_PIPE)
+        return -1;
+    return pipesplice(out->pipe, in, n);
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -173,3 +295,60 @@ filewrite(struct file *f, uint64 addr, int n) {
     return ret;
 }
 
+// Write cnt user buffers to file f, in order, as if they
+// were one. For an inode the segments are packed into as
+// few log transactions as filewrite() would need for a
+// single buffer of the same total size: they land back to
+// back in the file, so the same per-transaction bound holds.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt) {
+    int i, r, n1, room, max, tot = 0;
+    uint64 off;
+
+    if (f->writable == 0)
+        return -1;
+
+    if (f->type != FD_INODE) {
+        for (i = 0; i < cnt; i++) {
+            if (iov[i].len == 0)
+                continue;
+            if ((r = filewrite(f, iov[i].base, iov[i].len)) < 0)
+                return tot > 0 ? tot : -1;
+            tot += r;
+            if (r < iov[i].len)
+                break;
+        }
+        return tot;
+    }
+
+    max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+    i = 0;
+    off = 0;
+    r = 0;
+    while (i < cnt && r >= 0) {
+        begin_op();
+        ilock(f->ip);
+        for (room = max; i < cnt && room > 0; room -= n1) {
+            n1 = iov[i].len - off;
+            if (n1 > room)
+                n1 = room;
+            if (n1 > 0) {
+                if ((r = writei(f->ip, 1, iov[i].base + off, f->off, n1)) < 0)
+                    break;
+                if (r != n1)
+                    panic("short filewritev");
+                f->off += r;
+                tot += r;
+                off += r;
+            }
+            if (off == iov[i].len) {
+                i++;
+                off = 0;
+            }
+        }
+        iunlock(f->ip);
+        end_op();
+    }
+    return r < 0 && tot == 0 ? -1 : tot;
+}
+
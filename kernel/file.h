@@ -7,17 +7,25 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  struct file *next; // on the free list, when ref == 0
+  uint raend;        // FD_INODE: end of the last read, to spot sequential reads
+  uint rapos;        // FD_INODE: read-ahead has been started up to here
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+#define NMAPWIN 16  // must divide NINDIRECT
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;   // next in hash bucket
+  struct inode *lrunext; // unreferenced inodes, least recently
+  struct inode *lruprev; // used first; protected by icache.lrulock
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +34,21 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+  uchar data[NINLINE];
+  uint lastblock;     // block last allocated to the file; 0 if none yet
+  int text;           // exec's shared page cache may hold pages of it
+  int textrun;        // address spaces running it; it can't be written meanwhile
+  struct pcpage *pages;  // cached pages of its data; pcache.lock
+
+  // copy of NMAPWIN consecutive entries of an indirect block,
+  // for file blocks NDIRECT+mapbase onwards; saves re-reading
+  // the indirect block on sequential access. Readers holding
+  // lock shared all update it, so it has its own spinlock.
+  struct spinlock maplock;
+  int mapvalid;
+  uint mapbase;
+  uint map[NMAPWIN];
 };
 
 // map major device number to device functions.
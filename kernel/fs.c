@@ -26,14 +26,57 @@
 // only one device
 struct superblock sb; 
 
+// Allocation hints. balloc() and ialloc() resume scanning where
+// the last allocation left off instead of at the start of the
+// disk, unless the caller asks for a place near another block
+// or inode. nfree is the number of free blocks, counted once by
+// fsinit() and then kept up to date by balloc() and bfree().
+//
+// For locality the data blocks are split into groups of BPG
+// blocks, and the inodes into as many groups. A file's inode
+// goes in its directory's group and its blocks in its inode's
+// group, packed one after another; new directories are spread
+// over the groups.
+struct {
+  struct spinlock lock;
+  uint bnext;   // first block balloc() examines
+  uint inext;   // first inode ialloc() examines for a directory
+  uint nfree;   // free blocks on the device
+  uint ngroups; // allocation groups
+} fsalloc;
+
+// Group of inode inum.
+static uint
+igroup(uint inum)
+{
+  return (uint64)inum * fsalloc.ngroups / sb.ninodes;
+}
+
+// First data block of group g.
+static uint
+gblock(uint g)
+{
+  return sb.size - sb.nblocks + g * BPG;
+}
+
+// First inode of group g.
+static uint
+ginode(uint g)
+{
+  uint inum = ((uint64)g * sb.ninodes + fsalloc.ngroups - 1) / fsalloc.ngroups;
+  return inum ? inum : 1;
+}
+
+static void bcount(int dev);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / BSIZE);
+  memmove(sb, bp->data + SBOFF % BSIZE, sizeof(*sb));
   brelse(bp);
 }
 
@@ -43,7 +86,14 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.bsize != BSIZE)
+    panic("file system block size is not BSIZE");
   initlog(dev, &sb);
+  swapinit(dev, &sb);
+  initlock(&fsalloc.lock, "fsalloc");
+  fsalloc.inext = 1;
+  fsalloc.ngroups = (sb.nblocks + BPG - 1) / BPG;
+  bcount(dev);
 }
 
 // Zero a block.
@@ -60,28 +110,89 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// Count the free blocks in the bitmap, a word at a time.
+static void
+bcount(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi, used = 0;
+  uint64 w;
 
-  bp = 0;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi += 64){
+      w = ((uint64*)bp->data)[bi/64];
+      if(sb.size - (b + bi) < 64)
+        w &= (1UL << (sb.size - (b + bi))) - 1;  // bits past the disk
+      for(; w; w &= w - 1)
+        used++;
     }
     brelse(bp);
   }
+  fsalloc.nfree = sb.size - used;
+}
+
+// Find a clear bit in bitmap block bp at or after bit bi,
+// skipping full 64-bit words, for a block below sb.size.
+// b is the first block bp describes. Returns the bit or -1.
+static int
+bscan(struct buf *bp, uint b, uint bi)
+{
+  uint64 *w = (uint64*)bp->data;
+
+  while(bi < BPB && b + bi < sb.size){
+    if(w[bi/64] == ~0UL){
+      bi = (bi + 64) & ~63;
+      continue;
+    }
+    if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+      return bi;
+    bi++;
+  }
+  return -1;
+}
+
+// Allocate a zeroed disk block, the first free one at or
+// after goal, or after the allocation hint if goal is 0.
+// The scan wraps around, so successive allocations don't
+// rescan the blocks in use at the start of the disk.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, start, bi, i, nbmap;
+  int r;
+  struct buf *bp;
+
+  acquire(&fsalloc.lock);
+  if(fsalloc.nfree == 0)
+    panic("balloc: out of blocks");
+  start = goal && goal < sb.size ? goal : fsalloc.bnext;
+  release(&fsalloc.lock);
+
+  nbmap = (sb.size + BPB - 1) / BPB;
+  b = start - start % BPB;
+  bi = start % BPB;
+  // one extra pass over the first bitmap block covers the
+  // bits before the hint.
+  for(i = 0; i <= nbmap; i++){
+    bp = bread(dev, BBLOCK(b, sb));
+    if((r = bscan(bp, b, bi)) >= 0){
+      bp->data[r/8] |= 1 << (r % 8);  // Mark block in use.
+      log_write(bp);
+      brelse(bp);
+      acquire(&fsalloc.lock);
+      fsalloc.nfree--;
+      fsalloc.bnext = b + r + 1 < sb.size ? b + r + 1 : 0;
+      release(&fsalloc.lock);
+      bzero(dev, b + r);
+      return b + r;
+    }
+    brelse(bp);
+    bi = 0;
+    b += BPB;
+    if(b >= sb.size)
+      b = 0;
+  }
   panic("balloc: out of blocks");
 }
 
@@ -100,6 +211,21 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&fsalloc.lock);
+  fsalloc.nfree++;
+  release(&fsalloc.lock);
+}
+
+// Number of free blocks on the file system.
+uint
+bfreecount(void)
+{
+  uint n;
+
+  acquire(&fsalloc.lock);
+  n = fsalloc.nfree;
+  release(&fsalloc.lock);
+  return n;
 }
 
 // Inodes.
@@ -142,7 +268,8 @@ bfree(int dev, uint b)
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode.
+//   has first locked the inode. ilockshared() locks it for
+//   examining only, alongside other such readers.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -162,28 +289,106 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// Cached entries are hashed by (dev, inum) into NIBUCKET
+// chains. A bucket's spin-lock protects its chain and the ref of
+// the entries on it. Since ip->ref indicates whether an entry is
+// in use, and ip->dev and ip->inum indicate which i-node an entry
+// holds, one must hold the entry's bucket lock while using any of
+// those fields. Entries with ref == 0 stay cached, and are also on
+// an LRU list, protected by icache.lrulock, from which iget()
+// recycles. icache.lock serializes recycling, which moves an
+// entry from one bucket to another.
+// Lock order: icache.lock, bucket locks, icache.lrulock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 31
+
+static void dcache_init(void);
+static void dcache_purge(uint dev, uint dir);
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode *head;   // linked by ip->hnext
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *inode;  // inode[ninode], sized by iinit()
+  int ninode;
+  struct ibucket bucket[NIBUCKET];
+  struct spinlock lrulock;
+  struct inode lru;     // head of the list of entries with ref == 0
 } icache;
 
+static struct ibucket*
+ihash(uint dev, uint inum)
+{
+  return &icache.bucket[(dev * 31 + inum) % NIBUCKET];
+}
+
+// Put ip, whose ref just dropped to 0, at the end of
+// the LRU list. Caller holds ip's bucket lock.
+static void
+lru_add(struct inode *ip)
+{
+  acquire(&icache.lrulock);
+  ip->lrunext = &icache.lru;
+  ip->lruprev = icache.lru.lruprev;
+  icache.lru.lruprev->lrunext = ip;
+  icache.lru.lruprev = ip;
+  release(&icache.lrulock);
+}
+
+// Take ip, whose ref is about to become 1, off the
+// LRU list. Caller holds ip's bucket lock.
+static void
+lru_remove(struct inode *ip)
+{
+  acquire(&icache.lrulock);
+  ip->lrunext->lruprev = ip->lruprev;
+  ip->lruprev->lrunext = ip->lrunext;
+  ip->lrunext = ip->lruprev = 0;
+  release(&icache.lrulock);
+}
+
+// Return the entry in bk for (dev, inum), or 0.
+// Caller holds bk->lock.
+static struct inode*
+ifind(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  }
+  return 0;
+}
+
+// Size the inode cache by the process table.
+// Called before kinit().
 void
 iinit()
 {
   int i = 0;
   
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
+  initlock(&icache.lrulock, "icache.lru");
+  dcache_init();
+  for(i = 0; i < NIBUCKET; i++)
+    initlock(&icache.bucket[i].lock, "icache.bucket");
+  icache.ninode = nprocs;
+  if(icache.ninode < NINODE)
+    icache.ninode = NINODE;
+  icache.inode = bootalloc(icache.ninode * sizeof(struct inode));
+  icache.lru.lrunext = icache.lru.lruprev = &icache.lru;
+  for(i = 0; i < icache.ninode; i++) {
     initsleeplock(&icache.inode[i].lock, "inode");
+    initlock(&icache.inode[i].maplock, "inode.map");
+    lru_add(&icache.inode[i]);
   }
 }
 
@@ -192,23 +397,53 @@ static struct inode* iget(uint dev, uint inum);
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
+// A file goes in the group of inode near, its directory.
+// A directory goes in the group after the last directory's,
+// so directories and the files in them spread over the disk.
+// Either way, reads each inode block once.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  uint inum, start, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  if(dev == TMPDEV){
+    if((inum = tmpialloc(type)) == 0)
+      return 0;
+    return iget(dev, inum);
+  }
+
+  acquire(&fsalloc.lock);
+  if(type == T_DIR || near == 0)
+    start = fsalloc.inext;
+  else
+    start = ginode(igroup(near));
+  release(&fsalloc.lock);
+  if(start < 1 || start >= sb.ninodes)
+    start = 1;
+
+  inum = start;
+  for(n = 0; n < sb.ninodes - 1; ){
     bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
+    do {
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(dip->type == 0){  // a free inode
+        memset(dip, 0, sizeof(*dip));
+        dip->type = type;
+        log_write(bp);   // mark it allocated on the disk
+        brelse(bp);
+        if(type == T_DIR || near == 0){
+          acquire(&fsalloc.lock);
+          fsalloc.inext = ginode((igroup(inum) + 1) % fsalloc.ngroups);
+          release(&fsalloc.lock);
+        }
+        return iget(dev, inum);
+      }
+      n++;
+      if(++inum >= sb.ninodes)
+        inum = 1;
+    } while(inum % IPB != 0 && inum != 1 && n < sb.ninodes - 1);
     brelse(bp);
   }
   panic("ialloc: no inodes");
@@ -224,6 +459,10 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
+  if(ip->dev == TMPDEV){
+    tmpiupdate(ip);
+    return;
+  }
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
@@ -232,6 +471,7 @@ iupdate(struct inode *ip)
   dip->nlink = ip->nlink;
   dip->size = ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->data, ip->data, sizeof(ip->data));
   log_write(bp);
   brelse(bp);
 }
@@ -242,33 +482,68 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
-
-  acquire(&icache.lock);
+  struct ibucket *bk = ihash(dev, inum);
+  struct ibucket *ob;
+  struct inode *ip;
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+  acquire(&bk->lock);
+  if((ip = ifind(bk, dev, inum)) != 0)
+    goto found;
+  release(&bk->lock);
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Not cached; recycle the least recently used entry.
+  // Check again, since another iget() may have raced us here.
+  acquire(&icache.lock);
+  acquire(&bk->lock);
+  if((ip = ifind(bk, dev, inum)) != 0){
+    release(&icache.lock);
+    goto found;
+  }
+  for(;;){
+    acquire(&icache.lrulock);
+    ip = icache.lru.lrunext;
+    release(&icache.lrulock);
+    if(ip == &icache.lru)
+      panic("iget: no inodes");
+
+    // Lock the victim's bucket, so that nobody can find it, and
+    // make sure that it was not taken before we got the lock.
+    ob = ip->inum ? ihash(ip->dev, ip->inum) : 0;
+    if(ob && ob != bk)
+      acquire(&ob->lock);
+    if(ip->ref == 0 && ip->lrunext != 0)
+      break;
+    if(ob && ob != bk)
+      release(&ob->lock);
+  }
+  lru_remove(ip);
+  if(ip->pages)
+    pcdrop(ip);
+  if(ob){
+    struct inode **pp;
+    for(pp = &ob->head; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+    if(ob != bk)
+      release(&ob->lock);
+  }
+  release(&icache.lock);
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
+  ip->hnext = bk->head;
+  bk->head = ip;
+  release(&bk->lock);
+  return ip;
 
+found:
+  if(ip->ref == 0)
+    lru_remove(ip);
+  ip->ref++;
+  release(&bk->lock);
   return ip;
 }
 
@@ -277,9 +552,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -297,26 +574,55 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    if(ip->dev == TMPDEV){
+      tmpiload(ip);
+    } else {
+      bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+      dip = (struct dinode*)bp->data + ip->inum%IPB;
+      ip->type = dip->type;
+      ip->major = dip->major;
+      ip->minor = dip->minor;
+      ip->nlink = dip->nlink;
+      ip->size = dip->size;
+      memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+      memmove(ip->data, dip->data, sizeof(ip->data));
+      brelse(bp);
+    }
+    ip->mapvalid = 0;
+    ip->lastblock = 0;
+    ip->text = 1;  // not known, so writes must check the text cache
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode shared, for reading it: readi() and
+// stati() callers and directory lookups may hold an inode
+// together, while ilock() excludes them all.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquiresleepshared(&ip->lock);
+  while(ip->valid == 0){
+    // reading the inode in from disk changes it, so do
+    // that exclusively. Our reference keeps it valid after.
+    releasesleep(&ip->lock);
+    ilock(ip);
+    releasesleep(&ip->lock);
+    acquiresleepshared(&ip->lock);
+  }
+}
+
+// Unlock the given inode, locked by ilock() or ilockshared().
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || ip->ref < 1 ||
+     !(holdingsleep(&ip->lock) || holdingsleepshared(&ip->lock)))
     panic("iunlock");
 
   releasesleep(&ip->lock);
@@ -332,7 +638,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct ibucket *bk = ihash(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -341,8 +649,10 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&icache.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -350,11 +660,13 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquire(&bk->lock);
   }
 
   ip->ref--;
-  release(&icache.lock);
+  if(ip->ref == 0)
+    lru_add(ip);
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -372,46 +684,134 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
+// Allocate a block for ip: straight after the last one
+// allocated to it, or else at the start of its inode's group.
+static uint
+bmap_alloc(struct inode *ip)
+{
+  uint goal;
+
+  goal = ip->lastblock ? ip->lastblock + 1 : gblock(igroup(ip->inum));
+  ip->lastblock = balloc(ip->dev, goal);
+  return ip->lastblock;
+}
+
+// Look up (and allocate if necessary) entry i of the indirect
+// block in bp, and remember the entries around it in ip's map
+// window. bn is the block's index past the direct blocks.
+static uint
+bmap_ind(struct inode *ip, struct buf *bp, uint i, uint bn)
+{
+  uint addr, *a = (uint*)bp->data;
+
+  if((addr = a[i]) == 0){
+    a[i] = addr = bmap_alloc(ip);
+    log_write(bp);
+  }
+  acquire(&ip->maplock);
+  ip->mapbase = bn - bn % NMAPWIN;
+  memmove(ip->map, &a[i - i % NMAPWIN], sizeof(ip->map));
+  ip->mapvalid = 1;
+  release(&ip->maplock);
+  return addr;
+}
+
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = bmap_alloc(ip);
     return addr;
   }
   bn -= NDIRECT;
 
+  // Recently looked-up indirect entry?
+  acquire(&ip->maplock);
+  if(ip->mapvalid && bn - ip->mapbase < NMAPWIN &&
+     (addr = ip->map[bn - ip->mapbase]) != 0){
+    release(&ip->maplock);
+    return addr;
+  }
+  release(&ip->maplock);
+
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = bmap_alloc(ip);
+    bp = bread(ip->dev, addr);
+    addr = bmap_ind(ip, bp, bn, bn);
+    brelse(bp);
+    return addr;
+  }
+
+  if(bn - NINDIRECT < NDINDIRECT){
+    uint i = bn - NINDIRECT;
+    uint *a;
+
+    // Load doubly-indirect block, then the indirect block
+    // it points to, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = bmap_alloc(ip);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[i / NINDIRECT]) == 0){
+      a[i / NINDIRECT] = addr = bmap_alloc(ip);
       log_write(bp);
     }
     brelse(bp);
+    bp = bread(ip->dev, addr);
+    addr = bmap_ind(ip, bp, i % NINDIRECT, bn);
+    brelse(bp);
     return addr;
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it points to,
+// descending depth more levels of indirection.
+static void
+ifree(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      ifree(dev, a[j], depth - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(ip->text)
+    textinval(ip);
+  if(ip->pages)
+    pcdrop(ip);
+  if(ip->dev == TMPDEV){
+    tmpitrunc(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -421,21 +821,31 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    ifree(ip->dev, ip->addrs[NDIRECT], 0);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    ifree(ip->dev, ip->addrs[NDIRECT+1], 1);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->mapvalid = 0;
+  ip->lastblock = 0;
   ip->size = 0;
   iupdate(ip);
 }
 
+// Does ip keep its bytes in the dinode? Small regular files
+// do, until a write takes them past NINLINE; from then on
+// they have blocks, as they keep until itrunc().
+static int
+iinline(struct inode *ip)
+{
+  return ip->type == T_FILE && ip->size <= NINLINE && ip->addrs[0] == 0;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -449,7 +859,7 @@ stati(struct inode *ip, struct stat *st)
 }
 
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
@@ -462,8 +872,26 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(ip->dev == TMPDEV)
+    return tmpreadi(ip, user_dst, dst, off, n);
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+  if(iinline(ip)){
+    // ilock() has read the bytes in with the rest of the inode.
+    if(either_copyout(user_dst, dst, ip->data + off, n) == -1)
+      return 0;
+    return n;
+  }
+
+  // File data comes from the page cache; the buffer cache is
+  // left to directories, and to files when memory is short.
+  tot = 0;
+  if(ip->type == T_FILE){
+    tot = pcread(ip, user_dst, dst, off, n);
+    off += tot;
+    dst += tot;
+  }
+
+  for(; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
@@ -475,6 +903,48 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading the blocks of ip that hold bytes [off, off+n)
+// into the buffer cache, without waiting for them.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint blocks[NREADAHEAD];
+  uint bn, end;
+  int nb = 0;
+
+  if(off >= ip->size || iinline(ip) || ip->dev == TMPDEV)
+    return;
+  if(n > ip->size - off)
+    n = ip->size - off;
+  end = (off + n + BSIZE - 1) / BSIZE;
+  // blocks below ip->size always exist, so bmap() won't allocate.
+  // Blocks whose page is cached will not be read from the disk.
+  for(bn = off / BSIZE; bn < end && nb < NREADAHEAD; bn++)
+    if(!pcpresent(ip, bn * BSIZE / PGSIZE))
+      blocks[nb++] = bmap(ip, bn);
+  breadahead(ip->dev, blocks, nb);
+}
+
+// Fill mem with page pgno of ip's data for the page cache,
+// zeroing what lies past the end of the file. The buffers are
+// released cold, since the page now holds their bytes.
+// Caller must hold ip->lock.
+void
+ifill(struct inode *ip, uint pgno, char *mem)
+{
+  struct buf *bp;
+  uint off, base = pgno * PGSIZE;
+
+  for(off = 0; off < PGSIZE && base + off < ip->size; off += BSIZE){
+    bp = bread(ip->dev, bmap(ip, (base + off) / BSIZE));
+    memmove(mem + off, bp->data, BSIZE);
+    bdrop(bp);
+  }
+  if(ip->size - base < PGSIZE)
+    memset(mem + (ip->size - base), 0, PGSIZE - (ip->size - base));
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -489,6 +959,31 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->textrun > 0)
+    return -1;  // a process is running it
+  if(ip->text)
+    textinval(ip);
+  if(ip->dev == TMPDEV)
+    return tmpwritei(ip, user_src, src, off, n);
+
+  if(iinline(ip)){
+    if(off + n <= NINLINE){
+      if(either_copyin(ip->data + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    // Outgrowing the dinode: what it holds becomes block 0.
+    if(ip->size > 0){
+      bp = bread(ip->dev, bmap(ip, 0));
+      memmove(bp->data, ip->data, ip->size);
+      log_write(bp);
+      brelse(bp);
+    }
+    memset(ip->data, 0, sizeof(ip->data));
+  }
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -498,6 +993,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
+    pcwrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     brelse(bp);
   }
 
@@ -521,8 +1017,238 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache.
+//
+// Remembers the results of dirlookup(), both hits (with the
+// entry's offset) and misses (inum 0), so that repeated lookups
+// don't scan the directory. The cache is set-associative:
+// (dev, dir, name) hashes to a set of DCACHE_WAYS entries, and
+// the least recently used entry of the set is replaced. A
+// directory's entries change only with the directory locked, and
+// the changes (dirlink(), sys_unlink()) update the cache before
+// the lock is released, so cached results are never stale.
+
+#define DCACHE_SETS 64
+#define DCACHE_WAYS 4
+
+struct dcentry {
+  uint dev;
+  uint dir;           // directory inum; 0 if the entry is free
+  uint inum;          // 0 for a negative entry
+  uint off;           // offset of the dirent, if inum != 0
+  uint used;          // dcache.clock at the last use
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;
+  struct dcentry set[DCACHE_SETS][DCACHE_WAYS];
+} dcache;
+
+static void
+dcache_init(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dcentry*
+dcache_set(struct inode *dp, char *name)
+{
+  uint h = dp->dev * 31 + dp->inum;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return dcache.set[h % DCACHE_SETS];
+}
+
+// Find dp's cached entry for name in set s.
+// Caller holds dcache.lock.
+static struct dcentry*
+dcache_find(struct dcentry *s, struct inode *dp, char *name)
+{
+  for(int i = 0; i < DCACHE_WAYS; i++){
+    if(s[i].dir == dp->inum && s[i].dev == dp->dev &&
+       namecmp(s[i].name, name) == 0)
+      return &s[i];
+  }
+  return 0;
+}
+
+// Look name up in dp in the cache. Returns 1 and sets
+// *inum (0 if name is known to be absent) and *off on a hit.
+static int
+dcache_lookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  e = dcache_find(dcache_set(dp, name), dp, name);
+  if(e){
+    e->used = ++dcache.clock;
+    *inum = e->inum;
+    *off = e->off;
+  }
+  release(&dcache.lock);
+  return e != 0;
+}
+
+// Record that name in dp is inum at off, or absent if inum is 0.
+static void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dcentry *s, *e;
+
+  acquire(&dcache.lock);
+  s = dcache_set(dp, name);
+  if((e = dcache_find(s, dp, name)) == 0){
+    e = &s[0];
+    for(int i = 1; i < DCACHE_WAYS; i++){
+      if(s[i].used < e->used)
+        e = &s[i];
+    }
+  }
+  e->dev = dp->dev;
+  e->dir = dp->inum;
+  e->inum = inum;
+  e->off = off;
+  e->used = ++dcache.clock;
+  strncpy(e->name, name, DIRSIZ);
+  release(&dcache.lock);
+}
+
+// name has been removed from dp. Caller holds dp->lock.
+void
+dcache_remove(struct inode *dp, char *name)
+{
+  dcache_enter(dp, name, 0, 0);
+}
+
+// Directory (dev, dir) is being freed; forget its entries.
+static void
+dcache_purge(uint dev, uint dir)
+{
+  acquire(&dcache.lock);
+  for(int i = 0; i < DCACHE_SETS; i++){
+    for(int j = 0; j < DCACHE_WAYS; j++){
+      struct dcentry *e = &dcache.set[i][j];
+      if(e->dir == dir && e->dev == dev)
+        e->dir = 0;
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Hashed directories.
+
+// Does dp have the hashed layout? Linear directories
+// have "." in slot 0.
+static int
+dirhashed(struct inode *dp)
+{
+  struct buf *bp;
+  struct dirmeta *m;
+  int r;
+
+  if(dp->size < BSIZE || dp->dev == TMPDEV)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  m = (struct dirmeta*)bp->data;
+  r = m->inum == 0 && m->w[0] == DIRMAGIC;
+  brelse(bp);
+  return r;
+}
+
+// Search the entry slots of block bn of hashed directory dp
+// for name. Returns its inum and sets *poff, or returns 0.
+// Sets *pfree to the offset of the first empty slot, unless
+// it is already set, and *pnext to the next block to search:
+// the head of name's chain, or the link to the next in it.
+static uint
+dirscan(struct inode *dp, uint bn, char *name, uint *poff, int *pfree, uint *pnext)
+{
+  struct buf *bp;
+  struct dirent *de;
+  struct dirmeta *m;
+  uint h, i, inum = 0;
+
+  bp = bread(dp->dev, bmap(dp, bn));
+  de = (struct dirent*)bp->data;
+  m = (struct dirmeta*)bp->data;
+  for(i = (bn == 0 ? DIRTAB + 1 : 1); i < DIRSLOTS; i++){
+    if(de[i].inum == 0){
+      if(*pfree < 0)
+        *pfree = bn*BSIZE + i*sizeof(*de);
+    } else if(namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      *poff = bn*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  h = dirhash(name);
+  *pnext = bn == 0 ? m[1 + h/7].w[h%7] : m[0].w[0];
+  brelse(bp);
+  return inum;
+}
+
+// Look name up in hashed directory dp: in the header block,
+// then along its chain. Returns the inum, setting *poff, or 0.
+// Either way *pfree is the first free slot on the way, or -1,
+// and *plast the block the search ended in.
+static uint
+hashlookup(struct inode *dp, char *name, uint *poff, int *pfree, uint *plast)
+{
+  uint bn = 0, next, inum;
+
+  *pfree = -1;
+  for(;;){
+    if((inum = dirscan(dp, bn, name, poff, pfree, &next)) != 0)
+      break;
+    if(next == 0)
+      break;
+    bn = next;
+  }
+  *plast = bn;
+  return inum;
+}
+
+// Add a block of zeroes to the end of directory dp, and
+// return its number in dp, or 0 if a chain link can't hold it.
+static uint
+dirgrow(struct inode *dp)
+{
+  uint bn = dp->size / BSIZE;
+
+  if(bn > 0xffff || bn >= MAXFILE)
+    return 0;
+  bmap(dp, bn);  // balloc() zeroes it
+  dp->size = (bn + 1) * BSIZE;
+  iupdate(dp);
+  return bn;
+}
+
+// Give the new, empty directory dp the hashed layout.
+// Caller holds dp->lock, inside a transaction.
+void
+dirinit(struct inode *dp)
+{
+  struct dirmeta m;
+
+  if(dp->type != T_DIR || dp->size != 0)
+    panic("dirinit");
+  if(dp->dev == TMPDEV)
+    return;  // tmpfs directories stay linear
+  dirgrow(dp);
+  memset(&m, 0, sizeof(m));
+  m.w[0] = DIRMAGIC;
+  if(writei(dp, 0, (uint64)&m, 0, sizeof(m)) != sizeof(m))
+    panic("dirinit");
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// A hashed directory reads only the blocks a name can be in;
+// a linear one is scanned in full.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -532,6 +1258,28 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcache_lookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if(dirhashed(dp)){
+    int free;
+    uint last;
+
+    if((inum = hashlookup(dp, name, &off, &free, &last)) == 0){
+      dcache_enter(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = off;
+    dcache_enter(dp, name, inum, off);
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -542,13 +1290,39 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcache_enter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcache_enter(dp, name, 0, 0);
   return 0;
 }
 
+// Return a reference to the inode that the entry (name, inum)
+// of directory dp leads to, as a path through dp would reach
+// it: the tmpfs root for its mount point, and the mount point's
+// parent for ".." of the tmpfs root. Caller holds dp->lock.
+struct inode*
+direntget(struct inode *dp, char *name, uint inum)
+{
+  struct inode *ip, *up;
+
+  if(dp->dev == TMPDEV && dp->inum == ROOTINO && namecmp(name, "..") == 0){
+    // no one holds the mount point while locking the tmpfs root.
+    ip = iget(ROOTDEV, tmpmnt);
+    ilockshared(ip);
+    up = dirlookup(ip, "..", 0);
+    iunlockput(ip);
+    return up;
+  }
+  if(inum == dp->inum)
+    return idup(dp);
+  if(tmpmnt && dp->dev == ROOTDEV && inum == tmpmnt)
+    return iget(TMPDEV, ROOTINO);
+  return iget(dp->dev, inum);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
@@ -563,18 +1337,41 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dirhashed(dp)){
+    uint h, bn, last, link, unused;
+    ushort next;
+
+    // The free slot nearest the header, or else a new
+    // block at the end of name's chain.
+    hashlookup(dp, name, &unused, &off, &last);
+    if(off < 0){
+      if((bn = dirgrow(dp)) == 0)
+        return -1;
+      h = dirhash(name);
+      if(last == 0)
+        link = (1 + h/7)*sizeof(struct dirmeta) + 2 + (h%7)*sizeof(ushort);
+      else
+        link = last*BSIZE + 2;
+      next = bn;
+      if(writei(dp, 0, (uint64)&next, link, sizeof(next)) != sizeof(next))
+        panic("dirlink link");
+      off = bn*BSIZE + sizeof(de);
+    }
+  } else {
+    // Look for an empty dirent.
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlink read");
+      if(de.inum == 0)
+        break;
+    }
   }
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
@@ -633,7 +1430,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
@@ -643,11 +1440,22 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
+    if(ip->dev == TMPDEV && ip->inum == ROOTINO && namecmp(name, "..") == 0){
+      // out of the tmpfs, to the parent of its mount point.
+      iunlockput(ip);
+      ip = iget(ROOTDEV, tmpmnt);
+      ilockshared(ip);
+    }
     if((next = dirlookup(ip, name, 0)) == 0){
       iunlockput(ip);
       return 0;
     }
     iunlockput(ip);
+    if(tmpmnt && next->dev == ROOTDEV && next->inum == tmpmnt){
+      // into the tmpfs mounted here.
+      iput(next);
+      next = iget(TMPDEV, ROOTINO);
+    }
     ip = next;
   }
   if(nameiparent){
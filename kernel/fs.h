@@ -3,11 +3,21 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+
+// Block size, a multiple of 1024. The kernel, mkfs and user
+// programs must agree on it, so it is chosen for the whole
+// build (make FSBSIZE=4096); the superblock records it.
+#ifndef BSIZE
+#define BSIZE 1024
+#endif
+
+#define SBOFF 1024   // byte offset of the superblock, whatever BSIZE is
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                             free bit map | swap area | data blocks]
+// With blocks bigger than SBOFF, the super block is in the boot
+// block, and block 1 is unused.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +30,18 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // BSIZE of the image
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of swap blocks; 0 if none
 };
 
-#define FSMAGIC 0x10203040
+#define FSMAGIC 0x10203041   // 128-byte dinodes
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+#define NINLINE 64   // bytes a small file keeps in its dinode
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +50,10 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses: direct,
+                           // singly- and doubly-indirect
+  uchar data[NINLINE];  // A T_FILE's bytes, while they all fit here
+                        // and it has no blocks
 };
 
 // Inodes per block.
@@ -50,6 +68,10 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
+// Data blocks per allocation group; the inodes are split
+// into as many groups as the data blocks.
+#define BPG           BPB
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -58,3 +80,33 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+#define DIRSLOTS (BSIZE / sizeof(struct dirent))   // dirents per block
+
+// A hashed directory starts with a header block. Its slot 0
+// holds DIRMAGIC; slots 1 to DIRTAB hold the first chain block
+// of each of the NDIRBUCKET buckets, 7 to a slot; the rest hold
+// entries, as in a linear directory. An entry that finds them
+// full goes to the chain of blocks that its name hashes to,
+// where slot 0 of each block links to the next. These meta
+// slots all have inum 0, so code that simply reads dirents
+// skips them. A linear directory has "." in slot 0.
+#define DIRMAGIC   0x4844
+#define NDIRBUCKET 32
+#define DIRTAB     ((NDIRBUCKET + 6) / 7)
+
+struct dirmeta {
+  ushort inum;   // always 0
+  ushort w[7];   // DIRMAGIC; bucket heads; the next chain block
+};
+
+// The bucket of a directory entry name, for mkfs too.
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 0;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (unsigned char)name[i];
+  return h % NDIRBUCKET;
+}
+
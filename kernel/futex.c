@@ -0,0 +1,134 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futexwait() sleeps only if the word still holds the value the
+// caller saw, checked under the lock of the word's hash bucket;
+// futexwake() takes the same lock, so a wakeup that follows a
+// change to the word cannot slip in between the check and the
+// sleep. A private word is keyed by its address space and
+// virtual address, which threads sharing it through clone()
+// agree on, and which stay put when copy-on-write after a
+// fork() or swapping moves the word to another page. A word in
+// a MAP_SHARED region is keyed by physical address instead, so
+// that processes mapping the page meet in the same queue
+// whatever address each has it at.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 64   // hash buckets
+
+// A waiter, on its own kernel stack.
+struct futexw {
+  struct mm *mm;         // address space of a private word; 0 if shared
+  uint64 addr;           // its virtual address, or physical if shared
+  int woken;
+  struct futexw *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct futexw *head;
+} futextab[NFUTEX];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEX; i++)
+    initlock(&futextab[i].lock, "futex");
+}
+
+// Find the key of the user word at va, faulting its page in.
+// Returns the hash bucket, or -1 if va is no good.
+static int
+futexkey(uint64 va, struct mm **mmp, uint64 *addrp)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  if(va % sizeof(uint) != 0 || (pa = uvmuseraddr(p->pagetable, va)) == 0)
+    return -1;
+  if(mmapshared(p->mm, va)){
+    // a shared page is never copy-on-write or swapped out.
+    *mmp = 0;
+    *addrp = pa;
+  } else {
+    *mmp = p->mm;
+    *addrp = va;
+  }
+  return ((uint64)*mmp / sizeof(struct mm) + *addrp / sizeof(uint)) % NFUTEX;
+}
+
+// Sleep until woken by futexwake() on va, if the word at va
+// holds val. Returns 0 once woken, -1 if the word differs or
+// the process was killed.
+int
+futexwait(uint64 va, uint val)
+{
+  struct proc *p = myproc();
+  struct futexw w, **wp;
+  uint64 pa;
+  int b;
+
+  if((b = futexkey(va, &w.mm, &w.addr)) < 0)
+    return -1;
+  acquire(&futextab[b].lock);
+  // look the page up again, since it may have moved; with the
+  // lock held it can't be faulted back in, and the wait fails.
+  if((pa = walkaddr(p->pagetable, va)) == 0 ||
+     *(volatile uint*)(pa + va % PGSIZE) != val){
+    release(&futextab[b].lock);
+    return -1;
+  }
+  w.woken = 0;
+  w.next = futextab[b].head;
+  futextab[b].head = &w;
+  while(!w.woken && !p->killed)
+    sleep(&w, &futextab[b].lock);
+  if(!w.woken){
+    for(wp = &futextab[b].head; *wp != &w; wp = &(*wp)->next)
+      ;
+    *wp = w.next;
+  }
+  release(&futextab[b].lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n waiters on va, oldest first.
+// Returns the number woken.
+int
+futexwake(uint64 va, int n)
+{
+  struct futexw *w, **wp, *last;
+  struct mm *mm;
+  uint64 addr;
+  int b, woken = 0;
+
+  if((b = futexkey(va, &mm, &addr)) < 0)
+    return -1;
+  acquire(&futextab[b].lock);
+  while(woken < n){
+    // waiters push themselves on the head, so the
+    // oldest match is the last one.
+    last = 0;
+    for(wp = &futextab[b].head; (w = *wp) != 0; wp = &w->next)
+      if(w->mm == mm && w->addr == addr)
+        last = w;
+    if(last == 0)
+      break;
+    for(wp = &futextab[b].head; *wp != last; wp = &(*wp)->next)
+      ;
+    *wp = last->next;
+    last->woken = 1;
+    wakeup(last);
+    woken++;
+  }
+  release(&futextab[b].lock);
+  return woken;
+}
@@ -0,0 +1,38 @@
+// ioring_enter(): a submission queue and a completion queue
+// in user memory. The program fills sq[sqtail % NIORING] and
+// then advances sqtail; each ioring_enter() runs the queued
+// requests in order, posting each result at cq[cqtail % NIORING],
+// for as long as the completion queue has room. The program
+// advances cqhead as it consumes them. Indices only grow.
+
+#define NIORING 32   // entries in each queue
+
+#define IO_READ   1   // fd, addr, len; res = bytes read
+#define IO_WRITE  2   // fd, addr, len; res = bytes written
+#define IO_OPEN   3   // addr = path, len = omode; res = fd
+#define IO_CLOSE  4   // fd
+#define IO_FSYNC  5   // fd
+
+struct iosqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int len;
+  int pad;
+  uint64 data;   // copied to the completion
+};
+
+struct iocqe {
+  uint64 data;
+  int res;       // as the system call would return
+  int pad;
+};
+
+struct ioring {
+  uint sqhead;   // advanced by the kernel
+  uint sqtail;   // advanced by the program
+  uint cqhead;   // advanced by the program
+  uint cqtail;   // advanced by the kernel
+  struct iosqe sq[NIORING];
+  struct iocqe cq[NIORING];
+};
@@ -1,6 +1,22 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list and lock, so allocations
+// on different CPUs don't contend. A CPU whose list is empty
+// steals a batch of pages from another CPU's list.
+//
+// A kernel thread zeroes free pages at the lowest scheduling
+// priority and keeps them for kzalloc(), so that user memory
+// rarely has to be zeroed on the allocating path.
+//
+// Caches that hold pages they could do without register a
+// shrinker (kshrinker()). When free memory falls below
+// KLOWPAGES, kzalloc() wakes the kreclaim thread, which calls
+// the shrinkers until KHIGHPAGES are free again, and then on
+// swapout() for user memory; and a kalloc() that finds nothing
+// at all calls the shrinkers itself before failing. Callers
+// that may sleep can wait for kreclaim instead (kreclaimwait()).
 
 #include "types.h"
 #include "param.h"
@@ -9,7 +25,22 @@
 #include "riscv.h"
 #include "defs.h"
 
+// number of pages kalloc() moves from another CPU's
+// free list when the local list runs dry.
+#define STEAL_BATCH 32
+
+// free-page watermarks for the kreclaim thread.
+#define KLOWPAGES   128
+#define KHIGHPAGES  512
+
+// pages asked of the shrinkers at a time.
+#define SHRINK_BATCH 32
+
+#define NSHRINKER 4
+
 void freerange(void *pa_start, void *pa_end);
+static struct run *zget(int wake);
+static int kshrink(int n);
 
 extern char end[]; // first address after kernel.
 // defined by kernel.ld.
@@ -18,45 +49,209 @@ struct run {
     struct run *next;
 };
 
-struct {
+struct kmem {
     struct spinlock lock;
     struct run *freelist;
-} kmem;
+    uint64 nfree;       // number of pages on freelist
+};
+
+struct kmem kmem[NCPU];
+
+// Pages zeroed by kzero() for kzalloc(), linked through their
+// first word. They are allocated (reference count 1) but are
+// counted as free.
+struct {
+    struct spinlock lock;
+    struct run *list;
+    int n;
+    int waiting;        // kzero() sleeps until the pool drains
+} zpool;
+
+// Functions that give back up to n pages and return how many
+// they freed. Registered at boot, so read without a lock.
+struct {
+    int n;
+    struct {
+        char *name;
+        int (*fn)(int);
+    } s[NSHRINKER];
+} shrinkers;
+
+struct {
+    struct spinlock lock;
+    int want;           // kreclaim() has been asked to run
+    int passes;         // times kreclaim() has run
+    int freed;          // pages it freed the last time
+} reclaim;
+
+// Tables sized at boot take memory from the start of free RAM,
+// before kinit() hands the rest to the page allocator.
+static char *bootfree;
+static int kinited;
+
+// Reference counts for every physical page, so that copy-on-write
+// fork can share a page among several page tables. kalloc() sets
+// a page's count to 1 and kfree() only frees it once the count
+// drops to 0. Updated with atomic instructions, so no lock.
+#define PA2REF(pa) (((uint64) (pa) - KERNBASE) / PGSIZE)
+static int pageref[PA2REF(PHYSTOP)];
 
 void
 kinit() {
-    initlock(&kmem.lock, "kmem");
-    freerange(end, (void *) PHYSTOP);
+    for (int i = 0; i < NCPU; i++)
+        initticketlock(&kmem[i].lock, "kmem");
+    initlock(&zpool.lock, "zpool");
+    initlock(&reclaim.lock, "reclaim");
+    kinited = 1;
+    freerange(bootfree ? bootfree : end, (void *) PHYSTOP);
+}
+
+// Allocate n zeroed bytes of physically contiguous memory
+// that is never freed. Only usable before kinit().
+void *
+bootalloc(uint64 n) {
+    char *p;
+
+    if (kinited)
+        panic("bootalloc");
+    if (bootfree == 0)
+        bootfree = end;
+    p = (char *) (((uint64) bootfree + 15) & ~15L);
+    if (p + n > (char *) PHYSTOP)
+        panic("bootalloc: out of memory");
+    bootfree = p + n;
+    memset(p, 0, n);
+    return p;
 }
 
+// Bytes of RAM the kernel has not used yet, for sizing
+// tables before kinit().
+uint64
+bootmem(void) {
+    return PHYSTOP - (uint64) (bootfree ? bootfree : end);
+}
+
+// Hand the pages in [pa_start, pa_end) to the allocator,
+// dealing them round-robin across the per-CPU free lists
+// so that no CPU has to steal right after boot.
 void
 freerange(void *pa_start, void *pa_end) {
     char *p;
+    int id = 0;
+
     p = (char *) PGROUNDUP((uint64) pa_start);
-    for (; p + PGSIZE <= (char *) pa_end; p += PGSIZE)
-        kfree(p);
+    for (; p + PGSIZE <= (char *) pa_end; p += PGSIZE) {
+        struct run *r = (struct run *) p;
+
+#ifdef JUNKFILL
+        memset(p, 1, PGSIZE);
+#endif
+        acquire(&kmem[id].lock);
+        r->next = kmem[id].freelist;
+        kmem[id].freelist = r;
+        kmem[id].nfree++;
+        release(&kmem[id].lock);
+        id = (id + 1) % NCPU;
+    }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// When the last reference goes away, the page goes on the
+// current CPU's free list.
 void
 kfree(void *pa) {
     struct run *r;
+    int id, ref;
 
     if (((uint64) pa % PGSIZE) != 0 || (char *) pa < end || (uint64) pa >= PHYSTOP)
         panic("kfree");
 
+    ref = __sync_sub_and_fetch(&pageref[PA2REF(pa)], 1);
+    if (ref > 0)
+        return;
+    if (ref < 0)
+        panic("kfree: ref");
+
+#ifdef JUNKFILL
     // Fill with junk to catch dangling refs.
     memset(pa, 1, PGSIZE);
+#endif
 
     r = (struct run *) pa;
 
-    acquire(&kmem.lock);
-    r->next = kmem.freelist;
-    kmem.freelist = r;
-    release(&kmem.lock);
+    push_off();
+    id = cpuid();
+    acquire(&kmem[id].lock);
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = r;
+    kmem[id].nfree++;
+    release(&kmem[id].lock);
+    pop_off();
+}
+
+// Move up to STEAL_BATCH pages from some other CPU's free
+// list onto CPU id's list. Only one kmem lock is held at a
+// time, so two CPUs stealing from each other can't deadlock.
+// Returns the number of pages moved.
+static int
+ksteal(int id) {
+    struct run *head, *tail;
+    int n;
+
+    for (int i = 1; i < NCPU; i++) {
+        struct kmem *victim = &kmem[(id + i) % NCPU];
+
+        acquire(&victim->lock);
+        head = tail = victim->freelist;
+        n = 0;
+        if (head) {
+            n = 1;
+            while (n < STEAL_BATCH && tail->next) {
+                tail = tail->next;
+                n++;
+            }
+            victim->freelist = tail->next;
+            victim->nfree -= n;
+        }
+        release(&victim->lock);
+
+        if (n > 0) {
+            acquire(&kmem[id].lock);
+            tail->next = kmem[id].freelist;
+            kmem[id].freelist = head;
+            kmem[id].nfree += n;
+            release(&kmem[id].lock);
+            return n;
+        }
+    }
+    return 0;
+}
+
+// Take a page off this CPU's free list, stealing from the
+// other CPUs if it is empty. Returns 0 if all lists are empty.
+static struct run *
+kget(void) {
+    struct run *r;
+    int id;
+
+    push_off();
+    id = cpuid();
+    for (;;) {
+        acquire(&kmem[id].lock);
+        r = kmem[id].freelist;
+        if (r) {
+            kmem[id].freelist = r->next;
+            kmem[id].nfree--;
+        }
+        release(&kmem[id].lock);
+        if (r || ksteal(id) == 0)
+            break;
+    }
+    pop_off();
+    return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -66,29 +261,210 @@ void *
 kalloc(void) {
     struct run *r;
 
-    acquire(&kmem.lock);
-    r = kmem.freelist;
-    if (r)
-        kmem.freelist = r->next;
-    release(&kmem.lock);
+    if ((r = kget()) != 0) {
+#ifdef JUNKFILL
+        memset((char *) r, 5, PGSIZE); // fill with junk
+#endif
+        pageref[PA2REF(r)] = 1;
+    } else if ((r = zget(0)) == 0 && kshrink(SHRINK_BATCH) > 0) {
+        // memory is short: fall back on the zeroed pool, then on
+        // the caches. kalloc() callers may hold a proc lock, so
+        // neither kzero() nor kreclaim() is woken.
+        return kalloc();
+    }
+    return (void *) r;
+}
+
+// Take a page from the zeroed pool, or return 0 if it is empty.
+// If wake is set, wakes kzero() once the pool is half drained.
+static struct run *
+zget(int wake) {
+    struct run *r;
 
+    acquire(&zpool.lock);
+    if ((r = zpool.list) != 0) {
+        zpool.list = r->next;
+        zpool.n--;
+    }
+    if (wake && zpool.waiting && zpool.n < NZPOOL / 2)
+        zpool.waiting = 0;
+    else
+        wake = 0;
+    release(&zpool.lock);
+    if (wake)
+        wakeup(&zpool);
     if (r)
-        memset((char *) r, 5, PGSIZE); // fill with junk
+        r->next = 0;  // the link was the page's only non-zero word
+    return r;
+}
+
+// Allocate one zeroed page, for user memory.
+// Must not be called with a proc lock held, since it may wake kzero().
+void *
+kzalloc(void) {
+    struct run *r;
+
+    if ((r = zget(1)) == 0 && (r = kalloc()) != 0)
+        memset((char *) r, 0, PGSIZE);
+    if (get_freemem() < KLOWPAGES * PGSIZE && !reclaim.want) {
+        acquire(&reclaim.lock);
+        reclaim.want = 1;
+        wakeup(&reclaim);
+        release(&reclaim.lock);
+    }
     return (void *) r;
 }
 
-uint64
-get_freemem() {
-    uint64 free = 0;
+// Register a shrinker: fn(n) gives back up to n pages to kfree()
+// and returns how many it freed. fn must not sleep, and may be
+// called from any kalloc(), so it takes only spinlocks that are
+// never held across a kalloc(). Called at boot, before the other
+// CPUs start.
+void
+kshrinker(char *name, int (*fn)(int)) {
+    if (shrinkers.n == NSHRINKER)
+        panic("kshrinker");
+    shrinkers.s[shrinkers.n].name = name;
+    shrinkers.s[shrinkers.n].fn = fn;
+    shrinkers.n++;
+}
+
+// Ask the shrinkers, in registration order, for up to n pages.
+// Returns the number of pages freed.
+static int
+kshrink(int n) {
+    int got = 0;
+
+    for (int i = 0; i < shrinkers.n && got < n; i++)
+        got += shrinkers.s[i].fn(n - got);
+    return got;
+}
+
+// Kernel thread that refills free memory from the caches once
+// it falls below the low watermark, so that kalloc() seldom has
+// to reclaim on its own path. When the caches are empty it
+// swaps user memory out, which sleeps, so the shrinkers can't.
+static void
+kreclaim(void) {
+    int n, freed;
+
+    acquire(&reclaim.lock);
+    for (;;) {
+        while (!reclaim.want)
+            sleep(&reclaim, &reclaim.lock);
+        release(&reclaim.lock);
+
+        freed = 0;
+        while (get_freemem() < KHIGHPAGES * PGSIZE &&
+               ((n = kshrink(SHRINK_BATCH)) > 0 || (n = swapout(SHRINK_BATCH)) > 0)) {
+            freed += n;
+            yield();
+        }
+
+        acquire(&reclaim.lock);
+        reclaim.want = 0;
+        reclaim.passes++;
+        reclaim.freed = freed;
+        wakeup(&reclaim.passes);
+    }
+}
+
+// Wait for the kreclaim thread to run, for a caller that found
+// no memory and may sleep. Returns 0 if it freed some, -1 if
+// it freed none or memory wasn't short in the first place.
+int
+kreclaimwait(void) {
+    int pass, r;
+
+    if (get_freemem() >= KLOWPAGES * PGSIZE)
+        return -1;
+    acquire(&reclaim.lock);
+    pass = reclaim.passes;
+    reclaim.want = 1;
+    wakeup(&reclaim);
+    while (reclaim.passes == pass)
+        sleep(&reclaim.passes, &reclaim.lock);
+    r = reclaim.freed > 0 ? 0 : -1;
+    release(&reclaim.lock);
+    return r;
+}
+
+// Kernel thread that keeps the zeroed pool topped up. It runs
+// at the lowest scheduling level and yields after every page,
+// so it only uses CPU time that nothing else wants.
+static void
+kzero(void) {
+    struct run *r;
 
-    struct run *p = kmem.freelist;
-    acquire(&kmem.lock);
+    for (;;) {
+        acquire(&zpool.lock);
+        while (zpool.n >= NZPOOL) {
+            zpool.waiting = 1;
+            sleep(&zpool, &zpool.lock);
+        }
+        release(&zpool.lock);
 
-    while (p) {
-        free += PGSIZE;
-        p = p->next;
+        if ((r = kget()) == 0) {
+            // out of memory; try again once kzalloc() drains the pool.
+            acquire(&zpool.lock);
+            zpool.waiting = 1;
+            sleep(&zpool, &zpool.lock);
+            release(&zpool.lock);
+            continue;
+        }
+        memset((char *) r, 0, PGSIZE);
+        pageref[PA2REF(r)] = 1;
+        acquire(&zpool.lock);
+        r->next = zpool.list;
+        zpool.list = r;
+        zpool.n++;
+        release(&zpool.lock);
+        yield();
     }
+}
+
+// Start kzero(). Called from the first process.
+void
+kzeroinit(void) {
+    int pid;
+
+    if ((pid = kthread(kzero, "kzero")) < 0)
+        panic("kzeroinit");
+    setpriority(pid, NPRIO - 1);
+}
+
+// Start kreclaim(). Called from the first process.
+void
+kreclaiminit(void) {
+    if (kthread(kreclaim, "kreclaim") < 0)
+        panic("kreclaiminit");
+}
+
+// Add a reference to an allocated page.
+void
+kaddref(void *pa) {
+    if (((uint64) pa % PGSIZE) != 0 || (char *) pa < end || (uint64) pa >= PHYSTOP)
+        panic("kaddref");
+    if (__sync_fetch_and_add(&pageref[PA2REF(pa)], 1) < 1)
+        panic("kaddref: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa) {
+    return __atomic_load_n(&pageref[PA2REF(pa)], __ATOMIC_RELAXED);
+}
+
+// Return the number of free bytes.
+// Sums the per-CPU counters without taking any kmem lock,
+// so it never blocks kalloc()/kfree(); a page moving between
+// CPUs in ksteal() may briefly be missed.
+uint64
+get_freemem(void) {
+    uint64 npages = 0;
 
-    release(&kmem.lock);
-    return free;
+    for (int i = 0; i < NCPU; i++)
+        npages += __atomic_load_n(&kmem[i].nfree, __ATOMIC_RELAXED);
+    npages += __atomic_load_n(&zpool.n, __ATOMIC_RELAXED);
+    return npages * PGSIZE;
 }
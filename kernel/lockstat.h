@@ -0,0 +1,41 @@
+// Spinlock contention statistics, kept per lock name:
+// all locks initialized with the same name (every proc lock,
+// every pipe lock, ...) share one entry.
+
+#define NLOCKSTAT 64   // lock names tracked
+#define LOCKSLOW 1000  // timer ticks (100us): a hold worth counting
+
+struct lockstat {
+  char name[16];     // lock name
+  uint64 nlocks;     // locks initialized with this name
+  uint64 acquire;    // acquisitions
+  uint64 contended;  // acquisitions that found the lock held
+  uint64 spins;      // iterations spent waiting
+  uint64 slow;       // holds of LOCKSLOW ticks or more
+  uint64 maxhold;    // longest hold, in timer ticks
+  uint64 maxpc;      // caller of acquire() for the longest hold
+};
+
+// Time spent in sleep(), per call site: the caller of sleep()
+// and its caller, since sleep() is mostly called by wrappers
+// like acquiresleep() and begin_op().
+#define NWAITSTAT 64   // call sites tracked
+
+struct waitstat {
+  uint64 pc[2];      // return addresses: sleep()'s caller, its caller
+  uint64 n;          // sleeps
+  uint64 time;       // total timer ticks asleep
+  uint64 maxtime;    // longest single sleep
+};
+
+// Result of one lockbench() run: how long each acquire()
+// of the shared benchmark lock waited, in timer ticks.
+#define NLBHIST 20     // wait histogram buckets, log2 of ticks
+
+struct lockbench {
+  uint64 n;              // acquisitions
+  uint64 time;           // ticks from first acquire to last release
+  uint64 wait;           // total ticks spent in acquire()
+  uint64 maxwait;        // longest single wait
+  uint64 hist[NLBHIST];  // hist[i]: waits of [2^i-1, 2^(i+1)-1) ticks
+};
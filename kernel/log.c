@@ -6,14 +6,15 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "sysinfo.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A transaction only commits when none of its FS system
+// calls are active. Thus there is never any reasoning required
+// about whether a commit might write an uncommitted system
+// call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
@@ -21,6 +22,24 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// The in-memory log header is double-buffered. When a
+// transaction commits, its header becomes the committing
+// header and the other one starts a new, empty transaction.
+// As soon as commit() has copied the committing transaction's
+// blocks into the log buffers, new FS system calls may begin
+// and join the new transaction while the old one is still being
+// written. Only one transaction commits at a time; if the new
+// one is complete when the old one finishes, the same commit()
+// call commits it too.
+//
+// Committed blocks are installed to their home locations by a
+// flusher kernel thread, so a commit() returns as soon as the
+// log and its header are on disk. The cached home blocks stay
+// pinned until the flusher has written them. The log is only
+// truncated after the install, and the next transaction cannot
+// write the log before then, so commit() waits for the flusher
+// before copying a new transaction into the log.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -34,22 +53,41 @@
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[MAXLOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // log blocks in use, including the header.
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int admitting;   // commit() has its snapshot; new ops may begin.
+  struct logheader *installing; // committed, flusher is installing it.
   int dev;
-  struct logheader lh;
+  int cur;         // lh[cur] is the transaction new ops join.
+  struct logheader lh[2];
+  struct buf *pinned[2][MAXLOGSIZE]; // cached blocks of lh[i], pinned by log_write()
+
+  // scratch for the committer; too big for the kernel stack.
+  struct buf *lbuf[MAXLOGSIZE];
+  uint dst[MAXLOGSIZE];
+
+  uint64 nclosed;         // transactions commit() has closed.
+
+  // statistics, protected by lock.
+  uint64 ncommit;         // transactions committed since boot.
+  uint64 commitcycles;    // total time spent committing them.
+  uint64 maxcommitcycles; // longest single commit.
+  uint64 nblocks;         // blocks written by those transactions.
+  uint64 nabsorb;         // log_write()s absorbed into a logged block.
+  uint64 nstall;          // begin_op() waits for log space.
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -57,40 +95,56 @@ initlog(int dev, struct superblock *sb)
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
-  initlock(&log.lock, "log");
+  initticketlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  if (log.size - 1 < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  if (log.size - 1 > MAXLOGSIZE)
+    log.size = MAXLOGSIZE + 1;  // leave the rest of the log unused
   log.dev = dev;
   recover_from_log();
+  if (kthread(flusher, "flusher") < 0)
+    panic("initlog: flusher");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// writing them to disk as a single batch.
+// Uses the committer's scratch arrays; commit() never touches
+// them while a transaction is being installed.
+//
+// The blocks are written straight from the log buffers, so
+// install never locks a cached home block. Those may already
+// be in use by FS system calls of the next transaction, and
+// their cached copies are at least as new as the log's, so
+// they need no update.
 static void
-install_trans(void)
+install_trans(struct logheader *lh, int recovering)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < lh->n; tail++) {
+    log.lbuf[tail] = bread(log.dev, log.start+tail+1); // read log block
+    log.dst[tail] = lh->block[tail];
+  }
+  bwritevat(log.lbuf, log.dst, lh->n);  // write to dsts on disk
+  for (tail = 0; tail < lh->n; tail++) {
+    brelse(log.lbuf[tail]);
+    if (recovering == 0)
+      bunpin(log.pinned[lh - log.lh][tail]);
   }
 }
 
 // Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  h->n = lh->n;
+  for (i = 0; i < h->n; i++) {
+    h->block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -99,14 +153,14 @@ read_head(void)
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -115,10 +169,12 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct logheader *lh = &log.lh[log.cur ^ 1];
+
+  read_head(lh);
+  install_trans(lh, 1); // if committed, copy from log to disk
+  lh->n = 0;
+  write_head(lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -127,10 +183,11 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing && !log.admitting){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh[log.cur].n + (log.outstanding+1)*MAXOPBLOCKS > log.size-1){
       // this op might exhaust log space; wait for commit.
+      log.nstall++;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -141,7 +198,9 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless another commit is in progress, which will then
+// commit this transaction when it is done.
 void
 end_op(void)
 {
@@ -149,9 +208,7 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -166,44 +223,137 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log buffers.
+// Returns with the log buffers locked in log.lbuf[].
 static void
-write_log(void)
+snapshot_log(struct logheader *lh)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  for (tail = 0; tail < lh->n; tail++) {
     struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+    struct buf *from = bread(log.dev, lh->block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
     brelse(from);
-    brelse(to);
+    log.lbuf[tail] = to;
   }
 }
 
+// Write the log buffers from snapshot_log() to disk
+// in one burst, and release them.
+static void
+write_log(struct logheader *lh)
+{
+  int tail;
+
+  bwritev(log.lbuf, lh->n);  // write the log
+  for (tail = 0; tail < lh->n; tail++)
+    brelse(log.lbuf[tail]);
+}
+
+// Commit the open transaction, and then any transaction
+// that completed while that commit was in progress.
+// Caller has set log.committing, and no FS system calls
+// are outstanding.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  struct logheader *lh;
+  uint64 t0, t, n;
+
+  acquire(&log.lock);
+  while (log.outstanding == 0 && log.lh[log.cur].n > 0) {
+    if (log.installing) {
+      // The log still holds the previous transaction. Let new
+      // ops join the open one while the flusher finishes.
+      log.admitting = 1;
+      sleep(&log, &log.lock);
+      continue;
+    }
+
+    // Close the open transaction and start an empty one.
+    lh = &log.lh[log.cur];
+    log.cur ^= 1;
+    log.lh[log.cur].n = 0;
+    log.admitting = 0;
+    log.nclosed++;
+    release(&log.lock);
+
+    t0 = r_time();
+    n = lh->n;
+    snapshot_log(lh); // Copy modified blocks from cache to log
+
+    // Changes made from now on belong to the new transaction.
+    acquire(&log.lock);
+    log.admitting = 1;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log(lh); // Write the log to disk
+    write_head(lh);     // Write header to disk -- the real commit
+    t = r_time() - t0;
+
+    acquire(&log.lock);
+    log.installing = lh; // The flusher installs it and erases the log
+    wakeup(&log.installing);
+    log.ncommit++;
+    log.nblocks += n;
+    log.commitcycles += t;
+    if (t > log.maxcommitcycles)
+      log.maxcommitcycles = t;
+  }
+  log.admitting = 0;
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Wait until every change logged so far is committed:
+// the open transaction if it holds any, otherwise the one
+// commit() may be writing. For fsync().
+void
+log_force(void)
+{
+  uint64 want;
+
+  acquire(&log.lock);
+  want = log.nclosed + (log.lh[log.cur].n > 0);
+  while(log.ncommit < want)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Kernel thread that installs committed transactions to
+// their home locations, then erases them from the log.
+static void
+flusher(void)
+{
+  struct logheader *lh;
+
+  acquire(&log.lock);
+  for (;;) {
+    while (log.installing == 0)
+      sleep(&log.installing, &log.lock);
+    lh = log.installing;
+    release(&log.lock);
+
+    install_trans(lh, 0); // Write committed blocks to home locations
+    lh->n = 0;
+    write_head(lh);       // Erase the transaction from the log
+
+    acquire(&log.lock);
+    log.installing = 0;
+    wakeup(&log); // commit() may be waiting to reuse the log
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will do the log write, and the
+// flusher the home write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -214,22 +364,41 @@ void
 log_write(struct buf *b)
 {
   int i;
+  struct logheader *lh;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  acquire(&log.lock);
+  lh = &log.lh[log.cur];
+  if (lh->n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  for (i = 0; i < lh->n; i++) {
+    if (lh->block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  if (i < lh->n)
+    log.nabsorb++;
+  lh->block[i] = b->blockno;
+  if (i == lh->n) {  // Add new block to log?
     bpin(b);
-    log.lh.n++;
+    log.pinned[log.cur][i] = b;
+    lh->n++;
   }
   release(&log.lock);
 }
 
+// Report commit statistics.
+void
+loginfo(struct sysinfo *info)
+{
+  acquire(&log.lock);
+  info->ncommit = log.ncommit;
+  info->commitcycles = log.commitcycles;
+  info->maxcommitcycles = log.maxcommitcycles;
+  info->logblocks = log.nblocks;
+  info->logabsorb = log.nabsorb;
+  info->logstall = log.nstall;
+  info->logsize = log.size - 1;
+  release(&log.lock);
+}
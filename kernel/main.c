@@ -16,7 +16,12 @@ main()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
+    proctabinit();   // process table
+    fileinit();      // file table
+    iinit();         // inode cache
     kinit();         // physical page allocator
+    slabinit();      // small object caches
+    pipeinit();      // pipe cache
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -25,8 +30,11 @@ main()
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
-    iinit();         // inode cache
-    fileinit();      // file table
+    pcinit();        // file page cache
+    tmpinit();       // in-memory file system
+    textinit();      // shared program pages
+    traceinit();     // system call trace rings
+    futexinit();     // futex wait queues
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -27,9 +27,16 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
+// supervisor mode sees the CLINT at CLINTVA instead, which keeps
+// kernel mappings out of [0, MAXUVA); see kvmcreate().
+#define CLINTVA 0x40000000L
+#define CLINTVA_MSIP(hartid) (CLINTVA + 4*(hartid))
+#define CLINTVA_MTIMECMP(hartid) (CLINTVA + 0x4000 + 8*(hartid))
+
 // qemu puts programmable interrupt controller here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -62,6 +69,12 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   trapframes of the other threads, one page each
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TRAPFRAMEN(slot) (TRAPFRAME - (slot)*PGSIZE)
+
+// user memory must lie below MAXUVA, so that each process's
+// kernel page table can map it beneath the devices.
+#define MAXUVA PLIC
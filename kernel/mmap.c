@@ -0,0 +1,368 @@
+//
+// Memory-mapped files.
+//
+// mmap() records a region of a file in one of the process's
+// vma slots and maps nothing; the pages are read from the
+// file by mmapfault() when first touched. Regions are placed
+// top-down from MAXUVA, above the heap, which growproc()
+// keeps below mmapbase(). MAP_SHARED regions that may have
+// been written are written back by munmap() and at exit.
+//
+// The regions belong to the address space (struct mm), which
+// threads share: mm->lock guards vma[], and mmlock() keeps
+// mmap() and munmap() of different threads apart.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "fcntl.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Lowest address used by mm's mappings, or MAXUVA.
+// Caller must hold mm->lock.
+uint64
+mmapbase(struct mm *mm)
+{
+  uint64 base = MAXUVA;
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Caller must hold mm->lock.
+static struct vma*
+findvma(struct mm *mm, uint64 va)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Is va in a MAP_SHARED region of mm? For futexes, whose
+// waiters on a shared page must meet across address spaces.
+int
+mmapshared(struct mm *mm, uint64 va)
+{
+  struct vma *v;
+  int r;
+
+  acquire(&mm->lock);
+  r = (v = findvma(mm, va)) != 0 && (v->flags & MAP_SHARED);
+  release(&mm->lock);
+  return r;
+}
+
+// Map len bytes of f, from offset off, into the current
+// process. Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v;
+  uint64 base;
+
+  if(len == 0 || off % PGSIZE != 0 || f->type != FD_INODE)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if((prot & (PROT_READ|PROT_EXEC)) && !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable)
+    return -1;
+
+  len = PGROUNDUP(len);
+  mmlock(mm);
+  acquire(&mm->lock);
+  base = mmapbase(mm);
+  if(base < len || base - len < PGROUNDUP(mm->sz)){
+    release(&mm->lock);
+    mmunlock(mm);
+    return -1;
+  }
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(v->len == 0){
+      v->addr = base - len;
+      v->len = len;
+      v->prot = prot;
+      v->flags = flags;
+      v->off = off;
+      v->f = filedup(f);
+      base = v->addr;
+      release(&mm->lock);
+      mmunlock(mm);
+      return base;
+    }
+  }
+  release(&mm->lock);
+  mmunlock(mm);
+  return -1;
+}
+
+// Read the page of mm's mapping at va in from its file.
+// Returns 0 if it is now mapped, -1 if va is not in a
+// mapping that allows the access.
+int
+mmapfault(struct mm *mm, uint64 va, int write)
+{
+  struct vma *v;
+  struct file *f;
+  uint64 off;
+  pte_t *pte;
+  char *mem;
+  int perm, prot;
+
+  if(write && mmapcow(mm, va) == 0)
+    return 0;
+  acquire(&mm->lock);
+  if((v = findvma(mm, va)) == 0 ||
+     (write && (v->prot & PROT_WRITE) == 0) ||
+     (!write && (v->prot & (PROT_READ|PROT_EXEC)) == 0)){
+    release(&mm->lock);
+    return -1;
+  }
+  va = PGROUNDDOWN(va);
+  // reading sleeps: hold f, and check v again afterwards,
+  // since another thread may unmap it meanwhile.
+  f = filedup(v->f);
+  off = v->off + va - v->addr;
+  prot = v->prot;
+  release(&mm->lock);
+
+  if((mem = kzalloc()) == 0){  // bytes past the end of the file stay zero
+    fileclose(f);
+    return -1;
+  }
+  ilockshared(f->ip);
+  if(readi(f->ip, 0, (uint64)mem, off, PGSIZE) < 0){
+    iunlock(f->ip);
+    fileclose(f);
+    kfree(mem);
+    return -1;
+  }
+  iunlock(f->ip);
+
+  perm = PTE_U;
+  if(prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;  // RISC-V has no write-only pages
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  acquire(&mm->lock);
+  if((v = findvma(mm, va)) == 0 || v->f != f ||
+     v->off + va - v->addr != off){
+    release(&mm->lock);  // unmapped (and maybe mapped again)
+    fileclose(f);
+    kfree(mem);
+    return -1;
+  }
+  if((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    release(&mm->lock);  // another thread read the page in
+    fileclose(f);
+    kfree(mem);
+    return 0;
+  }
+  if(mappages(mm->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    release(&mm->lock);
+    fileclose(f);
+    kfree(mem);
+    return -1;
+  }
+  uvmsync(mm->pagetable);
+  release(&mm->lock);
+  fileclose(f);
+  return 0;
+}
+
+// Fault in the pages of [va, va+n) that lie in mappings, so
+// that copyin() and copyout(), which may run with spinlocks
+// or the mapped file's inode lock held, find them mapped.
+void
+mmaptouch(uint64 va, uint64 n)
+{
+  struct mm *mm = myproc()->mm;
+  uint64 a;
+  pte_t *pte;
+  int fault;
+
+  if(va + n < va || va + n <= mm->sz)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    acquire(&mm->lock);
+    fault = findvma(mm, a) != 0 &&
+      ((pte = walk(mm->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0);
+    release(&mm->lock);
+    if(fault)
+      mmapfault(mm, a, 0);
+  }
+}
+
+// Write the mapped pages of [va, va+n) in shared mapping v
+// back to its file, without growing the file.
+static void
+writeback(struct mm *mm, struct vma *v, uint64 va, uint64 n)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip = v->f->ip;
+  uint64 a, pa, off;
+  pte_t *pte;
+  int i, n1;
+
+  if(v->flags != MAP_SHARED || (v->prot & PROT_WRITE) == 0)
+    return;
+  for(a = va; a < va + n; a += PGSIZE){
+    pte = walk(mm->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    off = v->off + a - v->addr;
+    // a page takes more than one log transaction.
+    for(i = 0; i < PGSIZE; i += n1){
+      begin_op();
+      ilock(ip);
+      if(off + i >= ip->size){
+        iunlock(ip);
+        end_op();
+        break;
+      }
+      n1 = min(min(PGSIZE - i, max), ip->size - (off + i));
+      writei(ip, 0, pa + i, off + i, n1);
+      iunlock(ip);
+      end_op();
+    }
+  }
+}
+
+// Unmap [va, va+n) of mapping v, which must be at its
+// start or its end. Caller must hold mmlock(), or be
+// the last user of mm.
+static void
+unmap(struct mm *mm, struct vma *v, uint64 va, uint64 n)
+{
+  struct file *f = 0;
+
+  writeback(mm, v, va, n);
+  // shrink v first, so that mmapfault() maps nothing more
+  // in the range.
+  acquire(&mm->lock);
+  if(va == v->addr){
+    v->addr += n;
+    v->off += n;
+  }
+  v->len -= n;
+  if(v->len == 0){
+    f = v->f;
+    v->f = 0;
+  }
+  release(&mm->lock);
+  mmunmap(mm, va, n / PGSIZE);
+  if(f)
+    fileclose(f);
+}
+
+// Remove the mappings of [va, va+len) of the current process.
+// The range must lie within one mapping and include its first
+// or last page. Returns 0 or -1.
+int
+munmap(uint64 va, uint64 len)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v;
+
+  if(va % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  mmlock(mm);
+  acquire(&mm->lock);
+  if((v = findvma(mm, va)) == 0 || va + len > v->addr + v->len ||
+     (va != v->addr && va + len != v->addr + v->len)){  // would split it
+    release(&mm->lock);
+    mmunlock(mm);
+    return -1;
+  }
+  release(&mm->lock);
+  unmap(mm, v, va, len);
+  mmunlock(mm);
+  return 0;
+}
+
+// Give the child's new address space nmm copies of mm's
+// mappings. The pages of private mappings that are in are
+// shared copy-on-write, as uvmcopy() shares the heap, so the
+// child sees what the parent wrote there; the child faults
+// the rest, and shared mappings, in from the files again.
+// Returns 0, or -1 if out of memory, leaving nmm for the
+// caller to free. Caller must hold mm->lock.
+int
+mmapfork(struct mm *mm, struct mm *nmm)
+{
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    nmm->vma[i] = mm->vma[i];
+    if(mm->vma[i].len)
+      filedup(mm->vma[i].f);
+  }
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if(v->len == 0 || v->flags == MAP_SHARED)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(mm->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      if(mappages(nmm->pagetable, a, PGSIZE, PTE2PA(*pte), PTE_FLAGS(*pte)) != 0)
+        return -1;
+      kaddref((void*)PTE2PA(*pte));
+    }
+  }
+  return 0;
+}
+
+// Resolve a write to a page of one of mm's private mappings
+// that fork() left copy-on-write. Doesn't sleep.
+// Returns 0 if the write can be retried, -1 if va is not
+// such a page or memory is exhausted.
+int
+mmapcow(struct mm *mm, uint64 va)
+{
+  struct vma *v;
+  int r = -1;
+
+  acquire(&mm->lock);
+  if((v = findvma(mm, va)) != 0 && (v->prot & PROT_WRITE))
+    r = uvmcowfault(mm->pagetable, va);
+  release(&mm->lock);
+  return r;
+}
+
+// Remove all of mm's mappings, when its last thread is done
+// with it.
+void
+mmapexit(struct mm *mm)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->len)
+      unmap(mm, v, v->addr, v->len);
+}
@@ -0,0 +1,298 @@
+// Page cache for file data.
+//
+// Regular files are read through whole pages of their bytes,
+// kept apart from the buffer cache so that big sequential reads
+// don't push out the bitmap, inode and directory blocks that
+// everything else depends on. Each cached page belongs to one
+// in-memory inode and is found by hashing (inode, page number);
+// the inode also links its own pages, so that truncating or
+// recycling it drops them without a search.
+//
+// Pages are filled through the buffer cache and the buffers are
+// then released cold (bdrop()), so that their blocks are the
+// first to be recycled. Writes still go through buffers and the
+// log, as crash recovery needs; writei() copies what it wrote
+// into any cached page as well (pcwrite()), so the cache never
+// holds stale data.
+//
+// Unpinned pages sit on an LRU list. They are given back when
+// the descriptors run out, and to kalloc()'s shrinkers when
+// memory runs low (pcreclaim()), so that cached file data never
+// keeps memory from processes.
+//
+// A page is only used or changed with its inode locked: shared
+// to read it, exclusively to write it, so pcache.lock guards the
+// lists but not the bytes.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "sysinfo.h"
+
+#if BSIZE > PGSIZE
+#error "the page cache needs blocks no bigger than pages"
+#endif
+
+#define NPCHASH 61
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+static int pcreclaim(int);
+
+struct pcpage {
+  struct inode *ip;         // owner; 0 if the descriptor is free
+  uint pgno;                // page number within the file
+  int ref;                  // pinned by pcget()
+  char *data;               // PGSIZE bytes from kalloc()
+  struct pcpage *hnext;     // hash chain, or free list
+  struct pcpage *inext;     // ip->pages list
+  struct pcpage *iprev;
+  struct pcpage *lrunext;   // unpinned pages, least recently
+  struct pcpage *lruprev;   // used first
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *hash[NPCHASH];
+  struct pcpage *free;
+  struct pcpage lru;        // list head
+} pcache;
+
+void
+pcinit(void)
+{
+  struct pcpage *p;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.lru.lrunext = pcache.lru.lruprev = &pcache.lru;
+  for(p = pcache.page; p < pcache.page + NPCACHE; p++){
+    p->hnext = pcache.free;
+    pcache.free = p;
+  }
+  kshrinker("pcache", pcreclaim);
+}
+
+static struct pcpage**
+pchash(struct inode *ip, uint pgno)
+{
+  return &pcache.hash[((uint64)ip / sizeof(*ip) * 31 + pgno) % NPCHASH];
+}
+
+static void
+lru_remove(struct pcpage *p)
+{
+  p->lrunext->lruprev = p->lruprev;
+  p->lruprev->lrunext = p->lrunext;
+  p->lrunext = p->lruprev = 0;
+}
+
+static void
+lru_add(struct pcpage *p)
+{
+  p->lrunext = &pcache.lru;
+  p->lruprev = pcache.lru.lruprev;
+  pcache.lru.lruprev->lrunext = p;
+  pcache.lru.lruprev = p;
+}
+
+// Caller holds pcache.lock.
+static struct pcpage*
+pcfind(struct inode *ip, uint pgno)
+{
+  struct pcpage *p;
+
+  for(p = *pchash(ip, pgno); p; p = p->hnext)
+    if(p->ip == ip && p->pgno == pgno)
+      return p;
+  return 0;
+}
+
+// Take p, which is not pinned, out of the cache and put its
+// descriptor on the free list. Returns its page for the caller
+// to kfree(). Caller holds pcache.lock.
+static char*
+pcremove(struct pcpage *p)
+{
+  struct pcpage **pp;
+  char *data = p->data;
+
+  if(p->ref != 0)
+    panic("pcremove");
+  for(pp = pchash(p->ip, p->pgno); *pp != p; pp = &(*pp)->hnext)
+    ;
+  *pp = p->hnext;
+  if(p->iprev)
+    p->iprev->inext = p->inext;
+  else
+    p->ip->pages = p->inext;
+  if(p->inext)
+    p->inext->iprev = p->iprev;
+  lru_remove(p);
+  p->ip = 0;
+  p->data = 0;
+  p->hnext = pcache.free;
+  pcache.free = p;
+  return data;
+}
+
+// Return page pgno of ip's data, pinned, reading it in if it
+// isn't cached. Returns 0 if there is no memory for it.
+// Caller must hold ip->lock, and pgno must lie below ip->size.
+static struct pcpage*
+pcget(struct inode *ip, uint pgno)
+{
+  struct pcpage *p;
+  char *mem, *old = 0;
+
+  acquire(&pcache.lock);
+  if((p = pcfind(ip, pgno)) != 0){
+    statinc(ST_PCHIT);
+    goto found;
+  }
+  release(&pcache.lock);
+  statinc(ST_PCMISS);
+
+  // Read the page without the lock; kalloc() may reclaim pages.
+  if((mem = kalloc()) == 0)
+    return 0;
+  ifill(ip, pgno, mem);
+
+  // Other readers holding ip->lock shared may have beaten us.
+  acquire(&pcache.lock);
+  if((p = pcfind(ip, pgno)) != 0){
+    kfree(mem);
+    goto found;
+  }
+  if((p = pcache.free) == 0){
+    if((p = pcache.lru.lrunext) == &pcache.lru){
+      release(&pcache.lock);
+      kfree(mem);
+      return 0;
+    }
+    old = pcremove(p);
+  }
+  pcache.free = p->hnext;
+  p->ip = ip;
+  p->pgno = pgno;
+  p->ref = 1;
+  p->data = mem;
+  p->hnext = *pchash(ip, pgno);
+  *pchash(ip, pgno) = p;
+  p->iprev = 0;
+  p->inext = ip->pages;
+  if(ip->pages)
+    ip->pages->iprev = p;
+  ip->pages = p;
+  release(&pcache.lock);
+  if(old)
+    kfree(old);
+  return p;
+
+found:
+  if(p->ref++ == 0)
+    lru_remove(p);
+  release(&pcache.lock);
+  return p;
+}
+
+static void
+pcput(struct pcpage *p)
+{
+  acquire(&pcache.lock);
+  if(--p->ref == 0)
+    lru_add(p);
+  release(&pcache.lock);
+}
+
+// Copy n bytes of ip's data at off out through its cached
+// pages. Returns the number of bytes copied, which is short if
+// memory ran out or the copy failed; the caller carries on
+// through the buffer cache. Caller must hold ip->lock and have
+// clipped [off, off+n) to ip->size.
+int
+pcread(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  struct pcpage *p;
+  uint tot, m;
+  int r;
+
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    if((p = pcget(ip, off / PGSIZE)) == 0)
+      break;
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    r = either_copyout(user_dst, dst, p->data + off % PGSIZE, m);
+    pcput(p);
+    if(r == -1)
+      break;
+  }
+  return tot;
+}
+
+// writei() has just logged n bytes at off from src; bring any
+// cached page holding them up to date. Caller must hold
+// ip->lock exclusively.
+void
+pcwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *p;
+  uint tot, m;
+
+  for(tot = 0; tot < n && ip->pages; tot += m, off += m, src += m){
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    acquire(&pcache.lock);
+    if((p = pcfind(ip, off / PGSIZE)) != 0 && p->ref++ == 0)
+      lru_remove(p);
+    release(&pcache.lock);
+    if(p){
+      memmove(p->data + off % PGSIZE, src, m);
+      pcput(p);
+    }
+  }
+}
+
+// Is page pgno of ip cached? For read-ahead, which needn't
+// bring in blocks that are already in the page cache.
+int
+pcpresent(struct inode *ip, uint pgno)
+{
+  int r;
+
+  if(ip->pages == 0)
+    return 0;
+  acquire(&pcache.lock);
+  r = pcfind(ip, pgno) != 0;
+  release(&pcache.lock);
+  return r;
+}
+
+// Drop all of ip's cached pages, when it is truncated or its
+// in-memory inode is recycled. Caller must hold ip->lock, or
+// know that ip is unreferenced.
+void
+pcdrop(struct inode *ip)
+{
+  acquire(&pcache.lock);
+  while(ip->pages)
+    kfree(pcremove(ip->pages));
+  release(&pcache.lock);
+}
+
+// Shrinker: give up to n unpinned pages back, least recently
+// used first. Returns the number of pages freed.
+static int
+pcreclaim(int n)
+{
+  int i;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < n && pcache.lru.lrunext != &pcache.lru; i++)
+    kfree(pcremove(pcache.lru.lrunext));
+  release(&pcache.lock);
+  return i;
+}
@@ -1,13 +1,29 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // minimum number of processes
+#define MAXPROC    1024  // maximum number of processes
+#define PROCMEM  (256*1024) // bytes of RAM per process slot (see proctabinit)
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduling levels
+#define NZPOOL       64  // pre-zeroed pages kept for kzalloc()
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NVMA         16  // mmap() regions per process
+#define NSEG          4  // demand-loaded exec segments per process
+#define NTHREAD      32  // threads sharing one address space
+#define NTEXT       128  // program pages shared between processes
+#define NELFCACHE    16  // programs whose parsed ELF headers exec keeps
+#define NFILE       100  // minimum open files per system (4 per process slot)
+#define NINODE       50  // minimum number of active i-nodes (1 per process slot)
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define TMPDEV        2  // device number of the in-memory tmpfs
+#define NTMPINODE   200  // inodes in the tmpfs
 #define MAXARG       32  // max exec arguments
+#define NSPAWNFD      3  // descriptors spawn() hands the child
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*3)  // default on-disk log blocks (mkfs -l)
+#define MAXLOGSIZE   (MAXOPBLOCKS*6)  // max data blocks the kernel logs at once
+#define NBUF         (MAXLOGSIZE*3+MAXOPBLOCKS*2) // size of disk block cache
+#define NREADAHEAD    8  // blocks read ahead of sequential file reads
+#define NPCACHE    1024  // most pages of file data cached
+#define FSSIZE       200000  // size of file system in blocks
+#define SWAPSIZE     16384  // 1K blocks of it mkfs sets aside for swap
 #define MAXPATH      128   // maximum file path name
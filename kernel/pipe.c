@@ -8,32 +8,76 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The ring is held in a power-of-two number of pages, so
+// that byte counts wrapping around 2^32 stay in step with
+// the ring. Writers wake readers only when the ring reaches
+// half full or when a write ends, and readers wake writers
+// only once half the ring is free, and then only if someone
+// is waiting, to avoid a context switch per buffer.
+#define PIPEPAGES     1     // default ring size, pages
+#define PIPEMAXPAGES  16    // largest ring, pages
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPAGES]; // the ring, size bytes in all
+  uint size;      // bytes in the ring
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int splicing;   // pipesplice() is filling the ring without the lock
+  int rwait;      // a reader sleeps on nread
+  int wwait;      // a writer sleeps on nwrite
 };
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+static struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe));
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < PIPEMAXPAGES; i++)
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  kmem_cache_free(pipecache, pi);
+}
+
+// Create a pipe whose ring holds size bytes, rounded up to
+// a power-of-two number of pages; 0 means the default.
 int
-pipealloc(struct file **f0, struct file **f1)
+pipealloc(struct file **f0, struct file **f1, int size)
 {
   struct pipe *pi;
+  int i, npages;
+
+  if(size < 0 || size > PIPEMAXPAGES*PGSIZE)
+    return -1;
+  npages = size == 0 ? PIPEPAGES : 1;
+  while(npages*PGSIZE < size)
+    npages *= 2;
 
   pi = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  for(i = 0; i < npages; i++)
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
+  pi->size = npages*PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
-  pi->nwrite = 0;
-  pi->nread = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +91,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,43 +112,166 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Address of ring byte off.
+static char*
+pipeaddr(struct pipe *pi, uint off)
+{
+  off %= pi->size;
+  return pi->page[off / PGSIZE] + off % PGSIZE;
+}
+
+// Bytes that can be written to the ring in one piece.
+static int
+pipespace(struct pipe *pi)
+{
+  uint m = pi->size - (pi->nwrite - pi->nread);
+  return min(m, PGSIZE - pi->nwrite % PGSIZE);
+}
+
+// Bytes that can be read from the ring in one piece.
+static int
+pipeavail(struct pipe *pi)
+{
+  uint m = pi->nwrite - pi->nread;
+  return min(m, PGSIZE - pi->nread % PGSIZE);
+}
+
+// Wake a sleeping reader. Caller holds pi->lock.
+static void
+pipewakereader(struct pipe *pi)
+{
+  if(pi->rwait){
+    pi->rwait = 0;
+    wakeup(&pi->nread);
+  }
+}
+
+// Wake a sleeping writer. Caller holds pi->lock.
+static void
+pipewakewriter(struct pipe *pi)
+{
+  if(pi->wwait){
+    pi->wwait = 0;
+    wakeup(&pi->nwrite);
+  }
+}
+
+// Wait until a writer may add bytes to the ring.
+// Returns -1 if the reader has gone away or we were killed.
+// Caller holds pi->lock.
+static int
+pipewait(struct pipe *pi)
+{
+  struct proc *pr = myproc();
+
+  while(pi->nwrite == pi->nread + pi->size || pi->splicing){  //DOC: pipewrite-full
+    if(pi->readopen == 0 || pr->killed)
+      return -1;
+    pipewakereader(pi);
+    pi->wwait = 1;
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0 || pr->killed)
+    return -1;
+  return 0;
+}
+
+// Ring has been written to; wake a reader once it is half full.
+static void
+pipewritten(struct pipe *pi)
+{
+  if(pi->nwrite - pi->nread >= pi->size / 2)
+    pipewakereader(pi);
+}
+
+// Copy user data into the ring, a contiguous piece at a time.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i, m, r;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
-        release(&pi->lock);
-        return -1;
-      }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+  for(i = 0; i < n; i += m){
+    if(pipewait(pi) < 0){
+      release(&pi->lock);
+      return -1;
+    }
+    m = min(n - i, pipespace(pi));
+    if(copyin(pr->pagetable, pipeaddr(pi, pi->nwrite), addr + i, m) == -1){
+      // maybe a page that can't be read in under pi->lock.
+      release(&pi->lock);
+      r = uvmtouch(addr + i, m, 0);
+      acquire(&pi->lock);
+      if(r < 0)
+        break;
+      m = 0;
+      continue;
+    }
+    pi->nwrite += m;
+    pipewritten(pi);
+  }
+  pipewakereader(pi);
+  release(&pi->lock);
+  return i;
+}
+
+// Move up to n bytes from inode file f, at f->off, into the
+// pipe. The data goes straight from the buffer cache into the
+// ring. While readi() fills free ring space without pi->lock,
+// pi->splicing keeps other writers out; the reader only looks
+// at bytes below nwrite.
+int
+pipesplice(struct pipe *pi, struct file *f, int n)
+{
+  int i, m, r;
+  char *dst;
+
+  acquire(&pi->lock);
+  for(i = 0; i < n; i += r){
+    if(pipewait(pi) < 0){
+      release(&pi->lock);
+      return i > 0 ? i : -1;
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    m = min(n - i, pipespace(pi));
+    dst = pipeaddr(pi, pi->nwrite);
+    pi->splicing = 1;
+    release(&pi->lock);
+
+    if(f->ref > 1)  // f->off is shared, see fileread()
+      ilock(f->ip);
+    else
+      ilockshared(f->ip);
+    if((r = readi(f->ip, 0, (uint64)dst, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+
+    acquire(&pi->lock);
+    pi->splicing = 0;
+    if(r > 0)
+      pi->nwrite += r;
+    pipewritten(pi);
+    pipewakewriter(pi);  // writers waiting for splicing to clear
+    if(r <= 0)
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
   }
-  wakeup(&pi->nread);
+  pipewakereader(pi);
   release(&pi->lock);
   return i;
 }
 
+// Copy bytes from the ring out to user space, a contiguous
+// piece at a time.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m, r;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -112,16 +279,26 @@ piperead(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
+    pi->rwait = 1;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+    m = min(n - i, pipeavail(pi));
+    if(copyout(pr->pagetable, addr + i, pipeaddr(pi, pi->nread), m) == -1){
+      release(&pi->lock);
+      r = uvmtouch(addr + i, m, 1);
+      acquire(&pi->lock);
+      if(r < 0)
+        break;
+      m = 0;
+      continue;
+    }
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(pi->size - (pi->nwrite - pi->nread) >= pi->size / 2)
+    pipewakewriter(pi);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
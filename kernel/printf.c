@@ -16,15 +16,65 @@
 #include "proc.h"
 
 volatile int panicked = 0;
+static volatile int panicking;  // print straight to the UART
+
+// printf() formats into its CPU's buffer with interrupts off,
+// taking no lock, and commits the text in one piece (a whole
+// printf() unless it overflows PRBUF) to klog, a ring of recent
+// kernel output that dmesg() reads, and to the UART's transmit
+// ring, which drains by interrupts rather than by spinning.
+#define PRBUF  256
+#define KLOGSIZE 16384   // power of two
+
+static struct {
+  char buf[PRBUF];
+  int n;
+} prbuf[NCPU];
 
-// lock to avoid interleaving concurrent printf's.
 static struct {
   struct spinlock lock;
-  int locking;
-} pr;
+  char buf[KLOGSIZE];
+  uint64 w;       // bytes ever logged; buf holds the last KLOGSIZE
+} klog;
 
 static char digits[] = "0123456789abcdef";
 
+// Hand the CPU's buffered output to klog and the UART.
+static void
+prflush(void)
+{
+  int i, n, id = cpuid();
+  char *b = prbuf[id].buf;
+
+  n = prbuf[id].n;
+  prbuf[id].n = 0;
+  if(n == 0)
+    return;
+  if(panicking){
+    // no locks: the panic may have come from inside one.
+    for(i = 0; i < n; i++)
+      uartputc_sync(b[i]);
+    return;
+  }
+  acquire(&klog.lock);
+  for(i = 0; i < n; i++)
+    klog.buf[(klog.w + i) % KLOGSIZE] = b[i];
+  klog.w += n;
+  // inside klog.lock, so that UART output is in klog order.
+  uartputs(b, n);
+  release(&klog.lock);
+}
+
+static void
+prputc(int c)
+{
+  int id = cpuid();
+
+  if(prbuf[id].n == PRBUF)
+    prflush();
+  prbuf[id].buf[prbuf[id].n++] = c;
+}
+
 static void
 printint(int xx, int base, int sign)
 {
@@ -46,17 +96,17 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    prputc(buf[i]);
 }
 
 static void
 printptr(uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  prputc('0');
+  prputc('x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    prputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the console. only understands %d, %x, %p, %s.
@@ -64,20 +114,17 @@ void
 printf(char *fmt, ...)
 {
   va_list ap;
-  int i, c, locking;
+  int i, c;
   char *s;
 
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-
   if (fmt == 0)
     panic("null fmt");
 
+  push_off();
   va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      prputc(c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -97,27 +144,26 @@ printf(char *fmt, ...)
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        prputc(*s);
       break;
     case '%':
-      consputc('%');
+      prputc('%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      prputc('%');
+      prputc(c);
       break;
     }
   }
-
-  if(locking)
-    release(&pr.lock);
+  prflush();
+  pop_off();
 }
 
 void
 panic(char *s)
 {
-  pr.locking = 0;
+  panicking = 1;
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -129,6 +175,45 @@ panic(char *s)
 void
 printfinit(void)
 {
-  initlock(&pr.lock, "pr");
-  pr.locking = 1;
+  initlock(&klog.lock, "klog");
+}
+
+// Copy up to n bytes of the most recent kernel output, oldest
+// first, to user address dst. Returns the number of bytes.
+int
+klogread(uint64 dst, int n)
+{
+  struct proc *p = myproc();
+  char buf[128];
+  uint64 pos, end;
+  int i, m, tot = 0;
+
+  if(n < 0)
+    return -1;
+  acquire(&klog.lock);
+  end = klog.w;
+  release(&klog.lock);
+  if(n > KLOGSIZE)
+    n = KLOGSIZE;
+  if(n > end)
+    n = end;
+  pos = end - n;
+  while(pos < end){
+    m = end - pos < sizeof(buf) ? end - pos : sizeof(buf);
+    acquire(&klog.lock);
+    if(klog.w - pos > KLOGSIZE){
+      // overwritten meanwhile; skip to what survives.
+      pos = klog.w - KLOGSIZE;
+      release(&klog.lock);
+      continue;
+    }
+    for(i = 0; i < m; i++)
+      buf[i] = klog.buf[(pos + i) % KLOGSIZE];
+    release(&klog.lock);
+    if(copyout(p->pagetable, dst + tot, buf, m) < 0)
+      return -1;
+    pos += m;
+    tot += m;
+  }
+  return tot;
 }
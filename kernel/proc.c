@@ -5,31 +5,141 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sysinfo.h"
+#include "lockstat.h"
+#include "time.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+struct proc *proc;   // proc[nprocs], sized by proctabinit()
+int nprocs;
+
+// Per-CPU multi-level feedback queues of RUNNABLE processes.
+// A process is on exactly one queue while it is RUNNABLE and
+// not yet picked by a scheduler, at level p->prio; level 0
+// runs first. A process drops a level each time the timer
+// preempts it, and returns to its base level p->baseprio when
+// it wakes up from sleep, or every BOOSTTICKS ticks so that
+// CPU hogs don't starve. Lock order: p->lock, then runq lock.
+#define BOOSTTICKS 10
+
+struct runq {
+    struct spinlock lock;
+    struct proc *head[NPRIO];
+    struct proc *tail[NPRIO];
+    int n;                      // queued processes
+    uint boosted;               // ticks at the last boost
+} runq[NCPU];
+
+// Hashed queues of processes sleeping on a channel, so that
+// wakeup() only visits the sleepers on its channel. A sleeper
+// stays queued until it is woken by wakeup() or runs again.
+// Lock order: p->lock, then sleep queue lock; wakeup() takes
+// them one at a time.
+#define NSLEEPQ 64
+
+struct sleepq {
+    struct spinlock lock;
+    struct proc *head;
+} sleepq[NSLEEPQ];
+
+static struct sleepq *
+chanq(void *chan) {
+    uint64 h = (uint64) chan;
+
+    h ^= h >> 12;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return &sleepq[h >> 58];  // top log2(NSLEEPQ) bits
+}
+
+// Remove p from q if it is there.
+// Caller must hold q->lock.
+static void
+sleepq_remove(struct sleepq *q, struct proc *p) {
+    struct proc **pp;
+
+    if (!p->onsleepq)
+        return;
+    for (pp = &q->head; *pp; pp = &(*pp)->sqnext) {
+        if (*pp == p) {
+            *pp = p->sqnext;
+            break;
+        }
+    }
+    p->sqnext = 0;
+    p->onsleepq = 0;
+}
 
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Kernel threads take ids from a sequence of their own, far
+// above user pids, so that user processes are numbered from 1
+// as if there were none, and they aren't counted in nproc.
+#define KPIDBASE 1000000000
+int nextkpid = KPIDBASE;
+
+// UNUSED proc slots, and allocated procs hashed by pid.
+// Lock order: p->lock, then tab_lock.
+#define NPIDHASH 64
+
+struct spinlock tab_lock;
+struct proc *freeprocs;            // linked by p->tabnext
+struct proc *pidhash[NPIDHASH];    // linked by p->tabnext
+int nproc;                         // allocated procs; atomic
+
+#define PIDHASH(pid) (&pidhash[(uint)(pid) % NPIDHASH])
+
 extern void forkret(void);
 
 static void wakeup1(struct proc *chan);
 
 static void freeproc(struct proc *p);
 
+
 extern char trampoline[]; // trampoline.S
 
+static struct kmem_cache *mmcache;  // struct mm
+
+// The address spaces in use by processes, for the clock that
+// mmevict() runs over their pages: the hand is at page va of
+// mm hand, or at the head of the list if hand is 0.
+// Lock order: mms.lock, then mm->lock.
+static struct {
+    struct spinlock lock;
+    struct mm *list;
+    struct mm *hand;
+    uint64 va;
+} mms;
+
+// size the proc table by the amount of RAM, and allocate it.
+// called before kinit().
+void
+proctabinit(void) {
+    nprocs = bootmem() / PROCMEM;
+    if (nprocs < NPROC)
+        nprocs = NPROC;
+    if (nprocs > MAXPROC)
+        nprocs = MAXPROC;
+    proc = bootalloc(nprocs * sizeof(struct proc));
+}
+
 // initialize the proc table at boot time.
 void
 procinit(void) {
     struct proc *p;
 
     initlock(&pid_lock, "nextpid");
-    for (p = proc; p < &proc[NPROC]; p++) {
+    initlock(&tab_lock, "proctab");
+    initlock(&mms.lock, "mms");
+    for (int i = 0; i < NCPU; i++)
+        initlock(&runq[i].lock, "runq");
+    for (int i = 0; i < NSLEEPQ; i++)
+        initlock(&sleepq[i].lock, "sleepq");
+    mmcache = kmem_cache_create("mm", sizeof(struct mm));
+    for (p = proc; p < &proc[nprocs]; p++) {
         initlock(&p->lock, "proc");
 
         // Allocate a page for the process's kernel stack.
@@ -42,6 +152,10 @@ procinit(void) {
         kvmmap(va, (uint64) pa, PGSIZE, PTE_R | PTE_W);
         p->kstack = va;
     }
+    for (p = &proc[nprocs - 1]; p >= proc; p--) {
+        p->tabnext = freeprocs;
+        freeprocs = p;
+    }
     kvminithart();
 }
 
@@ -73,48 +187,394 @@ myproc(void) {
     return p;
 }
 
+// Interrupt CPU id, to get it out of wfi.
+static void
+ipi(int id) {
+    *(uint32 *) CLINTVA_MSIP(id) = 1;
+}
+
+// Append p to q at level p->prio.
+// Caller must hold q->lock.
+static void
+runq_append(struct runq *q, struct proc *p) {
+    int l = p->prio;
+
+    p->rqnext = 0;
+    if (q->tail[l])
+        q->tail[l]->rqnext = p;
+    else
+        q->head[l] = p;
+    q->tail[l] = p;
+}
+
+// Move every queued process back to its base level.
+// Caller must hold q->lock.
+static void
+runq_boost(struct runq *q) {
+    struct proc *p, *next;
+
+    for (int l = 1; l < NPRIO; l++) {
+        p = q->head[l];
+        q->head[l] = q->tail[l] = 0;
+        for (; p; p = next) {
+            next = p->rqnext;
+            p->prio = p->baseprio;
+            runq_append(q, p);
+        }
+    }
+    q->boosted = ticks;
+}
+
+// Mark p RUNNABLE and append it to the run queue of
+// the CPU it last ran on. If that CPU is busy, wake
+// an idle one, which will steal p.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p) {
+    struct runq *q = &runq[p->cpu];
+    int i;
+
+    p->state = RUNNABLE;
+    if (p->prio < p->baseprio)
+        p->prio = p->baseprio;
+    acquire(&q->lock);
+    runq_append(q, p);
+    q->n++;
+    release(&q->lock);
+
+    // Pairs with the fence in idle(): either the idle CPU
+    // sees p on the queue or we see it idle.
+    __sync_synchronize();
+    for (i = 0; i < NCPU; i++) {
+        int id = (p->cpu + i) % NCPU;
+        if (cpus[id].idle) {
+            ipi(id);
+            break;
+        }
+    }
+}
+
+// Take the first process of the best non-empty level
+// off CPU id's run queue, or 0.
+static struct proc *
+runq_pop(int id) {
+    struct runq *q = &runq[id];
+    struct proc *p = 0;
+
+    if (q->n == 0)   // racy peek, to spare the lock traffic
+        return 0;
+    acquire(&q->lock);
+    if (ticks - q->boosted >= BOOSTTICKS)
+        runq_boost(q);
+    for (int l = 0; l < NPRIO && p == 0; l++) {
+        p = q->head[l];
+        if (p) {
+            q->head[l] = p->rqnext;
+            if (q->head[l] == 0)
+                q->tail[l] = 0;
+            p->rqnext = 0;
+            q->n--;
+        }
+    }
+    release(&q->lock);
+    return p;
+}
+
 int
-allocpid() {
+allocpid(int kernel) {
     int pid;
 
     acquire(&pid_lock);
-    pid = nextpid;
-    nextpid = nextpid + 1;
+    if (kernel) {
+        pid = nextkpid;
+        nextkpid = nextkpid + 1;
+    } else {
+        pid = nextpid;
+        nextpid = nextpid + 1;
+    }
     release(&pid_lock);
 
     return pid;
 }
 
+// Make a new address space for p, with no user memory and
+// p's trapframe in slot 0.
+struct mm *
+mmalloc(struct proc *p) {
+    struct mm *mm;
+
+    if ((mm = kmem_cache_alloc(mmcache)) == 0)
+        return 0;
+    memset(mm, 0, sizeof(*mm));
+    initlock(&mm->lock, "mm");
+    if ((mm->pagetable = proc_pagetable(p)) == 0) {
+        kmem_cache_free(mmcache, mm);
+        return 0;
+    }
+    mm->ref = 1;
+    mm->tfmap = 1;
+    return mm;
+}
+
+// mm now holds a process's user memory: let mmevict() swap
+// its pages out. Until then, exec() and fork() fill it in
+// without taking mm->lock.
+void
+mmswappable(struct mm *mm) {
+    acquire(&mms.lock);
+    mm->mmnext = mms.list;
+    mms.list = mm;
+    mm->swappable = 1;
+    release(&mms.lock);
+}
+
+// Take mm off the list, before it is torn down. mmevict()
+// holds mms.lock while it looks at mm's pages.
+static void
+mmunlist(struct mm *mm) {
+    struct mm **pp;
+
+    acquire(&mms.lock);
+    for (pp = &mms.list; *pp != mm; pp = &(*pp)->mmnext)
+        ;
+    *pp = mm->mmnext;
+    if (mms.hand == mm) {
+        mms.hand = mm->mmnext;
+        mms.va = 0;
+    }
+    release(&mms.lock);
+}
+
+// Advance the clock over the address spaces' pages, looking at
+// up to *budget PTEs (see uvmevict()), until it has taken up to
+// n pages of one address space for swap. The pages' PTEs name
+// their new slots now; their addresses go in pa[] and their slots
+// in slot[]. Sets *mmp to the address space, which other threads
+// may be using the pages through their TLBs until mmflush(), and
+// which may be torn down as soon as this returns. Returns the
+// number of pages taken; 0 if none within the budget.
+int
+mmevict(struct mm **mmp, uint64 *pa, uint *slot, int n, int *budget) {
+    struct mm *mm;
+    int k;
+
+    acquire(&mms.lock);
+    while (*budget > 0) {
+        if (mms.hand == 0) {
+            if (mms.list == 0)
+                break;
+            mms.hand = mms.list;
+            mms.va = 0;
+        }
+        mm = mms.hand;
+        acquire(&mm->lock);
+        k = uvmevict(mm->pagetable, &mms.va, mm->sz, pa, slot, n, budget);
+        if (k > 0)
+            uvmsync(mm->pagetable);
+        release(&mm->lock);
+        if (k > 0) {
+            release(&mms.lock);
+            *mmp = mm;
+            return k;
+        }
+        if (*budget > 0) {
+            // past the end of mm
+            mms.hand = mm->mmnext;
+            mms.va = 0;
+        }
+    }
+    release(&mms.lock);
+    return 0;
+}
+
+// Let the new thread p use mm, mapping its trapframe in a
+// free slot.
+static int
+mmshare(struct mm *mm, struct proc *p) {
+    int slot;
+
+    acquire(&mm->lock);
+    for (slot = 0; slot < NTHREAD && (mm->tfmap & (1 << slot)); slot++)
+        ;
+    if (slot == NTHREAD ||
+        mappages(mm->pagetable, TRAPFRAMEN(slot), PGSIZE,
+                 (uint64) (p->trapframe), PTE_R | PTE_W) < 0) {
+        release(&mm->lock);
+        return -1;
+    }
+    mm->tfmap |= 1 << slot;
+    mm->ref++;
+    release(&mm->lock);
+    p->mm = mm;
+    p->tfva = TRAPFRAMEN(slot);
+    return 0;
+}
+
+// Drop a thread's use of mm, unmapping its trapframe from
+// tfva. The last thread tears the address space down: writes
+// back and drops mmap()ed regions, puts the program file and
+// frees the page table. That sleeps, unless mm never got a
+// region or a program file, as when allocproc() or fork() fail.
+void
+mmput(struct mm *mm, uint64 tfva) {
+    int last;
+
+    acquire(&mm->lock);
+    uvmunmap(mm->pagetable, tfva, 1, 0);
+    mm->tfmap &= ~(1 << ((TRAPFRAME - tfva) / PGSIZE));
+    last = --mm->ref == 0;
+    release(&mm->lock);
+    if (!last)
+        return;
+
+    if (mm->swappable)
+        mmunlist(mm);
+    mmapexit(mm);
+    if (mm->exe) {
+        textuse(mm->exe, -1);
+        begin_op();
+        iput(mm->exe);
+        end_op();
+    }
+    proc_freepagetable(mm->pagetable, mm->sz);
+    kmem_cache_free(mmcache, mm);
+}
+
+// Serialize sbrk(), mmap() and munmap() between mm's threads,
+// since they drop mm->lock part way through.
+void
+mmlock(struct mm *mm) {
+    acquire(&mm->lock);
+    while (mm->busy)
+        sleep(&mm->busy, &mm->lock);
+    mm->busy = 1;
+    release(&mm->lock);
+}
+
+void
+mmunlock(struct mm *mm) {
+    acquire(&mm->lock);
+    mm->busy = 0;
+    wakeup(&mm->busy);
+    release(&mm->lock);
+}
+
+// Wait until no other CPU may still use translations of mm's
+// PTEs from before the call. There are no TLB shootdown
+// interrupts, but a CPU bumps its tlbgen just before each full
+// TLB flush: on every return to user space and every switch
+// between processes. So wait for each CPU running another
+// thread of mm to bump it once. That thread may be in user
+// space until the next timer interrupt. The caller needn't be
+// one of mm's threads (see swapout()), and mm may even have
+// been freed: it is only compared with the CPUs' processes'.
+// Must not hold spinlocks.
+void
+mmflush(struct mm *mm) {
+    uint64 gen[NCPU];
+    struct proc *cp, *p = myproc();
+    int i, me;
+
+    if (p && p->mm == mm && __atomic_load_n(&mm->ref, __ATOMIC_RELAXED) < 2)
+        return;
+    __sync_synchronize();
+    push_off();
+    me = cpuid();
+    pop_off();
+    for (i = 0; i < NCPU; i++)
+        gen[i] = __atomic_load_n(&cpus[i].tlbgen, __ATOMIC_ACQUIRE);
+    for (i = 0; i < NCPU; i++) {
+        while (i != me && (cp = __atomic_load_n(&cpus[i].proc, __ATOMIC_ACQUIRE)) != 0 &&
+               cp->mm == mm && __atomic_load_n(&cpus[i].tlbgen, __ATOMIC_ACQUIRE) == gen[i])
+            yield();
+    }
+}
+
+// Unmap and free npages of mm's user memory from va. Another
+// thread may be using a page until mmflush() says it's safe,
+// so clear PTEs in batches and free each batch after a flush.
+void
+mmunmap(struct mm *mm, uint64 va, uint64 npages) {
+    uint64 pa[64], a, end = va + npages * PGSIZE;
+    pte_t *pte;
+    int i, n;
+
+    for (a = va; a < end;) {
+        acquire(&mm->lock);
+        for (n = 0; a < end && n < NELEM(pa); a += PGSIZE) {
+            if ((pte = walk(mm->pagetable, a, 0)) == 0)
+                continue;
+            if (*pte & PTE_V) {
+                if (PTE_FLAGS(*pte) == PTE_V)
+                    panic("mmunmap: not a leaf");
+                pa[n++] = PTE2PA(*pte);
+            } else if (*pte & PTE_SWAP) {
+                swapfree(PTE2SWAP(*pte));
+            }
+            *pte = 0;  // also drops any PTE_FILE mark
+        }
+        uvmsync(mm->pagetable);
+        release(&mm->lock);
+        mmflush(mm);
+        for (i = 0; i < n; i++)
+            kfree((void *) pa[i]);
+    }
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. It gets a new address space,
+// or shares mm if that is non-zero. kernel is set for a
+// kernel thread, which gets a kernel thread id.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc *
-allocproc(void) {
+allocproc(struct mm *mm, int kernel) {
     struct proc *p;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        acquire(&p->lock);
-        if (p->state == UNUSED) {
-            goto found;
-        } else {
-            release(&p->lock);
-        }
-    }
-    return 0;
+    acquire(&tab_lock);
+    p = freeprocs;
+    if (p)
+        freeprocs = p->tabnext;
+    release(&tab_lock);
+    if (p == 0)
+        return 0;
 
-    found:
-    p->pid = allocpid();
+    // p may still be locked by the freeproc() that freed it.
+    acquire(&p->lock);
+    if (p->state != UNUSED)
+        panic("allocproc");
+    p->pid = allocpid(kernel);
+    acquire(&tab_lock);
+    p->tabnext = *PIDHASH(p->pid);
+    *PIDHASH(p->pid) = p;
+    release(&tab_lock);
+    if (!kernel)
+        __sync_fetch_and_add(&nproc, 1);
 
     // Allocate a trapframe page.
     if ((p->trapframe = (struct trapframe *) kalloc()) == 0) {
+        freeproc(p);
         release(&p->lock);
         return 0;
     }
 
-    // An empty user page table.
-    p->pagetable = proc_pagetable(p);
-    if (p->pagetable == 0) {
+    // An empty user address space, or a share of mm.
+    if (mm == 0) {
+        if ((p->mm = mmalloc(p)) == 0) {
+            freeproc(p);
+            release(&p->lock);
+            return 0;
+        }
+        p->tfva = TRAPFRAME;
+    } else if (mmshare(mm, p) < 0) {
+        freeproc(p);
+        release(&p->lock);
+        return 0;
+    }
+    p->pagetable = p->mm->pagetable;
+
+    // A kernel page table to run on, which will map user memory.
+    if ((p->kpagetable = kvmcreate()) == 0) {
         freeproc(p);
         release(&p->lock);
         return 0;
@@ -130,17 +590,40 @@ allocproc(void) {
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
+// including user pages, and return it to the free list.
 // p->lock must be held.
 static void
 freeproc(struct proc *p) {
+    struct proc **pp;
+
+    acquire(&tab_lock);
+    for (pp = PIDHASH(p->pid); *pp; pp = &(*pp)->tabnext) {
+        if (*pp == p) {
+            *pp = p->tabnext;
+            break;
+        }
+    }
+    p->tabnext = freeprocs;
+    freeprocs = p;
+    release(&tab_lock);
+    if (p->pid < KPIDBASE)
+        __sync_fetch_and_sub(&nproc, 1);
+
+    // exit() has put the address space, unless p never ran.
+    if (p->mm)
+        mmput(p->mm, p->tfva);
+    p->mm = 0;
+    p->pagetable = 0;
     if (p->trapframe)
         kfree((void *) p->trapframe);
     p->trapframe = 0;
-    if (p->pagetable)
-        proc_freepagetable(p->pagetable, p->sz);
-    p->pagetable = 0;
-    p->sz = 0;
+    if (p->kpagetable)
+        kvmfree(p->kpagetable);
+    p->kpagetable = 0;
+    p->ucopy = 0;
+    p->thread = 0;
+    p->utime = p->stime = 0;
+    p->cutime = p->cstime = 0;
     p->pid = 0;
     p->parent = 0;
     p->name[0] = 0;
@@ -208,13 +691,15 @@ void
 userinit(void) {
     struct proc *p;
 
-    p = allocproc();
+    p = allocproc(0, 0);
     initproc = p;
 
     // allocate one user page and copy init's instructions
     // and data into it.
     uvminit(p->pagetable, initcode, sizeof(initcode));
-    p->sz = PGSIZE;
+    p->mm->sz = PGSIZE;
+    kvmsync(p->kpagetable, p->pagetable);
+    mmswappable(p->mm);
 
     // prepare for the very first "return" from kernel to user.
     p->trapframe->epc = 0;      // user program counter
@@ -223,27 +708,69 @@ userinit(void) {
     safestrcpy(p->name, "initcode", sizeof(p->name));
     p->cwd = namei("/");
 
-    p->state = RUNNABLE;
+    p->cpu = 0;
+    setrunnable(p);
 
     release(&p->lock);
 }
 
-// Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
-growproc(int n) {
-    uint sz;
+// A kernel thread's first scheduling swtch()es here.
+static void
+kthreadret(void) {
     struct proc *p = myproc();
 
-    sz = p->sz;
-    if (n > 0) {
-        if ((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-            return -1;
-        }
-    } else if (n < 0) {
-        sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // Still holding p->lock from scheduler.
+    release(&p->lock);
+    p->kfn();
+    panic("kthread returned");
+}
+
+// Start a kernel thread running fn(), which must not return.
+// It has no parent and never enters user space, so it
+// never exits or gets waited for. Returns its id, which is
+// not a user pid (KPIDBASE), or -1.
+// Must be called from process context, since fn may use
+// the file system right away.
+int
+kthread(void (*fn)(void), char *name) {
+    struct proc *p;
+
+    if ((p = allocproc(0, 1)) == 0)
+        return -1;
+    p->kfn = fn;
+    p->context.ra = (uint64) kthreadret;
+    safestrcpy(p->name, name, sizeof(p->name));
+    p->cpu = 0;
+    setrunnable(p);
+    release(&p->lock);
+    return p->pid;
+}
+
+// Grow or shrink user memory by n bytes.
+// Growing only reserves address space; pages are allocated
+// on first touch by uvmfault().
+// Set *oldszp to the old size, which threads calling together
+// each see differently. Return 0 on success, -1 on failure.
+int
+growproc(int n, uint64 *oldszp) {
+    uint64 sz, oldsz;
+    struct mm *mm = myproc()->mm;
+
+    mmlock(mm);
+    acquire(&mm->lock);
+    sz = oldsz = mm->sz;
+    if ((n > 0 && sz + n > mmapbase(mm)) || (n < 0 && sz < -n)) {
+        release(&mm->lock);
+        mmunlock(mm);
+        return -1;
     }
-    p->sz = sz;
+    *oldszp = oldsz;
+    sz += n;
+    mm->sz = sz;  // other threads fault nothing in above sz now
+    release(&mm->lock);
+    if (PGROUNDUP(sz) < PGROUNDUP(oldsz))
+        mmunmap(mm, PGROUNDUP(sz), (PGROUNDUP(oldsz) - PGROUNDUP(sz)) / PGSIZE);
+    mmunlock(mm);
     return 0;
 }
 
@@ -256,22 +783,40 @@ fork(void) {
     struct proc *p = myproc();
 
     // Allocate process.
-    if ((np = allocproc()) == 0) {
+    if ((np = allocproc(0, 0)) == 0) {
         return -1;
     }
 
-    // Copy user memory from parent to child.
-    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
+    // Copy user memory from parent to child. uvmcopy() marks
+    // the parent's pages copy-on-write, so hold off its threads.
+    acquire(&p->mm->lock);
+    if (uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0) {
+        release(&p->mm->lock);
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+    np->mm->sz = p->mm->sz;
+    if (mmapfork(p->mm, np->mm) < 0) {
+        release(&p->mm->lock);
+        uvmsync(p->pagetable);
         freeproc(np);
         release(&np->lock);
         return -1;
     }
-    np->sz = p->sz;
+    release(&p->mm->lock);
+    uvmsync(p->pagetable);
+    kvmsync(np->kpagetable, np->pagetable);
+    mmswappable(np->mm);
 
     np->parent = p;
 
     // trace mask
     np->trace_mask = p->trace_mask;
+    np->trace_flags = p->trace_flags;
+
+    np->baseprio = p->baseprio;
+    np->prio = p->baseprio;
 
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
@@ -284,12 +829,135 @@ fork(void) {
         if (p->ofile[i])
             np->ofile[i] = filedup(p->ofile[i]);
     np->cwd = idup(p->cwd);
+    if (p->mm->exe) {
+        np->mm->exe = idup(p->mm->exe);
+        textuse(np->mm->exe, 1);
+    }
+    memmove(np->mm->seg, p->mm->seg, sizeof(p->mm->seg));
+    np->mm->nseg = p->mm->nseg;
 
     safestrcpy(np->name, p->name, sizeof(p->name));
 
     pid = np->pid;
 
-    np->state = RUNNABLE;
+    // the parent's other threads may still write to the pages
+    // now shared copy-on-write, through stale TLB entries.
+    if (p->mm->ref > 1) {
+        release(&np->lock);
+        mmflush(p->mm);
+        acquire(&np->lock);
+    }
+
+    np->cpu = cpuid();  // interrupts are off while np->lock is held
+    setrunnable(np);
+
+    release(&np->lock);
+
+    return pid;
+}
+
+// Create a child process running the program at path, as fork()
+// followed by exec() would, but without copying the caller's
+// address space only to throw it away. The child's descriptors
+// 0 to NSPAWNFD-1 are fds[], where not null; it gets no others.
+// Takes over the caller's references to fds[].
+// Returns the child's pid, or -1 if the program cannot be run.
+int
+spawn(char *path, char **argv, struct file **fds) {
+    int i, argc, pid;
+    uint64 entry, sp;
+    struct proc *np;
+    struct proc *p = myproc();
+
+    if ((np = allocproc(0, 0)) == 0)
+        goto bad;
+    // loading the program sleeps. np is not on any run queue
+    // and has no parent yet, so nothing else will touch it.
+    release(&np->lock);
+    if ((argc = execload(np->mm, path, argv, &entry, &sp)) < 0) {
+        // mmput() may sleep in iput(), so not under np->lock.
+        mmput(np->mm, np->tfva);
+        np->mm = 0;
+        acquire(&np->lock);
+        freeproc(np);
+        release(&np->lock);
+        goto bad;
+    }
+    kvmsync(np->kpagetable, np->pagetable);
+    mmswappable(np->mm);
+
+    memset(np->trapframe, 0, sizeof(*np->trapframe));
+    np->trapframe->epc = entry;
+    np->trapframe->sp = sp;
+    np->trapframe->a0 = argc;
+    np->trapframe->a1 = sp;
+
+    for (i = 0; i < NSPAWNFD; i++)
+        np->ofile[i] = fds[i];
+    np->cwd = idup(p->cwd);
+    execname(np, path);
+
+    acquire(&np->lock);
+    np->parent = p;
+    np->trace_mask = p->trace_mask;
+    np->trace_flags = p->trace_flags;
+    np->baseprio = p->baseprio;
+    np->prio = p->baseprio;
+    pid = np->pid;
+    np->cpu = cpuid();
+    setrunnable(np);
+    release(&np->lock);
+
+    return pid;
+
+    bad:
+    for (i = 0; i < NSPAWNFD; i++)
+        if (fds[i])
+            fileclose(fds[i]);
+    return -1;
+}
+
+// Create a thread that shares the caller's address space and
+// runs fn(arg) in user space on the stack below stack. The
+// thread gets its own trapframe and kernel stack, and copies
+// of the caller's open file descriptors and current directory.
+// Returns its pid, which join() waits for.
+int
+clone(uint64 fn, uint64 arg, uint64 stack) {
+    int i, pid;
+    struct proc *np;
+    struct proc *p = myproc();
+
+    if (stack == 0)
+        return -1;
+    if ((np = allocproc(p->mm, 0)) == 0)
+        return -1;
+    kvmsync(np->kpagetable, np->pagetable);
+
+    np->parent = p;
+    np->thread = 1;
+    np->trace_mask = p->trace_mask;
+    np->trace_flags = p->trace_flags;
+    np->baseprio = p->baseprio;
+    np->prio = p->baseprio;
+
+    *(np->trapframe) = *(p->trapframe);
+    np->trapframe->epc = fn;
+    np->trapframe->a0 = arg;
+    np->trapframe->sp = stack & ~0xfULL;  // riscv sp must be 16-byte aligned
+    np->trapframe->ra = 0;  // fn must not return
+
+    for (i = 0; i < NOFILE; i++)
+        if (p->ofile[i])
+            np->ofile[i] = filedup(p->ofile[i]);
+    np->cwd = idup(p->cwd);
+
+    safestrcpy(np->name, p->name, sizeof(p->name));
+
+    pid = np->pid;
+
+    np->cpu = cpuid();  // idle CPUs steal it from our queue
+    setrunnable(np);
 
     release(&np->lock);
 
@@ -302,7 +970,7 @@ void
 reparent(struct proc *p) {
     struct proc *pp;
 
-    for (pp = proc; pp < &proc[NPROC]; pp++) {
+    for (pp = proc; pp < &proc[nprocs]; pp++) {
         // this code uses pp->parent without holding pp->lock.
         // acquiring the lock first could cause a deadlock
         // if pp or a child of pp were also in exit()
@@ -331,6 +999,18 @@ exit(int status) {
     if (p == initproc)
         panic("init exiting");
 
+    // A process's exit ends the threads it made with clone().
+    if (!p->thread && p->mm->ref > 1)
+        killthreads(p);
+
+    // Stop using the user page table, which mmput() may free.
+    struct mm *mm = p->mm;
+    p->mm = 0;
+    p->pagetable = 0;
+    kvmsync(p->kpagetable, 0);
+    sfence_vma();
+    mmput(mm, p->tfva);
+
     // Close all open files.
     for (int fd = 0; fd < NOFILE; fd++) {
         if (p->ofile[fd]) {
@@ -386,10 +1066,12 @@ exit(int status) {
     panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr) {
+// Wait for a child to exit and return its pid: a child
+// process, or for join() a thread made by clone(), pid or any
+// if pid is 0. init reaps both, since it inherits the threads
+// of exited processes. Return -1 if there is no such child.
+static int
+waitchild(int threads, int tid, uint64 addr) {
     struct proc *np;
     int havekids, pid;
     struct proc *p = myproc();
@@ -401,11 +1083,12 @@ wait(uint64 addr) {
     for (;;) {
         // Scan through table looking for exited children.
         havekids = 0;
-        for (np = proc; np < &proc[NPROC]; np++) {
+        for (np = proc; np < &proc[nprocs]; np++) {
             // this code uses np->parent without holding np->lock.
             // acquiring the lock first would cause a deadlock,
             // since np might be an ancestor, and we already hold p->lock.
-            if (np->parent == p) {
+            if (np->parent == p && (np->thread == threads || p == initproc) &&
+                (tid == 0 || np->pid == tid)) {
                 // np->parent can't change between the check and the acquire()
                 // because only the parent changes it, and we're the parent.
                 acquire(&np->lock);
@@ -419,6 +1102,8 @@ wait(uint64 addr) {
                         release(&p->lock);
                         return -1;
                     }
+                    p->cutime += np->utime + np->cutime;
+                    p->cstime += np->stime + np->cstime;
                     freeproc(np);
                     release(&np->lock);
                     release(&p->lock);
@@ -439,10 +1124,77 @@ wait(uint64 addr) {
     }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr) {
+    return waitchild(0, 0, addr);
+}
+
+// Wait for thread tid made by this process's clone(), or any
+// such thread if tid is 0, to exit and return its pid.
+int
+join(int tid, uint64 addr) {
+    return waitchild(1, tid, addr);
+}
+
+// Is any run queue non-empty?
+static int
+runq_ready(void) {
+    for (int i = 0; i < NCPU; i++) {
+        if (runq[i].n)
+            return 1;
+    }
+    return 0;
+}
+
+// Wait for an interrupt, unless work showed up, and
+// account the time as idle.
+static void
+idle(struct cpu *c) {
+    uint64 now;
+
+    c->idle = 1;
+    __sync_synchronize();
+    if (!runq_ready()) {
+        timerslice();  // no slice to time while idle
+        cputime(0);
+        asm volatile("wfi");
+        now = r_time();
+        c->idlecycles += now - c->stamp;
+        c->stamp = now;
+    }
+    c->idle = 0;
+}
+
+// Charge the time since this CPU's last call to the process
+// running on it, if any, and to the CPU: as user time if user
+// is set, else as system time. Called at each switch between
+// user space, the kernel and the scheduler.
+// Interrupts must be off.
+void
+cputime(int user) {
+    struct cpu *c = mycpu();
+    struct proc *p = c->proc;
+    uint64 now = r_time(), d = now - c->stamp;
+
+    c->stamp = now;
+    if (user) {
+        c->utime += d;
+        if (p)
+            p->utime += d;
+    } else {
+        c->stime += d;
+        if (p)
+            p->stime += d;
+    }
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process from this CPU's run queue, or
+//    steal one from another CPU's queue if it is empty.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -450,35 +1202,48 @@ void
 scheduler(void) {
     struct proc *p;
     struct cpu *c = mycpu();
+    int id = cpuid();
 
     c->proc = 0;
+    c->stamp = r_time();
     for (;;) {
         // Avoid deadlock by ensuring that devices can interrupt.
         intr_on();
 
-        int found = 0;
-        for (p = proc; p < &proc[NPROC]; p++) {
-            acquire(&p->lock);
-            if (p->state == RUNNABLE) {
-                // Switch to chosen process.  It is the process's job
-                // to release its lock and then reacquire it
-                // before jumping back to us.
-                p->state = RUNNING;
-                c->proc = p;
-                swtch(&c->context, &p->context);
-
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
-
-                found = 1;
-            }
-            release(&p->lock);
-        }
-        if (found == 0) {
-            intr_on();
-            asm volatile("wfi");
+        p = runq_pop(id);
+        for (int i = 1; p == 0 && i < NCPU; i++)
+            p = runq_pop((id + i) % NCPU);
+        if (p == 0) {
+            idle(c);
+            continue;
         }
+
+        // p is off the queue, so no other CPU can pick it. It may
+        // still be switching out on its previous CPU, which holds
+        // p->lock until it is back in its scheduler.
+        acquire(&p->lock);
+        if (p->state != RUNNABLE)
+            panic("scheduler: queued proc not runnable");
+        // Switch to chosen process.  It is the process's job
+        // to release its lock and then reacquire it
+        // before jumping back to us.
+        p->state = RUNNING;
+        p->cpu = id;
+        cputime(0);  // the scheduler's own time
+        c->proc = p;
+        timerslice();
+        c->tlbgen++;  // see mmflush()
+        w_satp(MAKE_SATP(p->kpagetable));
+        sfence_vma();
+        swtch(&c->context, &p->context);
+        cputime(0);
+        c->tlbgen++;
+        kvminithart();
+
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        c->proc = 0;
+        release(&p->lock);
     }
 }
 
@@ -504,16 +1269,30 @@ sched(void) {
         panic("sched interruptible");
 
     intena = mycpu()->intena;
+    statinc(ST_CSWITCH);
     swtch(&p->context, &mycpu()->context);
     mycpu()->intena = intena;
 }
 
+// Give up the CPU because the timer expired, and move
+// down to the next scheduling level.
+void
+preempt(void) {
+    struct proc *p = myproc();
+    acquire(&p->lock);
+    if (p->prio < NPRIO - 1)
+        p->prio++;
+    setrunnable(p);
+    sched();
+    release(&p->lock);
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void) {
     struct proc *p = myproc();
     acquire(&p->lock);
-    p->state = RUNNABLE;
+    setrunnable(p);
     sched();
     release(&p->lock);
 }
@@ -533,35 +1312,125 @@ forkret(void) {
         // be run from main().
         first = 0;
         fsinit(ROOTDEV);
+        kzeroinit();
+        kreclaiminit();
     }
 
     usertrapret();
 }
 
+// Time asleep per call site of sleep(), for waitstat().
+static struct waitstat waitstats[NWAITSTAT];
+static int nwaitstat;
+static uint waitstatlock;  // a bare flag: taken under p->lock
+
+// Charge t ticks asleep to call site pc[2]. Sites beyond
+// NWAITSTAT go uncounted.
+static void
+waitrecord(uint64 *pc, uint64 t) {
+    struct waitstat *w;
+
+    while (__sync_lock_test_and_set(&waitstatlock, 1) != 0)
+        ;
+    for (w = waitstats; w < &waitstats[nwaitstat]; w++)
+        if (w->pc[0] == pc[0] && w->pc[1] == pc[1])
+            break;
+    if (w == &waitstats[nwaitstat] && nwaitstat < NWAITSTAT) {
+        w->pc[0] = pc[0];
+        w->pc[1] = pc[1];
+        nwaitstat++;
+    }
+    if (w < &waitstats[nwaitstat]) {
+        w->n++;
+        w->time += t;
+        if (t > w->maxtime)
+            w->maxtime = t;
+    }
+    __sync_lock_release(&waitstatlock);
+}
+
+// Copy up to n call sites' sleep times to user address dst,
+// then forget them all if reset is set. Returns the number
+// copied.
+int
+waitstatread(uint64 dst, int n, int reset) {
+    struct proc *p = myproc();
+    struct waitstat ws;
+    int i;
+
+    if (n < 0)
+        return -1;
+    for (i = 0; i < n; i++) {
+        push_off();
+        while (__sync_lock_test_and_set(&waitstatlock, 1) != 0)
+            ;
+        if (i < nwaitstat)
+            ws = waitstats[i];
+        __sync_lock_release(&waitstatlock);
+        pop_off();
+        if (i >= nwaitstat)
+            break;
+        if (dst && copyout(p->pagetable, dst + i * sizeof(ws), (char *) &ws, sizeof(ws)) < 0)
+            return -1;
+    }
+    if (reset) {
+        push_off();
+        while (__sync_lock_test_and_set(&waitstatlock, 1) != 0)
+            ;
+        nwaitstat = 0;
+        memset(waitstats, 0, sizeof(waitstats));
+        __sync_lock_release(&waitstatlock);
+        pop_off();
+    }
+    return i;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk) {
     struct proc *p = myproc();
+    struct sleepq *q = chanq(chan);
+    uint64 fp;
 
     // Must acquire p->lock in order to
     // change p->state and then call sched.
-    // Once we hold p->lock, we can be
-    // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
+    // Once we hold p->lock and are on chan's
+    // sleep queue, we can be guaranteed that we
+    // won't miss any wakeup (wakeup finds us on
+    // the queue and locks p->lock),
     // so it's okay to release lk.
-    if (lk != &p->lock) {  //DOC: sleeplock0
+    if (lk != &p->lock)  //DOC: sleeplock0
         acquire(&p->lock);  //DOC: sleeplock1
-        release(lk);
-    }
+
+    // Note who is sleeping: our caller, and its caller from
+    // the frame above ours on the kernel stack.
+    p->sleeppc[0] = (uint64) __builtin_return_address(0);
+    p->sleeppc[1] = 0;
+    fp = *(uint64 *) (r_fp() - 16);
+    if (fp > p->kstack + 16 && fp <= p->kstack + PGSIZE)
+        p->sleeppc[1] = *(uint64 *) (fp - 8);
+    p->sleepat = r_time();
 
     // Go to sleep.
     p->chan = chan;
     p->state = SLEEPING;
+    acquire(&q->lock);
+    p->sqnext = q->head;
+    q->head = p;
+    p->onsleepq = 1;
+    release(&q->lock);
+
+    if (lk != &p->lock)
+        release(lk);
 
     sched();
+    waitrecord(p->sleeppc, r_time() - p->sleepat);
 
-    // Tidy up.
+    // Tidy up; kill() and wakeup1() leave us queued.
+    acquire(&q->lock);
+    sleepq_remove(q, p);
+    release(&q->lock);
     p->chan = 0;
 
     // Reacquire original lock.
@@ -575,15 +1444,40 @@ sleep(void *chan, struct spinlock *lk) {
 // Must be called without any p->lock.
 void
 wakeup(void *chan) {
-    struct proc *p;
+    struct sleepq *q = chanq(chan);
+    struct proc *woken[16];
+    struct proc *p, **pp;
+    int i, n;
+
+    // Unlink chan's sleepers, then wake them without
+    // holding the queue lock, to keep the lock order.
+    // Go round again if woken[] filled up.
+    again:
+    n = 0;
+    acquire(&q->lock);
+    for (pp = &q->head; (p = *pp) != 0 && n < NELEM(woken);) {
+        if (p->chan == chan) {
+            *pp = p->sqnext;
+            p->sqnext = 0;
+            p->onsleepq = 0;
+            woken[n++] = p;
+        } else {
+            pp = &p->sqnext;
+        }
+    }
+    release(&q->lock);
 
-    for (p = proc; p < &proc[NPROC]; p++) {
+    for (i = 0; i < n; i++) {
+        p = woken[i];
         acquire(&p->lock);
         if (p->state == SLEEPING && p->chan == chan) {
-            p->state = RUNNABLE;
+            p->prio = p->baseprio;
+            setrunnable(p);
         }
         release(&p->lock);
     }
+    if (n == NELEM(woken))
+        goto again;
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -593,7 +1487,58 @@ wakeup1(struct proc *p) {
     if (!holding(&p->lock))
         panic("wakeup1");
     if (p->chan == p && p->state == SLEEPING) {
-        p->state = RUNNABLE;
+        p->prio = p->baseprio;
+        setrunnable(p);
+    }
+}
+
+// Return the process with the given pid, locked, or 0.
+static struct proc *
+findproc(int pid) {
+    struct proc *p;
+
+    acquire(&tab_lock);
+    for (p = *PIDHASH(pid); p; p = p->tabnext) {
+        if (p->pid == pid)
+            break;
+    }
+    release(&tab_lock);
+    if (p == 0)
+        return 0;
+
+    // p may have been freed, or even reused, since.
+    acquire(&p->lock);
+    if (p->pid != pid || p->state == UNUSED) {
+        release(&p->lock);
+        return 0;
+    }
+    return p;
+}
+
+// Mark p killed, waking it if it sleeps.
+// Caller must hold p->lock.
+static void
+kill1(struct proc *p) {
+    p->killed = 1;
+    if (p->state == SLEEPING) {
+        // Wake process from sleep().
+        p->prio = p->baseprio;
+        setrunnable(p);
+    }
+}
+
+// Kill the other threads that share p's address space.
+void
+killthreads(struct proc *p) {
+    struct proc *pp;
+
+    for (pp = proc; pp < &proc[nprocs]; pp++) {
+        if (pp == p || pp->mm != p->mm)
+            continue;
+        acquire(&pp->lock);
+        if (pp->mm == p->mm)
+            kill1(pp);
+        release(&pp->lock);
     }
 }
 
@@ -604,20 +1549,27 @@ int
 kill(int pid) {
     struct proc *p;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        acquire(&p->lock);
-        if (p->pid == pid) {
-            p->killed = 1;
-            if (p->state == SLEEPING) {
-                // Wake process from sleep().
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
-            return 0;
-        }
-        release(&p->lock);
-    }
-    return -1;
+    if ((p = findproc(pid)) == 0)
+        return -1;
+    kill1(p);
+    release(&p->lock);
+    return 0;
+}
+
+// Set the base scheduling level of the process with the
+// given pid; 0 is the most favoured level.
+int
+setpriority(int pid, int prio) {
+    struct proc *p;
+
+    if (prio < 0 || prio >= NPRIO)
+        return -1;
+    if ((p = findproc(pid)) == 0)
+        return -1;
+    p->baseprio = prio;
+    p->prio = prio;  // takes effect when next queued
+    release(&p->lock);
+    return 0;
 }
 
 // Copy to either a user address, or kernel address,
@@ -664,7 +1616,7 @@ procdump(void) {
     char *state;
 
     printf("\n");
-    for (p = proc; p < &proc[NPROC]; p++) {
+    for (p = proc; p < &proc[nprocs]; p++) {
         if (p->state == UNUSED)
             continue;
         if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -672,18 +1624,54 @@ procdump(void) {
         else
             state = "???";
         printf("%d %s %s", p->pid, state, p->name);
+        if (p->state == SLEEPING)
+            printf(" on %p for %d ms, from %p %p", p->chan,
+                   (int) ((r_time() - p->sleepat) / (TIMEHZ / 1000)),
+                   p->sleeppc[0], p->sleeppc[1]);
         printf("\n");
     }
 }
 
 uint64
 getNproc() {
-    struct proc *p;
-    uint64 count = 0;
-    for (p = proc; p < &proc[NPROC]; p++) {
-        if (p->state != UNUSED) {
-            count++;
-        }
+    return __atomic_load_n(&nproc, __ATOMIC_RELAXED);
+}
+
+// Event counters for sysinfo, per CPU so that counting takes
+// no lock and no shared cache line.
+static struct {
+    uint64 n[NSTAT];
+} __attribute__((aligned(64))) cpustats[NCPU];
+
+// Count one event of kind st (ST_*).
+void
+statinc(int st) {
+    push_off();
+    cpustats[cpuid()].n[st]++;
+    pop_off();
+}
+
+// Report per-CPU time, and the calling process's.
+void
+cpuinfo(struct sysinfo *info) {
+    int n = NCPU < SYSINFO_MAXCPU ? NCPU : SYSINFO_MAXCPU;
+    struct proc *p = myproc();
+
+    info->ncpu = n;
+    for (int i = 0; i < n; i++) {
+        info->idlecycles[i] = cpus[i].idlecycles;
+        info->utime[i] = cpus[i].utime;
+        info->stime[i] = cpus[i].stime;
+    }
+    for (int i = 0; i < NSTAT; i++) {
+        info->stat[i] = 0;
+        for (int j = 0; j < NCPU; j++)
+            info->stat[i] += cpustats[j].n[i];
     }
-    return count;
+    info->putime = p->utime;
+    info->pstime = p->stime;
+    acquire(&p->lock);
+    info->cutime = p->cutime;
+    info->cstime = p->cstime;
+    release(&p->lock);
 }
@@ -24,6 +24,15 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // In wfi in scheduler(); wake with ipi().
+  uint64 idlecycles;          // Time spent idle (timer cycles).
+  uint64 utime;               // Time spent in user space (timer cycles).
+  uint64 stime;               // Time spent in the kernel, not idle.
+  uint64 stamp;               // r_time() when last charged; see cputime().
+  uint64 tlbgen;              // Bumped just before each full TLB flush.
+  uint64 slice;               // When proc's time slice ends (r_time()).
+  uint64 profnext;            // When to take the next profiler sample.
+  int profdue;                // A profiler sample is due; see prof.c.
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,12 +91,58 @@ struct trapframe {
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region of a file mapped by mmap(); see mmap.c.
+struct vma {
+  uint64 addr;      // first byte, page-aligned
+  uint64 len;       // bytes, a multiple of PGSIZE; 0 if unused
+  int prot;         // PROT_ bits
+  int flags;        // MAP_SHARED or MAP_PRIVATE
+  struct file *f;   // mapped file, referenced
+  uint64 off;       // file offset of addr
+};
+
+// A program segment that exec() left for execfault() to read in.
+struct seg {
+  uint64 va;        // first byte, page-aligned
+  uint64 memsz;     // bytes of memory
+  uint64 filesz;    // bytes read from the file; the rest is zero
+  uint64 off;       // file offset of va
+  int perm;         // PTE_R, PTE_W, PTE_X
+};
+
+// A user address space. fork() gives the child a copy of
+// the parent's; clone() makes a thread that shares it. Each
+// thread maps its own trapframe in the shared page table, at
+// TRAPFRAME - slot*PGSIZE.
+//
+// lock serializes changes to the page table's PTEs, sz and
+// vma[] between threads. Code that sleeps (reading a file
+// page in, writing one back) drops it and checks again
+// before installing its result; sbrk(), mmap() and munmap()
+// also take mmlock() to keep out of each other's way. exe
+// and seg[] only change when exec() makes a new address space.
+struct mm {
+  struct spinlock lock;
+  int ref;                     // Threads using it
+  int busy;                    // Held by mmlock()
+  uint tfmap;                  // Trapframe slots in use, one bit each
+  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes)
+  struct vma vma[NVMA];        // mmap()ed regions
+  struct inode *exe;           // Program file, for seg[]
+  struct seg seg[NSEG];        // Demand-loaded program segments
+  int nseg;
+  int swappable;               // On the list for mmevict()
+  struct mm *mmnext;           // ... which this links
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
 
   // trace 掩码
   int trace_mask;
+  int trace_flags;             // TRACE_RING
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
@@ -96,14 +151,34 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p joins when runnable
+  int prio;                    // Current MLFQ level; 0 runs first
+  int baseprio;                // Level to return to on wakeup, set by setpriority()
+  struct proc *rqnext;         // Next on run queue, protected by its lock
+  struct proc *tabnext;        // Next free or same-hash proc, protected by tab_lock
+  struct proc *sqnext;         // Next on sleep queue, protected by its lock
+  int onsleepq;                // On a sleep queue; protected by its lock
+  uint64 wakeat;               // sleep() deadline, protected by the timer lock
+  uint64 sleepat;              // r_time() when p went to sleep
+  uint64 sleeppc[2];           // sleep()'s caller and its caller
+  int tmridx;                  // Index in the timer heap while queued there
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct mm *mm;               // Address space, maybe shared with threads
+  pagetable_t pagetable;       // mm->pagetable, for short
+  pagetable_t kpagetable;      // Kernel page table that also maps user memory
+  int ucopy;                   // copyin() is reading user memory directly
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // user address of trapframe
+  int thread;                  // made by clone(): reaped by join(), not wait()
+  uint64 utime;                // CPU time in user space (timer cycles)
+  uint64 stime;                // CPU time in the kernel
+  uint64 cutime;               // utime+cutime of reaped children, under p->lock
+  uint64 cstime;               // stime+cstime of reaped children, under p->lock
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Kernel thread body, see kthread()
 };
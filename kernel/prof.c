@@ -0,0 +1,135 @@
+// Sampling profiler.
+//
+// While profiling is on, each CPU running a process takes a
+// timer interrupt PROFHZ times a second (see timer.c) and
+// records the interrupted pc and a few return addresses from
+// the frame-pointer chain into its own sample ring. Samples
+// that find the ring full are counted and dropped.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "prof.h"
+#include "time.h"
+#include "defs.h"
+
+#define NPROFSAMP 1024   // samples per CPU
+
+struct {
+  struct spinlock lock;    // serializes profctl() and profread()
+  struct {
+    struct profsample s[NPROFSAMP];
+    uint head;             // next to read
+    uint tail;             // next to write; head == tail: empty
+    uint64 drops;
+  } cpu[NCPU];
+} prof;
+
+uint profhz;   // samples per second per CPU, or 0 for off
+
+void
+profinit(void)
+{
+  initlock(&prof.lock, "prof");
+}
+
+// Start sampling at hz per second, dropping old samples, or
+// stop if hz is 0. Returns the number of samples dropped for
+// want of room since the last start.
+uint64
+profctl(uint hz)
+{
+  uint64 drops = 0;
+  int i;
+
+  if(hz > TIMEHZ)
+    return -1;
+  acquire(&prof.lock);
+  for(i = 0; i < NCPU; i++)
+    drops += prof.cpu[i].drops;
+  if(hz){
+    profhz = 0;
+    __sync_synchronize();
+    for(i = 0; i < NCPU; i++){
+      prof.cpu[i].head = prof.cpu[i].tail;
+      prof.cpu[i].drops = 0;
+    }
+  }
+  __sync_synchronize();
+  profhz = hz;
+  release(&prof.lock);
+  return drops;
+}
+
+// Called from the timer interrupt path with interrupts off: a
+// sample of the interrupted code, at pc with frame pointer fp.
+void
+profsample(struct proc *p, uint64 pc, uint64 fp, int user)
+{
+  struct profsample *s;
+  uint64 a, pa, top;
+  int i, id = cpuid();
+
+  if(prof.cpu[id].tail - prof.cpu[id].head >= NPROFSAMP){
+    prof.cpu[id].drops++;
+    return;
+  }
+  s = &prof.cpu[id].s[prof.cpu[id].tail % NPROFSAMP];
+  s->pid = p ? p->pid : 0;
+  s->user = user;
+  s->pc[0] = pc;
+  top = PGROUNDUP(fp);
+  if(top == fp)
+    top += PGSIZE;
+  for(i = 1; i < PROFDEPTH; i++){
+    // the return address is at fp-8 and the caller's fp at
+    // fp-16. Stay within the stack page, and do not fault on
+    // user memory from an interrupt.
+    if(fp % 8 != 0 || fp - 16 < top - PGSIZE || fp > top)
+      break;
+    a = fp - 16;
+    if(user){
+      if(p == 0 || a >= MAXVA || (pa = walkaddr(p->pagetable, a)) == 0)
+        break;
+      pa += a - PGROUNDDOWN(a);
+      s->pc[i] = ((uint64*)pa)[1];
+      fp = ((uint64*)pa)[0];
+    } else {
+      s->pc[i] = ((uint64*)a)[1];
+      fp = ((uint64*)a)[0];
+    }
+  }
+  for(; i < PROFDEPTH; i++)
+    s->pc[i] = 0;
+  __sync_synchronize();
+  prof.cpu[id].tail++;
+}
+
+// Copy up to n samples to user address dst, removing them.
+// Returns the number copied.
+int
+profread(uint64 dst, int n)
+{
+  struct proc *p = myproc();
+  struct profsample s;
+  int i, got = 0;
+
+  acquire(&prof.lock);
+  for(i = 0; i < NCPU && got < n; i++){
+    while(got < n && prof.cpu[i].head != prof.cpu[i].tail){
+      s = prof.cpu[i].s[prof.cpu[i].head % NPROFSAMP];
+      __sync_synchronize();
+      prof.cpu[i].head++;
+      release(&prof.lock);
+      if(copyout(p->pagetable, dst + got * sizeof(s), (char*)&s, sizeof(s)) < 0)
+        return got ? got : -1;
+      acquire(&prof.lock);
+      got++;
+    }
+  }
+  release(&prof.lock);
+  return got;
+}
@@ -0,0 +1,9 @@
+// Samples of the sampling profiler, see prof.c.
+
+#define PROFDEPTH 4   // pc and up to 3 return addresses
+
+struct profsample {
+  uint64 pc[PROFDEPTH];  // pc[0] interrupted pc, then callers; 0 ends
+  int pid;               // 0 if no process was running
+  int user;              // 1 if pc[] are user addresses
+};
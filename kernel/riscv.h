@@ -40,6 +40,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -233,6 +234,30 @@ r_stval()
   return x;
 }
 
+// frame pointer, s0
+static inline uint64
+r_fp()
+{
+  uint64 x;
+  asm volatile("mv %0, s0" : "=r" (x) );
+  return x;
+}
+
+// Supervisor-mode Counter-Enable
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // Machine-mode Counter-Enable
 static inline void 
 w_mcounteren(uint64 x)
@@ -248,6 +273,8 @@ r_mcounteren()
   return x;
 }
 
+#define COUNTEREN_TM (1L << 1)  // the time CSR
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -331,14 +358,28 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6) // accessed, set by the hardware
+#define PTE_COW (1L << 8) // RSW bit: copy-on-write page shared after fork
+#define PTE_FILE (1L << 9) // RSW bit, in an invalid PTE: page of a program file, see execfault()
+#define PTE_SWAP (1L << 8) // RSW bit, in an invalid PTE: page swapped out, see swapfault()
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
 
 #define PTE2PA(pte) (((pte) >> 10) << 12)
 
+// a swapped-out page's swap slot, kept where its PPN was.
+#define SWAP2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SWAP(pte) ((uint)((pte) >> 10))
+
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a valid PTE with any of R, W, X set is a leaf; otherwise it
+// points to the next level of the page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
+#define MEGAPGSIZE (1L << 21) // bytes mapped by a level-1 leaf PTE
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
@@ -0,0 +1,12 @@
+// Per-system-call latency statistics, recorded for processes
+// whose trace mask selects the system call.
+
+#define SCSTAT_NHIST 20    // latency histogram buckets
+
+struct scstat {
+  char name[16];             // system call name
+  uint64 count;              // calls recorded
+  uint64 cycles;             // total latency (timer cycles)
+  uint64 maxcycles;          // longest call
+  uint64 hist[SCSTAT_NHIST]; // hist[i]: calls taking < 2^(i+1) cycles
+};
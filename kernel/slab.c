@@ -0,0 +1,264 @@
+// Slab allocator for small kernel objects.
+//
+// A kmem_cache hands out objects of one size, carved from
+// pages obtained with kalloc(). Each page (a slab) starts with
+// a struct slab header and links its free objects through
+// their first word; a freed object finds its slab by rounding
+// its address down to the page.
+//
+// Each CPU keeps a small magazine of free objects per cache,
+// used with interrupts off and no lock. Only refilling or
+// draining a magazine takes the cache's lock, a batch of
+// SLAB_MAG/2 objects at a time. A slab whose objects are all
+// free goes back to kalloc(). Under memory pressure the shrinker
+// empties the current CPU's magazines, so that slabs pinned
+// only by cached objects can go back too.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sysinfo.h"
+#include "defs.h"
+
+#define SLAB_MAG    16  // free objects in each CPU's magazine
+#define NSLABCACHE   8  // number of caches
+
+struct slab {
+  struct slab *next;   // on the cache's partial list
+  struct slab *prev;
+  void *free;          // free objects in this slab
+  uint inuse;          // objects out of the slab, incl. magazines
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;           // object size, a multiple of 8
+  uint perslab;        // objects per slab
+  struct slab *partial; // slabs with free objects
+  uint64 npages;       // slabs held
+  uint64 nactive;      // objects held by callers
+  struct {
+    int n;
+    void *obj[SLAB_MAG];
+  } cpu[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NSLABCACHE];
+  int n;
+} slabs;
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7L)
+
+static int slabshrink(int n);
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+  kshrinker("slab", slabshrink);
+}
+
+// Create a cache of size-byte objects. The caches live
+// forever, so this is meant for boot-time initialization.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(void*) || size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+  acquire(&slabs.lock);
+  if(slabs.n == NSLABCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabs.cache[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  return c;
+}
+
+static void
+slabunlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+slabpush(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Turn a fresh page into a slab of free objects.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->next = s->prev = 0;
+  s->inuse = 0;
+  s->free = 0;
+  obj = (char*)s + SLABHDR + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, obj -= c->size){
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  return s;
+}
+
+// Move up to SLAB_MAG/2 objects from the slabs into CPU id's
+// empty magazine. Caller has interrupts off.
+static void
+slabrefill(struct kmem_cache *c, int id)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(c->cpu[id].n < SLAB_MAG/2){
+    if((s = c->partial) == 0){
+      release(&c->lock);
+      s = slabgrow(c);
+      acquire(&c->lock);
+      if(s == 0)
+        break;
+      slabpush(c, s);
+      c->npages++;
+    }
+    obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == 0)
+      slabunlink(c, s);
+    c->cpu[id].obj[c->cpu[id].n++] = obj;
+  }
+  release(&c->lock);
+}
+
+// Return the oldest n objects of CPU id's magazine to the
+// slabs, freeing slabs that become empty. Returns the number
+// of slabs freed. Caller has interrupts off.
+static int
+slabdrain(struct kmem_cache *c, int id, int n)
+{
+  struct slab *s;
+  void *obj;
+  int i, freed = 0;
+
+  acquire(&c->lock);
+  for(i = 0; i < n; i++){
+    obj = c->cpu[id].obj[i];
+    s = (struct slab*)PGROUNDDOWN((uint64)obj);
+    if(s->free == 0)
+      slabpush(c, s);
+    *(void**)obj = s->free;
+    s->free = obj;
+    if(--s->inuse == 0){
+      slabunlink(c, s);
+      c->npages--;
+      kfree((void*)s);
+      freed++;
+    }
+  }
+  release(&c->lock);
+  memmove(c->cpu[id].obj, c->cpu[id].obj + n, (SLAB_MAG - n) * sizeof(void*));
+  c->cpu[id].n -= n;
+  return freed;
+}
+
+// Shrinker: empty this CPU's magazines. Other CPUs' magazines
+// are theirs alone, so they are left be. If kalloc() was called
+// by slabgrow(), the magazine being refilled is in a consistent
+// state and its cache's lock is not held.
+// Returns the number of slabs freed.
+static int
+slabshrink(int n)
+{
+  struct kmem_cache *c;
+  int id, freed = 0;
+
+  push_off();
+  id = cpuid();
+  for(c = slabs.cache; c < &slabs.cache[slabs.n] && freed < n; c++)
+    if(c->cpu[id].n > 0)
+      freed += slabdrain(c, id, c->cpu[id].n);
+  pop_off();
+  return freed;
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory. The contents are undefined.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == 0)
+    slabrefill(c, id);
+  if(c->cpu[id].n > 0)
+    obj = c->cpu[id].obj[--c->cpu[id].n];
+  pop_off();
+  if(obj)
+    __sync_fetch_and_add(&c->nactive, 1);
+  return obj;
+}
+
+// Return an object obtained from kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  int id;
+
+  if((uint64)obj % 8 || (char*)obj < (char*)KERNBASE || (uint64)obj >= PHYSTOP)
+    panic("kmem_cache_free");
+#ifdef JUNKFILL
+  memset(obj, 1, c->size);
+#endif
+  __sync_fetch_and_sub(&c->nactive, 1);
+  push_off();
+  id = cpuid();
+  if(c->cpu[id].n == SLAB_MAG)
+    slabdrain(c, id, SLAB_MAG/2);
+  c->cpu[id].obj[c->cpu[id].n++] = obj;
+  pop_off();
+}
+
+// Pages held by all caches, and bytes in objects handed out.
+void
+slabinfo(struct sysinfo *info)
+{
+  struct kmem_cache *c;
+
+  info->slabpages = 0;
+  info->slabbytes = 0;
+  for(c = slabs.cache; c < &slabs.cache[slabs.n]; c++){
+    info->slabpages += __atomic_load_n(&c->npages, __ATOMIC_RELAXED);
+    info->slabbytes += __atomic_load_n(&c->nactive, __ATOMIC_RELAXED) * c->size;
+  }
+}
@@ -15,6 +15,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
   lk->pid = 0;
 }
 
@@ -22,24 +24,49 @@ void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  while (lk->locked || lk->readers) {
+    lk->wwait++;
     sleep(lk, &lk->lk);
+    lk->wwait--;
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Acquire lk shared with other readers.
+// A process must not acquire a lock shared twice: an
+// exclusive acquirer arriving in between would deadlock it.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+// Release lk, held either exclusively or shared.
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  lk->locked = 0;
-  lk->pid = 0;
-  wakeup(lk);
+  if (lk->locked) {
+    lk->locked = 0;
+    lk->pid = 0;
+    wakeup(lk);
+  } else {
+    if (lk->readers < 1)
+      panic("releasesleep");
+    if (--lk->readers == 0)
+      wakeup(lk);
+  }
   release(&lk->lk);
 }
 
+// Whether the current process holds lk exclusively.
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -51,5 +78,18 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Whether anyone holds lk shared. Readers aren't recorded,
+// so this can't tell whether the current process is one.
+int
+holdingsleepshared(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->readers > 0;
+  release(&lk->lk);
+  return r;
+}
+
 
 
@@ -1,10 +1,17 @@
 // Long-term locks for processes
+//
+// Held either exclusively (acquiresleep) by one process, or
+// shared (acquiresleepshared) by any number of readers. A
+// waiting exclusive acquirer holds off new readers, so a
+// stream of readers cannot starve it.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int wwait;         // Exclusive acquirers waiting
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
-  int pid;           // Process holding lock
+  int pid;           // Process holding lock exclusively
 };
 
@@ -6,14 +6,87 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "proc.h"
+#include "lockstat.h"
 #include "defs.h"
 
+// Contention counters for all the locks of one name. Each CPU
+// updates its own counters, with interrupts off, so acquire()
+// needs no atomic instructions for them.
+struct lockclass {
+  char *name;
+  uint64 nlocks;
+  struct {
+    uint64 acquire;
+    uint64 contended;
+    uint64 spins;
+    uint64 slow;
+    uint64 maxhold;
+    uint64 maxpc;
+  } cpu[NCPU];
+};
+
+static struct lockclass lockclass[NLOCKSTAT];
+static int nlockclass;
+static uint lockclasslock;  // a bare flag: initlock() can't use a spinlock
+
+// Find or make the class for name. Returns 0 if the table
+// is full, which leaves the lock uncounted.
+static struct lockclass*
+lockclassof(char *name)
+{
+  struct lockclass *c;
+
+  while(__sync_lock_test_and_set(&lockclasslock, 1) != 0)
+    ;
+  for(c = lockclass; c < &lockclass[nlockclass]; c++)
+    if(c->name == name || strncmp(c->name, name, 16) == 0)
+      break;
+  if(c == &lockclass[nlockclass]){
+    if(nlockclass < NLOCKSTAT){
+      c->name = name;
+      nlockclass++;
+    } else
+      c = 0;
+  }
+  if(c)
+    c->nlocks++;
+  __sync_lock_release(&lockclasslock);
+  return c;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->ticket = 0;
   lk->cpu = 0;
+  lk->class = lockclassof(name);
+}
+
+// Make lk a ticket lock, for locks that many CPUs fight over.
+void
+initticketlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->ticket = 1;
+  lk->next = 0;
+  lk->serving = 0;
+}
+
+// Take a ticket and wait for it to be served.
+// Returns the number of iterations spent waiting.
+static uint64
+ticketwait(struct spinlock *lk)
+{
+  uint t;
+  uint64 spins = 0;
+
+  t = __sync_fetch_and_add(&lk->next, 1);
+  while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != t)
+    spins++;
+  lk->locked = 1;
+  return spins;
 }
 
 // Acquire the lock.
@@ -29,8 +102,25 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if(lk->ticket){
+    uint64 spins = ticketwait(lk);
+
+    if(spins && lk->class){
+      lk->class->cpu[cpuid()].contended++;
+      lk->class->cpu[cpuid()].spins += spins;
+    }
+  } else if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    uint64 spins = 0;
+
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      spins++;
+    if(lk->class){
+      lk->class->cpu[cpuid()].contended++;
+      lk->class->cpu[cpuid()].spins += spins + 1;
+    }
+  }
+  if(lk->class)
+    lk->class->cpu[cpuid()].acquire++;
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +130,8 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->acqtime = r_time();
+  lk->acqpc = (uint64)__builtin_return_address(0);
 }
 
 // Release the lock.
@@ -49,6 +141,19 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  if(lk->class){
+    uint64 hold = r_time() - lk->acqtime;
+
+    if(hold >= LOCKSLOW){
+      int id = cpuid();
+      lk->class->cpu[id].slow++;
+      if(hold > lk->class->cpu[id].maxhold){
+        lk->class->cpu[id].maxhold = hold;
+        lk->class->cpu[id].maxpc = lk->acqpc;
+      }
+    }
+  }
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -66,7 +171,13 @@ release(struct spinlock *lk)
   // On RISC-V, sync_lock_release turns into an atomic swap:
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  if(lk->ticket){
+    // only the holder writes serving, so a plain increment
+    // published with a release store suffices.
+    lk->locked = 0;
+    __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+  } else
+    __sync_lock_release(&lk->locked);
 
   pop_off();
 }
@@ -81,6 +192,112 @@ holding(struct spinlock *lk)
   return r;
 }
 
+// Is this cpu holding any spinlock, or running with
+// push_off() in effect? If not, the caller may sleep.
+int
+holdinglocks(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->noff > 1;
+  pop_off();
+  return r;
+}
+
+// Copy the counters of up to n lock names to user address dst,
+// then zero them if reset is set. Returns the number copied.
+int
+lockstatread(uint64 dst, int n, int reset)
+{
+  struct proc *p = myproc();
+  struct lockstat ls;
+  struct lockclass *c;
+  int i, id;
+
+  if(n < 0)
+    return -1;
+  if(n > nlockclass)
+    n = nlockclass;
+  for(i = 0; i < n; i++){
+    c = &lockclass[i];
+    memset(&ls, 0, sizeof(ls));
+    safestrcpy(ls.name, c->name, sizeof(ls.name));
+    ls.nlocks = c->nlocks;
+    for(id = 0; id < NCPU; id++){
+      ls.acquire += c->cpu[id].acquire;
+      ls.contended += c->cpu[id].contended;
+      ls.spins += c->cpu[id].spins;
+      ls.slow += c->cpu[id].slow;
+      if(c->cpu[id].maxhold > ls.maxhold){
+        ls.maxhold = c->cpu[id].maxhold;
+        ls.maxpc = c->cpu[id].maxpc;
+      }
+    }
+    if(dst && copyout(p->pagetable, dst + i*sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+      return -1;
+  }
+  // other CPUs may count an acquisition or two during
+  // the reset; they are statistics.
+  if(reset)
+    for(c = lockclass; c < &lockclass[nlockclass]; c++)
+      memset(c->cpu, 0, sizeof(c->cpu));
+  return n;
+}
+
+// Locks for lockbench(): one of each kind, shared by every
+// process that runs the benchmark. benchcount is the critical
+// section's work, so the lock has something to protect.
+static struct spinlock benchlock[2];
+static uint64 benchcount;
+static uint benchinit;
+
+// Acquire and release a benchmark lock n times, timing each
+// acquire(), and copy a struct lockbench to dst.
+int
+lockbench(int ticket, int n, uint64 dst)
+{
+  struct lockbench lb;
+  struct spinlock *lk;
+  uint64 t0, t1, w;
+  int i, b;
+
+  if(n < 0)
+    return -1;
+  if(__sync_lock_test_and_set(&benchinit, 1) == 0){
+    initlock(&benchlock[0], "bench_tas");
+    initticketlock(&benchlock[1], "bench_ticket");
+    __atomic_store_n(&benchinit, 2, __ATOMIC_RELEASE);
+  }
+  while(__atomic_load_n(&benchinit, __ATOMIC_ACQUIRE) != 2)
+    ;
+  lk = &benchlock[ticket != 0];
+
+  memset(&lb, 0, sizeof(lb));
+  lb.time = r_time();
+  for(i = 0; i < n; i++){
+    t0 = r_time();
+    acquire(lk);
+    t1 = r_time();
+    benchcount++;
+    release(lk);
+
+    w = t1 - t0;
+    lb.wait += w;
+    if(w > lb.maxwait)
+      lb.maxwait = w;
+    for(b = 0; b < NLBHIST-1 && (w + 1) >> (b + 1); b++)
+      ;
+    lb.hist[b]++;
+  }
+  lb.time = r_time() - lb.time;
+  lb.n = n;
+
+  if(copyout(myproc()->pagetable, dst, (char*)&lb, sizeof(lb)) < 0)
+    return -1;
+  return 0;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -1,9 +1,21 @@
 // Mutual exclusion lock.
+//
+// initlock() makes a test-and-set lock, cheapest when the lock
+// is rarely contended. initticketlock() makes a ticket lock:
+// waiters take a ticket and get the lock in arrival order, and
+// spin reading, not swapping, a word that changes once per
+// release, so no CPU starves on a hot lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint ticket;       // Ticket lock if set
+  uint next;         // Ticket lock: next ticket to hand out
+  uint serving;      // Ticket lock: ticket that holds the lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  struct lockclass *class; // Contention counters, shared by name.
+  uint64 acqtime;    // r_time() when acquired, for hold times
+  uint64 acqpc;      // caller of acquire()
 };
 
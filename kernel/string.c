@@ -1,13 +1,39 @@
 #include "types.h"
 
+// memset(), memcmp() and memmove() work a uint64 at a time
+// once the pointers are 8-byte aligned, four words per loop
+// iteration, and finish with bytes. Misaligned loads trap to
+// M-mode on many RISC-V cores, so a dst/src pair that differs
+// in alignment is handled bytewise.
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = dst;
+  uint64 w, *wd;
+
+  while(n > 0 && ((uint64)d & 7)){
+    *d++ = c;
+    n--;
+  }
+  if(n >= 8){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wd = (uint64*)d;
+    for(; n >= 32; n -= 32, wd += 4){
+      wd[0] = w;
+      wd[1] = w;
+      wd[2] = w;
+      wd[3] = w;
+    }
+    for(; n >= 8; n -= 8)
+      *wd++ = w;
+    d = (uchar*)wd;
   }
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -18,6 +44,17 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    while(n > 0 && ((uint64)s1 & 7)){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the bytes of a differing
+    // word are compared below.
+    while(n >= 8 && *(uint64*)s1 == *(uint64*)s2)
+      s1 += 8, s2 += 8, n -= 8;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -30,19 +67,60 @@ memcmp(const void *v1, const void *v2, uint n)
 void*
 memmove(void *dst, const void *src, uint n)
 {
-  const char *s;
-  char *d;
+  const uchar *s;
+  uchar *d;
+  const uint64 *ws;
+  uint64 *wd, w0, w1, w2, w3;
+  int words;
 
   s = src;
   d = dst;
+  words = (((uint64)s ^ (uint64)d) & 7) == 0;
   if(s < d && s + n > d){
+    // overlapping with dst above src: copy downwards.
+    // each 4-word group is loaded before it is stored.
     s += n;
     d += n;
+    if(words){
+      while(n > 0 && ((uint64)d & 7)){
+        *--d = *--s;
+        n--;
+      }
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 32; n -= 32){
+        ws -= 4;
+        wd -= 4;
+        w3 = ws[3]; w2 = ws[2]; w1 = ws[1]; w0 = ws[0];
+        wd[3] = w3; wd[2] = w2; wd[1] = w1; wd[0] = w0;
+      }
+      for(; n >= 8; n -= 8)
+        *--wd = *--ws;
+      s = (const uchar*)ws;
+      d = (uchar*)wd;
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      while(n > 0 && ((uint64)d & 7)){
+        *d++ = *s++;
+        n--;
+      }
+      ws = (const uint64*)s;
+      wd = (uint64*)d;
+      for(; n >= 32; n -= 32, ws += 4, wd += 4){
+        w0 = ws[0]; w1 = ws[1]; w2 = ws[2]; w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for(; n >= 8; n -= 8)
+        *wd++ = *ws++;
+      s = (const uchar*)ws;
+      d = (uchar*)wd;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
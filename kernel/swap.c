@@ -0,0 +1,238 @@
+// Swap space for anonymous user memory.
+//
+// mkfs sets aside an area of the disk that the file system never
+// uses (sb.swapstart, sb.nswap), cut here into page-sized slots.
+// When free memory runs low and the caches have nothing left to
+// give, the kreclaim thread calls swapout(), which picks cold
+// pages of user memory by the clock (mmevict(), uvmevict()) and
+// writes them to free slots. A swapped-out page's PTE is left
+// invalid with PTE_SWAP, its permissions, and its slot where the
+// page's address was; the next touch faults, and swapfault()
+// reads the page back into a new page. Pages go to and from the
+// disk directly, not through the buffer cache.
+//
+// A slot counts the PTEs that name it, which fork() shares like
+// pages, and the reads and writes in progress on it; it is free
+// at zero. While its page is being written the slot is busy, and
+// swapfault() waits for the write before reading it back.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "sysinfo.h"
+
+#if BSIZE > PGSIZE
+#error "swap needs blocks no bigger than pages"
+#endif
+
+#define SPB       (PGSIZE / BSIZE)            // blocks per slot
+#define NSLOT     (SWAPSIZE / (PGSIZE / 1024)) // most slots
+#define SWAPBATCH 32    // pages swapout() takes from an mm at once
+#define SWAPSCAN  8192  // most PTEs swapout() looks at per call
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct {
+  struct spinlock lock;
+  uint start;              // first block of the swap area
+  uint nslot;              // slots in it; 0 if there is none
+  uint nused;
+  uint next;               // where swapalloc() looks first
+  ushort ref[NSLOT];       // PTEs and I/O using each slot
+  char busy[NSLOT];        // being written out
+
+  struct sleeplock iolock; // buf
+  struct buf buf[SPB];
+} swap;
+
+void
+swapinit(int dev, struct superblock *sb)
+{
+  int i;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  for(i = 0; i < SPB; i++)
+    swap.buf[i].dev = dev;
+  swap.start = sb->swapstart;
+  __sync_synchronize();  // swapout() starts once nslot is set
+  swap.nslot = min(sb->nswap / SPB, NSLOT);
+}
+
+// Allocate a slot for a page uvmevict() is taking: one
+// reference for its PTE and one for the write, and busy.
+// Returns the slot, or -1 if swap is full.
+int
+swapalloc(void)
+{
+  uint i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; swap.nused < swap.nslot && i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 2;
+      swap.busy[s] = 1;
+      swap.nused++;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Another reference to slot, for a PTE or a read.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot, freeing it with the last.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Read or write page pg from or to slot, as one disk request.
+static void
+swapio(uint slot, char *pg, int write)
+{
+  struct buf *b;
+  int i;
+
+  acquiresleep(&swap.iolock);
+  for(i = 0; i < SPB; i++){
+    b = &swap.buf[i];
+    if(write)
+      memmove(b->data, pg + i*BSIZE, BSIZE);
+    virtio_disk_submit(b, swap.start + slot*SPB + i, write);
+  }
+  virtio_disk_kick();
+  for(i = 0; i < SPB; i++){
+    b = &swap.buf[i];
+    virtio_disk_wait(b);
+    if(!write)
+      memmove(pg + i*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&swap.iolock);
+}
+
+// Write up to n cold pages of user memory to swap and free
+// them, for the kreclaim thread. Returns the number freed.
+int
+swapout(int n)
+{
+  uint64 pa[SWAPBATCH];
+  uint slot[SWAPBATCH];
+  struct mm *mm;
+  int budget = SWAPSCAN, done, k, i;
+
+  if(swap.nslot == 0)
+    return 0;
+  for(done = 0; done < n; done += k){
+    if((k = mmevict(&mm, pa, slot, min(n - done, SWAPBATCH), &budget)) == 0)
+      break;
+    // mm's threads may still write the pages through their TLBs.
+    mmflush(mm);
+    for(i = 0; i < k; i++){
+      swapio(slot[i], (char*)pa[i], 1);
+      acquire(&swap.lock);
+      swap.busy[slot[i]] = 0;
+      release(&swap.lock);
+      wakeup(&swap.busy[slot[i]]);
+      swapfree(slot[i]);
+      kfree((void*)pa[i]);
+      statinc(ST_SWAPOUT);
+    }
+  }
+  return done;
+}
+
+// Handle a page fault at va in mm, if the page was swapped
+// out, by reading it back into a new page. Anything else, such
+// as a page another thread has read back meanwhile, is left to
+// uvmfault(), which is tried again after waiting for kreclaim
+// if memory is short. access is as for uvmfault().
+// Returns 0 if the faulting access can be retried, -1 if not.
+// Sleeps, so the caller must not hold spinlocks.
+int
+swapfault(struct mm *mm, uint64 va, int access)
+{
+  pte_t *pte, old;
+  uint slot;
+  char *mem;
+  int r;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  acquire(&mm->lock);
+  if(va >= mm->sz || (pte = walk(mm->pagetable, va, 0)) == 0 ||
+     (*pte & (PTE_V|PTE_SWAP)) != PTE_SWAP){
+    r = uvmfault(mm->pagetable, va, mm->sz, access);
+    release(&mm->lock);
+    if(r < 0 && kreclaimwait() == 0)
+      r = mmfault(mm, va, access);
+    return r;
+  }
+  old = *pte;
+  slot = PTE2SWAP(old);
+  swapdup(slot);  // for the read, should the PTE let it go
+  release(&mm->lock);
+
+  while((mem = kalloc()) == 0){
+    if(kreclaimwait() < 0){
+      swapfree(slot);
+      return -1;
+    }
+  }
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  release(&swap.lock);
+  swapio(slot, mem, 0);
+  statinc(ST_SWAPIN);
+
+  // another thread may have read the page back meanwhile, or
+  // shrunk the process below it.
+  acquire(&mm->lock);
+  if(va < mm->sz && (pte = walk(mm->pagetable, va, 0)) != 0 && *pte == old){
+    // PTE_A, so that the clock hand doesn't take it straight back
+    // from under a caller such as uvmtouch().
+    *pte = PA2PTE(mem) | (old & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_V | PTE_A;
+    mem = 0;
+    swapfree(slot);
+    uvmsync(mm->pagetable);
+  }
+  release(&mm->lock);
+  if(mem)
+    kfree(mem);
+  swapfree(slot);
+  return 0;
+}
+
+void
+swapinfo(struct sysinfo *info)
+{
+  info->swappages = swap.nslot;
+  info->swapused = __atomic_load_n(&swap.nused, __ATOMIC_RELAXED);
+}
@@ -5,13 +5,16 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "syscall.h"
+#include "scstat.h"
+#include "trace.h"
+#include "sysinfo.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
 int
 fetchaddr(uint64 addr, uint64 *ip) {
     struct proc *p = myproc();
-    if (addr >= p->sz || addr + sizeof(uint64) > p->sz)
+    if (addr >= p->mm->sz || addr + sizeof(uint64) > p->mm->sz)
         return -1;
     if (copyin(p->pagetable, (char *) ip, addr, sizeof(*ip)) != 0)
         return -1;
@@ -123,6 +126,35 @@ extern uint64 sys_trace(void);
 
 extern uint64 sys_sysinfo(void);
 
+extern uint64 sys_scstat(void);
+
+extern uint64 sys_traceread(void);
+
+extern uint64 sys_setpriority(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_pipe2(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_dmesg(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_lockbench(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_yield(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_clock_gettime(void);
+extern uint64 sys_profctl(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_waitstat(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_ioring_enter(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_getdents(void);
+
 static uint64 (*syscalls[])(void) = {
         [SYS_fork]    sys_fork,
         [SYS_exit]    sys_exit,
@@ -147,6 +179,32 @@ static uint64 (*syscalls[])(void) = {
         [SYS_close]   sys_close,
         [SYS_trace]   sys_trace,
         [SYS_sysinfo] sys_sysinfo,
+        [SYS_scstat]  sys_scstat,
+        [SYS_traceread] sys_traceread,
+        [SYS_setpriority] sys_setpriority,
+        [SYS_splice]  sys_splice,
+        [SYS_pipe2]   sys_pipe2,
+        [SYS_mmap]    sys_mmap,
+        [SYS_munmap]  sys_munmap,
+        [SYS_dmesg]   sys_dmesg,
+        [SYS_lockstat] sys_lockstat,
+        [SYS_lockbench] sys_lockbench,
+        [SYS_clone]   sys_clone,
+        [SYS_join]    sys_join,
+        [SYS_yield]   sys_yield,
+        [SYS_futex_wait] sys_futex_wait,
+        [SYS_futex_wake] sys_futex_wake,
+        [SYS_spawn]   sys_spawn,
+        [SYS_clock_gettime] sys_clock_gettime,
+        [SYS_profctl] sys_profctl,
+        [SYS_profread] sys_profread,
+        [SYS_waitstat] sys_waitstat,
+        [SYS_readv]   sys_readv,
+        [SYS_writev]  sys_writev,
+        [SYS_fsync]   sys_fsync,
+        [SYS_ioring_enter] sys_ioring_enter,
+        [SYS_mount]   sys_mount,
+        [SYS_getdents] sys_getdents,
 };
 
 static char *syscalls_name[] = {
@@ -172,23 +230,100 @@ static char *syscalls_name[] = {
         [SYS_mkdir]   "mkdir",
         [SYS_close]   "close",
         [SYS_trace]   "trace",
-        [SYS_sysinfo] "sysinfo"
+        [SYS_sysinfo] "sysinfo",
+        [SYS_scstat]  "scstat",
+        [SYS_traceread] "traceread",
+        [SYS_setpriority] "setpriority",
+        [SYS_splice]  "splice",
+        [SYS_pipe2]   "pipe2",
+        [SYS_mmap]    "mmap",
+        [SYS_munmap]  "munmap",
+        [SYS_dmesg]   "dmesg",
+        [SYS_lockstat] "lockstat",
+        [SYS_lockbench] "lockbench",
+        [SYS_clone]   "clone",
+        [SYS_join]    "join",
+        [SYS_yield]   "yield",
+        [SYS_futex_wait] "futex_wait",
+        [SYS_futex_wake] "futex_wake",
+        [SYS_spawn]   "spawn",
+        [SYS_clock_gettime] "clock_gettime",
+        [SYS_profctl] "profctl",
+        [SYS_profread] "profread",
+        [SYS_waitstat] "waitstat",
+        [SYS_readv]   "readv",
+        [SYS_writev]  "writev",
+        [SYS_fsync]   "fsync",
+        [SYS_ioring_enter] "ioring_enter",
+        [SYS_mount]   "mount",
+        [SYS_getdents] "getdents",
 };
 
+// latency statistics, updated atomically without a lock.
+static struct scstat scstats[NELEM(syscalls)];
+
+static void
+screcord(int num, uint64 t) {
+    struct scstat *s = &scstats[num];
+    uint64 max;
+    int b;
+
+    for (b = 0; b < SCSTAT_NHIST - 1 && (t >> (b + 1)) != 0; b++)
+        ;
+    __sync_fetch_and_add(&s->count, 1);
+    __sync_fetch_and_add(&s->cycles, t);
+    __sync_fetch_and_add(&s->hist[b], 1);
+    while ((max = s->maxcycles) < t && !__sync_bool_compare_and_swap(&s->maxcycles, max, t))
+        ;
+}
+
 void
 syscall(void) {
     int num;
     struct proc *p = myproc();
+    uint64 t0;
 
     num = p->trapframe->a7;
+    statinc(ST_SYSCALL);
     if (num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+        t0 = r_time();
         p->trapframe->a0 = syscalls[num]();
 
-        if ((1 << num) & p->trace_mask)
-            printf("%d: syscall %s -> %d\n", p->pid, syscalls_name[num], p->trapframe->a0);
+        if (num < 32 && ((1 << num) & p->trace_mask)) {
+            screcord(num, r_time() - t0);
+            if (p->trace_flags & TRACE_RING)
+                tracepush(p->pid, num, p->trapframe->a0);
+            else
+                printf("%d: syscall %s -> %d\n", p->pid, syscalls_name[num], p->trapframe->a0);
+        }
 
     } else {
         printf("%d %s: unknown sys call %d\n", p->pid, p->name, num);
         p->trapframe->a0 = -1;
     }
-}
\ No newline at end of file
+}
+
+// copy the statistics of up to n system calls, indexed by
+// system call number, to the user array at addr.
+// returns the number of entries copied.
+uint64
+sys_scstat(void) {
+    uint64 addr;
+    int n, i;
+    struct scstat s;
+    struct proc *p = myproc();
+
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+        return -1;
+    if (n > NELEM(scstats))
+        n = NELEM(scstats);
+    for (i = 0; i < n; i++) {
+        s = scstats[i];
+        memset(s.name, 0, sizeof(s.name));
+        if (i < NELEM(syscalls_name) && syscalls_name[i])
+            safestrcpy(s.name, syscalls_name[i], sizeof(s.name));
+        if (copyout(p->pagetable, addr + i * sizeof(s), (char *) &s, sizeof(s)) < 0)
+            return -1;
+    }
+    return n;
+}
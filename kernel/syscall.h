@@ -21,4 +21,30 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_trace  22
-#define SYS_sysinfo 23
\ No newline at end of file
+#define SYS_sysinfo 23
+#define SYS_scstat 24
+#define SYS_traceread 25
+#define SYS_setpriority 26
+#define SYS_splice 27
+#define SYS_pipe2 28
+#define SYS_mmap  29
+#define SYS_munmap 30
+#define SYS_dmesg 31
+#define SYS_lockstat 32
+#define SYS_lockbench 33
+#define SYS_clone 34
+#define SYS_join 35
+#define SYS_yield 36
+#define SYS_futex_wait 37
+#define SYS_futex_wake 38
+#define SYS_spawn 39
+#define SYS_clock_gettime 40
+#define SYS_profctl 41
+#define SYS_profread 42
+#define SYS_waitstat 43
+#define SYS_readv 44
+#define SYS_writev 45
+#define SYS_fsync 46
+#define SYS_ioring_enter 47
+#define SYS_mount 48
+#define SYS_getdents 49
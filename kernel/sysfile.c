@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "ioring.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -71,9 +73,69 @@ sys_read(void) {
 
     if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
         return -1;
+    mmaptouch(p, n);
+    exectouch(p, n);
     return fileread(f, p, n);
 }
 
+// Copy in the readv()/writev() segment array (fd, iov, cnt),
+// and fault in the pages behind each segment as sys_read()
+// and sys_write() do for their one buffer.
+static int
+argiov(struct file **pf, struct iovec *iov, int *pcnt) {
+    uint64 uiov, tot = 0;
+    int i, cnt;
+
+    if (argfd(0, 0, pf) < 0 || argaddr(1, &uiov) < 0 || argint(2, &cnt) < 0)
+        return -1;
+    if (cnt < 0 || cnt > NIOV)
+        return -1;
+    if (copyin(myproc()->pagetable, (char *) iov, uiov, cnt * sizeof(struct iovec)) < 0)
+        return -1;
+    for (i = 0; i < cnt; i++) {
+        // the total comes back as an int.
+        tot += iov[i].len;
+        if (iov[i].len > 0x7fffffff || tot > 0x7fffffff)
+            return -1;
+        mmaptouch(iov[i].base, iov[i].len);
+        exectouch(iov[i].base, iov[i].len);
+    }
+    *pcnt = cnt;
+    return 0;
+}
+
+uint64
+sys_readv(void) {
+    struct iovec iov[NIOV];
+    struct file *f;
+    int cnt;
+
+    if (argiov(&f, iov, &cnt) < 0)
+        return -1;
+    return filereadv(f, iov, cnt);
+}
+
+uint64
+sys_writev(void) {
+    struct iovec iov[NIOV];
+    struct file *f;
+    int cnt;
+
+    if (argiov(&f, iov, &cnt) < 0)
+        return -1;
+    return filewritev(f, iov, cnt);
+}
+
+uint64
+sys_splice(void) {
+    struct file *in, *out;
+    int n;
+
+    if (argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+        return -1;
+    return filesplice(in, out, n);
+}
+
 uint64
 sys_write(void) {
     struct file *f;
@@ -82,10 +144,36 @@ sys_write(void) {
 
     if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
         return -1;
-
+    mmaptouch(p, n);
+    exectouch(p, n);
     return filewrite(f, p, n);
 }
 
+uint64
+sys_mmap(void) {
+    uint64 addr, off;
+    int len, prot, flags;
+    struct file *f;
+
+    // addr, the placement hint, is ignored.
+    if (argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+        argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argaddr(5, &off) < 0)
+        return -1;
+    if (len <= 0)
+        return -1;
+    return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void) {
+    uint64 addr;
+    int len;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+        return -1;
+    return munmap(addr, len);
+}
+
 uint64
 sys_close(void) {
     int fd;
@@ -98,6 +186,27 @@ sys_close(void) {
     return 0;
 }
 
+uint64
+sys_fsync(void) {
+    // every write is logged by the time it returns; what is
+    // left is to wait for the log to reach the disk.
+    if (argfd(0, 0, 0) < 0)
+        return -1;
+    log_force();
+    return 0;
+}
+
+uint64
+sys_getdents(void) {
+    struct file *f;
+    uint64 ds; // user pointer to struct dirstat[]
+    int n;
+
+    if (argfd(0, 0, &f) < 0 || argaddr(1, &ds) < 0 || argint(2, &n) < 0)
+        return -1;
+    return filegetdents(f, ds, n);
+}
+
 uint64
 sys_fstat(void) {
     struct file *f;
@@ -158,15 +267,16 @@ sys_link(void) {
 }
 
 // Is the directory dp empty except for "." and ".." ?
+// They are the first two entries only in a linear directory.
 static int
 isdirempty(struct inode *dp) {
     int off;
     struct dirent de;
 
-    for (off = 2 * sizeof(de); off < dp->size; off += sizeof(de)) {
+    for (off = 0; off < dp->size; off += sizeof(de)) {
         if (readi(dp, 0, (uint64) &de, off, sizeof(de)) != sizeof(de))
             panic("isdirempty: readi");
-        if (de.inum != 0)
+        if (de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
             return 0;
     }
     return 1;
@@ -198,6 +308,12 @@ sys_unlink(void) {
         goto bad;
     ilock(ip);
 
+    // Cannot unlink a directory with a file system mounted on it.
+    if (ip->dev == ROOTDEV && ip->inum == tmpmnt) {
+        iunlockput(ip);
+        goto bad;
+    }
+
     if (ip->nlink < 1)
         panic("unlink: nlink < 1");
     if (ip->type == T_DIR && !isdirempty(ip)) {
@@ -208,6 +324,7 @@ sys_unlink(void) {
     memset(&de, 0, sizeof(de));
     if (writei(dp, 0, (uint64) &de, off, sizeof(de)) != sizeof(de))
         panic("unlink: writei");
+    dcache_remove(dp, name);
     if (ip->type == T_DIR) {
         dp->nlink--;
         iupdate(dp);
@@ -247,8 +364,11 @@ create(char *path, short type, short major, short minor) {
         return 0;
     }
 
-    if ((ip = ialloc(dp->dev, type)) == 0)
-        panic("create: ialloc");
+    if ((ip = ialloc(dp->dev, type, dp->inum)) == 0) {
+        // only a full tmpfs; the disk's ialloc() panics.
+        iunlockput(dp);
+        return 0;
+    }
 
     ilock(ip);
     ip->major = major;
@@ -260,6 +380,7 @@ create(char *path, short type, short major, short minor) {
         dp->nlink++;  // for ".."
         iupdate(dp);
         // No ip->nlink++ for ".": avoid cyclic ref count.
+        dirinit(ip);
         if (dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
             panic("create dots");
     }
@@ -272,16 +393,12 @@ create(char *path, short type, short major, short minor) {
     return ip;
 }
 
-uint64
-sys_open(void) {
-    char path[MAXPATH];
-    int fd, omode;
+// Open path for sys_open() and IO_OPEN.
+static int
+openpath(char *path, int omode) {
+    int fd;
     struct file *f;
     struct inode *ip;
-    int n;
-
-    if ((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-        return -1;
 
     begin_op();
 
@@ -310,6 +427,14 @@ sys_open(void) {
         return -1;
     }
 
+    // a running program can't be truncated, as writei() can't
+    // write it.
+    if ((omode & O_TRUNC) && ip->type == T_FILE && ip->textrun > 0) {
+        iunlockput(ip);
+        end_op();
+        return -1;
+    }
+
     if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
         if (f)
             fileclose(f);
@@ -324,6 +449,8 @@ sys_open(void) {
     } else {
         f->type = FD_INODE;
         f->off = 0;
+        f->raend = 0;
+        f->rapos = 0;
     }
     f->ip = ip;
     f->readable = !(omode & O_WRONLY);
@@ -339,6 +466,99 @@ sys_open(void) {
     return fd;
 }
 
+uint64
+sys_open(void) {
+    char path[MAXPATH];
+    int omode;
+
+    if (argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+        return -1;
+    return openpath(path, omode);
+}
+
+// Run one ioring request, with the checks its system call makes.
+static int
+iosubmit(struct iosqe *e) {
+    struct proc *p = myproc();
+    char path[MAXPATH];
+    struct file *f = 0;
+
+    if (e->op != IO_OPEN) {
+        if (e->fd < 0 || e->fd >= NOFILE || (f = p->ofile[e->fd]) == 0)
+            return -1;
+    }
+    switch (e->op) {
+    case IO_READ:
+    case IO_WRITE:
+        if (e->len < 0)
+            return -1;
+        mmaptouch(e->addr, e->len);
+        exectouch(e->addr, e->len);
+        if (e->op == IO_READ)
+            return fileread(f, e->addr, e->len);
+        return filewrite(f, e->addr, e->len);
+    case IO_OPEN:
+        if (fetchstr(e->addr, path, MAXPATH) < 0)
+            return -1;
+        return openpath(path, e->len);
+    case IO_CLOSE:
+        p->ofile[e->fd] = 0;
+        fileclose(f);
+        return 0;
+    case IO_FSYNC:
+        log_force();
+        return 0;
+    }
+    return -1;
+}
+
+// Drain the submission queue of the ring at uring, as far as
+// the completion queue has room; returns how many completions
+// were posted. A request that fails gets -1 as its result,
+// as from its system call, and the requests after it still run.
+uint64
+sys_ioring_enter(void) {
+    struct proc *p = myproc();
+    struct ioring *r;
+    struct iosqe e;
+    struct iocqe c;
+    uint64 uring;
+    uint idx[4], n = 0;
+
+    if (argaddr(0, &uring) < 0)
+        return -1;
+    r = (struct ioring *) uring;   // a user address: never dereferenced
+    mmaptouch(uring, sizeof(*r));
+    exectouch(uring, sizeof(*r));
+    // sqhead, sqtail, cqhead, cqtail
+    if (copyin(p->pagetable, (char *) idx, uring, sizeof(idx)) < 0)
+        return -1;
+    if (idx[1] - idx[0] > NIORING || idx[3] - idx[2] > NIORING)
+        return -1;
+    while (idx[0] != idx[1] && idx[3] - idx[2] < NIORING) {
+        if (copyin(p->pagetable, (char *) &e, (uint64) &r->sq[idx[0] % NIORING],
+                   sizeof(e)) < 0)
+            return -1;
+        c.data = e.data;
+        c.res = iosubmit(&e);
+        c.pad = 0;
+        if (copyout(p->pagetable, (uint64) &r->cq[idx[3] % NIORING], (char *) &c,
+                    sizeof(c)) < 0)
+            return -1;
+        idx[0]++;
+        idx[3]++;
+        n++;
+        // publish the completion only after its contents.
+        __sync_synchronize();
+        if (copyout(p->pagetable, (uint64) &r->sqhead, (char *) &idx[0],
+                    sizeof(uint)) < 0 ||
+            copyout(p->pagetable, (uint64) &r->cqtail, (char *) &idx[3],
+                    sizeof(uint)) < 0)
+            return -1;
+    }
+    return n;
+}
+
 uint64
 sys_mkdir(void) {
     char path[MAXPATH];
@@ -373,6 +593,34 @@ sys_mknod(void) {
     return 0;
 }
 
+// Mount a file system of type fstype on directory path.
+// Only "tmpfs" exists, and it can be mounted once.
+uint64
+sys_mount(void) {
+    char fstype[8], path[MAXPATH];
+    struct inode *dp;
+
+    if (argstr(0, fstype, sizeof(fstype)) < 0 || argstr(1, path, MAXPATH) < 0)
+        return -1;
+    if (strncmp(fstype, "tmpfs", sizeof(fstype)) != 0)
+        return -1;
+
+    begin_op();
+    if ((dp = namei(path)) == 0) {
+        end_op();
+        return -1;
+    }
+    ilock(dp);
+    if (tmpmount(dp) < 0) {
+        iunlockput(dp);
+        end_op();
+        return -1;
+    }
+    iunlockput(dp);
+    end_op();
+    return 0;
+}
+
 uint64
 sys_chdir(void) {
     char path[MAXPATH];
@@ -397,18 +645,24 @@ sys_chdir(void) {
     return 0;
 }
 
-uint64
-sys_exec(void) {
-    char path[MAXPATH], *argv[MAXARG];
+static void
+freeargv(char **argv) {
     int i;
-    uint64 uargv, uarg;
 
-    if (argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0) {
-        return -1;
-    }
-    memset(argv, 0, sizeof(argv));
+    for (i = 0; i < MAXARG && argv[i] != 0; i++)
+        kfree(argv[i]);
+}
+
+// Copy the user argv array at uargv, and its strings, into argv,
+// one page per string. Returns 0, or -1 with nothing allocated.
+static int
+fetchargv(uint64 uargv, char **argv) {
+    int i;
+    uint64 uarg;
+
+    memset(argv, 0, MAXARG * sizeof(char *));
     for (i = 0;; i++) {
-        if (i >= NELEM(argv)) {
+        if (i >= MAXARG) {
             goto bad;
         }
         if (fetchaddr(uargv + sizeof(uint64) * i, (uint64 *) &uarg) < 0) {
@@ -424,30 +678,76 @@ sys_exec(void) {
         if (fetchstr(uarg, argv[i], PGSIZE) < 0)
             goto bad;
     }
+    return 0;
 
-    int ret = exec(path, argv);
+    bad:
+    freeargv(argv);
+    return -1;
+}
 
-    for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-        kfree(argv[i]);
+uint64
+sys_exec(void) {
+    char path[MAXPATH], *argv[MAXARG];
+    uint64 uargv;
+    int ret;
 
+    if (argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0) {
+        return -1;
+    }
+    if (fetchargv(uargv, argv) < 0)
+        return -1;
+    ret = exec(path, argv);
+    freeargv(argv);
     return ret;
-
-    bad:
-    for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-        kfree(argv[i]);
-    return -1;
 }
 
+// spawn(path, argv, fds): run path in a new child process whose
+// descriptor i is a copy of the caller's fds[i], or closed if
+// fds[i] is -1, for i < NSPAWNFD. A null fds passes on 0, 1, 2.
 uint64
-sys_pipe(void) {
-    uint64 fdarray; // user pointer to array of two integers
-    struct file *rf, *wf;
-    int fd0, fd1;
+sys_spawn(void) {
+    char path[MAXPATH], *argv[MAXARG];
+    struct file *files[NSPAWNFD];
+    int fds[NSPAWNFD], i, ret;
+    uint64 uargv, ufds;
     struct proc *p = myproc();
 
-    if (argaddr(0, &fdarray) < 0)
+    if (argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+        argaddr(2, &ufds) < 0) {
         return -1;
-    if (pipealloc(&rf, &wf) < 0)
+    }
+    for (i = 0; i < NSPAWNFD; i++)
+        fds[i] = i;
+    if (ufds && copyin(p->pagetable, (char *) fds, ufds, sizeof(fds)) < 0)
+        return -1;
+    for (i = 0; i < NSPAWNFD; i++) {
+        files[i] = 0;
+        if (fds[i] == -1)
+            continue;
+        if (fds[i] < 0 || fds[i] >= NOFILE || p->ofile[fds[i]] == 0)
+            return -1;
+    }
+    if (fetchargv(uargv, argv) < 0)
+        return -1;
+    // take the references now: spawn() sleeps, and another
+    // thread may close the descriptors meanwhile.
+    for (i = 0; i < NSPAWNFD; i++)
+        if (fds[i] != -1)
+            files[i] = filedup(p->ofile[fds[i]]);
+    ret = spawn(path, argv, files);
+    freeargv(argv);
+    return ret;
+}
+
+// Create a pipe with a size-byte ring, 0 for the default,
+// and store its read and write fds at user address fdarray.
+static int
+makepipe(uint64 fdarray, int size) {
+    struct file *rf, *wf;
+    int fd0, fd1, fds[2];
+    struct proc *p = myproc();
+
+    if (pipealloc(&rf, &wf, size) < 0)
         return -1;
     fd0 = -1;
     if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
@@ -457,8 +757,9 @@ sys_pipe(void) {
         fileclose(wf);
         return -1;
     }
-    if (copyout(p->pagetable, fdarray, (char *) &fd0, sizeof(fd0)) < 0 ||
-        copyout(p->pagetable, fdarray + sizeof(fd0), (char *) &fd1, sizeof(fd1)) < 0) {
+    fds[0] = fd0;
+    fds[1] = fd1;
+    if (copyout(p->pagetable, fdarray, (char *) fds, sizeof(fds)) < 0) {
         p->ofile[fd0] = 0;
         p->ofile[fd1] = 0;
         fileclose(rf);
@@ -467,3 +768,23 @@ sys_pipe(void) {
     }
     return 0;
 }
+
+uint64
+sys_pipe(void) {
+    uint64 fdarray; // user pointer to array of two integers
+
+    if (argaddr(0, &fdarray) < 0)
+        return -1;
+    return makepipe(fdarray, 0);
+}
+
+// Like pipe(), but with a ring of at least size bytes.
+uint64
+sys_pipe2(void) {
+    uint64 fdarray;
+    int size;
+
+    if (argaddr(0, &fdarray) < 0 || argint(1, &size) < 0)
+        return -1;
+    return makepipe(fdarray, size);
+}
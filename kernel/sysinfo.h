@@ -1,4 +1,60 @@
+#define SYSINFO_MAXCPU 8   // per-CPU entries; at least NCPU
+
+// Bumped whenever struct sysinfo changes, so that tools can
+// tell they were built against a different kernel.
+#define SYSINFO_VERSION 4
+
+// Event counters, kept per CPU by statinc() and summed into
+// sysinfo.stat[].
+#define ST_BHIT     0   // bget() found the block cached
+#define ST_BMISS    1   // bget() recycled a buffer
+#define ST_DREAD    2   // disk block reads
+#define ST_DWRITE   3   // disk block writes
+#define ST_CSWITCH  4   // context switches, in sched()
+#define ST_PGFAULT  5   // page faults handled
+#define ST_SYSCALL  6   // system calls
+#define ST_INTR     7   // device interrupts
+#define ST_PCHIT    8   // file page found in the page cache
+#define ST_PCMISS   9   // file page read into the page cache
+#define ST_SWAPOUT 10   // pages written to swap
+#define ST_SWAPIN  11   // pages read back from swap
+#define NSTAT      12
+
 struct sysinfo {
+  uint64 version;   // SYSINFO_VERSION
+  uint64 size;      // sizeof(struct sysinfo)
+
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+
+  // file system log
+  uint64 ncommit;          // transactions committed since boot
+  uint64 commitcycles;     // total time spent in commit (timer cycles)
+  uint64 maxcommitcycles;  // longest single commit (timer cycles)
+  uint64 logblocks;        // blocks written by committed transactions
+  uint64 logabsorb;        // log writes absorbed into an already logged block
+  uint64 logstall;         // times begin_op() waited for log space
+  uint64 logsize;          // data blocks the log can hold
+  uint64 freeblocks;       // free blocks on the file system
+
+  // system call tracing
+  uint64 tracedrops;       // trace records lost to a full ring
+
+  // scheduler
+  uint64 ncpu;                         // CPUs reported below
+  uint64 idlecycles[SYSINFO_MAXCPU];   // time each CPU spent in wfi
+  uint64 utime[SYSINFO_MAXCPU];        // ... running user code
+  uint64 stime[SYSINFO_MAXCPU];        // ... in the kernel, not idle
+  uint64 putime, pstime;   // user and kernel time of the calling process
+  uint64 cutime, cstime;   // the same, for its reaped children
+
+  // slab allocator
+  uint64 slabpages;        // pages held by kmem_caches
+  uint64 slabbytes;        // bytes in allocated slab objects
+
+  // swap
+  uint64 swappages;        // pages the swap area holds; 0 if none
+  uint64 swapused;         // ... that are in use
+
+  uint64 stat[NSTAT];      // events since boot, ST_*
 };
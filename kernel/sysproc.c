@@ -7,8 +7,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sysinfo.h"
-
-extern uint64 get_freemem();
+#include "time.h"
 
 extern uint64 getNproc();
 
@@ -39,15 +38,98 @@ sys_wait(void) {
     return wait(p);
 }
 
+// start a thread running fn(arg) on stack, in this address space.
+uint64
+sys_clone(void) {
+    uint64 fn, arg, stack;
+
+    if (argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+        return -1;
+    return clone(fn, arg, stack);
+}
+
+// wait for a thread made by clone().
+uint64
+sys_join(void) {
+    uint64 addr;
+    int tid;
+
+    if (argint(0, &tid) < 0 || argaddr(1, &addr) < 0)
+        return -1;
+    return join(tid, addr);
+}
+
+uint64
+sys_yield(void) {
+    yield();
+    return 0;
+}
+
+uint64
+sys_futex_wait(void) {
+    uint64 addr;
+    int val;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+        return -1;
+    return futexwait(addr, val);
+}
+
+uint64
+sys_futex_wake(void) {
+    uint64 addr;
+    int n;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+        return -1;
+    return futexwake(addr, n);
+}
+
+uint64
+sys_clock_gettime(void) {
+    struct timespec ts;
+    uint64 t, addr;
+    int clock;
+
+    if (argint(0, &clock) < 0 || argaddr(1, &addr) < 0)
+        return -1;
+    if (clock != CLOCK_MONOTONIC)
+        return -1;
+    t = r_time();
+    ts.sec = t / TIMEHZ;
+    ts.nsec = (t % TIMEHZ) * (1000000000 / TIMEHZ);
+    if (copyout(myproc()->pagetable, addr, (char *) &ts, sizeof(ts)) < 0)
+        return -1;
+    return 0;
+}
+
+uint64
+sys_profctl(void) {
+    int hz;
+
+    if (argint(0, &hz) < 0 || hz < 0)
+        return -1;
+    return profctl(hz);
+}
+
+uint64
+sys_profread(void) {
+    uint64 addr;
+    int n;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+        return -1;
+    return profread(addr, n);
+}
+
 uint64
 sys_sbrk(void) {
-    int addr;
+    uint64 addr;
     int n;
 
     if (argint(0, &n) < 0)
         return -1;
-    addr = myproc()->sz;
-    if (growproc(n) < 0)
+    if (growproc(n, &addr) < 0)
         return -1;
     return addr;
 }
@@ -55,21 +137,10 @@ sys_sbrk(void) {
 uint64
 sys_sleep(void) {
     int n;
-    uint ticks0;
 
     if (argint(0, &n) < 0)
         return -1;
-    acquire(&tickslock);
-    ticks0 = ticks;
-    while (ticks - ticks0 < n) {
-        if (myproc()->killed) {
-            release(&tickslock);
-            return -1;
-        }
-        sleep(&ticks, &tickslock);
-    }
-    release(&tickslock);
-    return 0;
+    return sleepticks(n);
 }
 
 uint64
@@ -85,29 +156,96 @@ sys_kill(void) {
 // since start.
 uint64
 sys_uptime(void) {
-    uint xticks;
-
-    acquire(&tickslock);
-    xticks = ticks;
-    release(&tickslock);
-    return xticks;
+    return uptimeticks();
 }
 
 uint64
 sys_trace(void) {
-    int n;
+    int n, flags;
     // 获取跟踪掩码
-    if (argint(0, &n) < 0)
+    if (argint(0, &n) < 0 || argint(1, &flags) < 0)
         return -1;
     myproc()->trace_mask = n;
+    myproc()->trace_flags = flags;
     return 0;
 }
 
+uint64
+sys_setpriority(void) {
+    int pid, prio;
+
+    if (argint(0, &pid) < 0 || argint(1, &prio) < 0)
+        return -1;
+    return setpriority(pid, prio);
+}
+
+// read trace records from the per-CPU trace rings.
+uint64
+sys_traceread(void) {
+    uint64 addr;
+    int n;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+        return -1;
+    return traceread(addr, n);
+}
+
+// copy, and optionally reset, spinlock contention counters.
+uint64
+sys_lockstat(void) {
+    uint64 addr;
+    int n, reset;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0 || argint(2, &reset) < 0)
+        return -1;
+    return lockstatread(addr, n, reset);
+}
+
+uint64
+sys_waitstat(void) {
+    uint64 addr;
+    int n, reset;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0 || argint(2, &reset) < 0)
+        return -1;
+    return waitstatread(addr, n, reset);
+}
+
+// hammer a shared test-and-set or ticket lock n times.
+uint64
+sys_lockbench(void) {
+    int ticket, n;
+    uint64 addr;
+
+    if (argint(0, &ticket) < 0 || argint(1, &n) < 0 || argaddr(2, &addr) < 0)
+        return -1;
+    return lockbench(ticket, n, addr);
+}
+
+// copy recent kernel printf() output to user space.
+uint64
+sys_dmesg(void) {
+    uint64 addr;
+    int n;
+
+    if (argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+        return -1;
+    return klogread(addr, n);
+}
+
 uint64
 sys_sysinfo(void) {
     struct sysinfo info;
+    info.version = SYSINFO_VERSION;
+    info.size = sizeof(info);
     info.freemem = get_freemem();
     info.nproc = getNproc();
+    loginfo(&info);
+    info.freeblocks = bfreecount();
+    info.tracedrops = tracedrops();
+    cpuinfo(&info);
+    slabinfo(&info);
+    swapinfo(&info);
 
     uint64 addr;
 
@@ -120,4 +258,4 @@ sys_sysinfo(void) {
         return -1;
 
     return 0;
-}
\ No newline at end of file
+}
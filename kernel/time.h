@@ -0,0 +1,11 @@
+// clock_gettime(): the time CSR, which counts at TIMEHZ from
+// boot, as seconds and nanoseconds.
+
+#define TIMEHZ 10000000   // qemu's timer runs at 10MHz
+
+#define CLOCK_MONOTONIC 1   // time since boot; never jumps
+
+struct timespec {
+  uint64 sec;
+  uint64 nsec;   // below 1000000000
+};
@@ -0,0 +1,190 @@
+// One-shot timers.
+//
+// There is no periodic clock tick. Each CPU programs its CLINT
+// compare register for its next deadline only: the end of the
+// running process's time slice, if any, and the earliest
+// sleeping process's wakeup time, and its next profiler sample
+// while profiling is on. An idle CPU with no sleepers to wake
+// is left alone.
+//
+// Sleepers sit in a min-heap ordered by wakeup time. Whichever
+// CPU makes a new earliest deadline arms its own timer for it,
+// and a CPU re-arming always includes the heap's top, so some
+// CPU's timer is always set no later than the next wakeup.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "time.h"
+#include "defs.h"
+
+#define TICK   (TIMEHZ / 10)  // sleep() and uptime() unit
+#define SLICE  TICK           // time slice of a running process
+#define NEVER  (~0UL)
+
+uint ticks;   // r_time() / TICK, as of the last timer interrupt
+
+struct {
+  struct spinlock lock;
+  struct proc *heap[MAXPROC];  // ordered by wakeat
+  int n;
+} sleepers;
+
+void
+timersinit(void)
+{
+  initlock(&sleepers.lock, "timer");
+}
+
+static void
+swap(int i, int j)
+{
+  struct proc *p = sleepers.heap[i];
+
+  sleepers.heap[i] = sleepers.heap[j];
+  sleepers.heap[j] = p;
+  sleepers.heap[i]->tmridx = i;
+  sleepers.heap[j]->tmridx = j;
+}
+
+static void
+siftup(int i)
+{
+  while(i > 0 && sleepers.heap[(i-1)/2]->wakeat > sleepers.heap[i]->wakeat){
+    swap(i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void
+siftdown(int i)
+{
+  int c;
+
+  for(;;){
+    c = 2*i + 1;
+    if(c >= sleepers.n)
+      break;
+    if(c+1 < sleepers.n && sleepers.heap[c+1]->wakeat < sleepers.heap[c]->wakeat)
+      c++;
+    if(sleepers.heap[i]->wakeat <= sleepers.heap[c]->wakeat)
+      break;
+    swap(i, c);
+    i = c;
+  }
+}
+
+// Take p out of the heap. Caller holds sleepers.lock.
+static void
+heapremove(struct proc *p)
+{
+  int i = p->tmridx;
+
+  sleepers.n--;
+  if(i != sleepers.n){
+    swap(i, sleepers.n);
+    siftdown(i);
+    siftup(i);
+  }
+  p->tmridx = -1;
+}
+
+// Program this CPU's timer for its next deadline.
+// Caller holds sleepers.lock, or has interrupts off; then the
+// heap may be changing under us, but whichever CPU changes it
+// re-arms itself afterwards, under the lock.
+static void
+arm(void)
+{
+  struct cpu *c = mycpu();
+  uint64 when = NEVER;
+
+  if(c->proc){
+    when = c->slice;
+    if(profhz && c->profnext < when)
+      when = c->profnext;
+  }
+  if(sleepers.n > 0 && sleepers.heap[0]->wakeat < when)
+    when = sleepers.heap[0]->wakeat;
+  *(uint64*)CLINTVA_MTIMECMP(cpuid()) = when;
+}
+
+// Start a new time slice for the process this CPU is about
+// to run, or drop the slice timer of an idle CPU. Does not
+// take sleepers.lock, which is taken before proc locks.
+void
+timerslice(void)
+{
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  c->slice = c->proc ? r_time() + SLICE : NEVER;
+  arm();
+  pop_off();
+}
+
+// Sleep for n ticks. Returns -1 if killed first.
+int
+sleepticks(uint n)
+{
+  struct proc *p = myproc();
+
+  acquire(&sleepers.lock);
+  p->wakeat = r_time() + (uint64)n * TICK;
+  p->tmridx = sleepers.n;
+  sleepers.heap[sleepers.n++] = p;
+  siftup(p->tmridx);
+  if(p->tmridx == 0)
+    arm();
+  while(p->tmridx >= 0 && !p->killed)
+    sleep(&p->wakeat, &sleepers.lock);
+  if(p->tmridx >= 0){
+    heapremove(p);
+    arm();
+  }
+  release(&sleepers.lock);
+  return p->killed ? -1 : 0;
+}
+
+// A timer interrupt: wake the sleepers that are due and
+// re-arm. Returns 1 if the running process's slice is over.
+int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 now;
+  int over = 0;
+
+  now = r_time();
+  ticks = now / TICK;
+  acquire(&sleepers.lock);
+  while(sleepers.n > 0 && (p = sleepers.heap[0])->wakeat <= now){
+    heapremove(p);
+    wakeup(&p->wakeat);
+  }
+  // give the process a new slice whether or not it is
+  // preempted, so that it does not fire again at once.
+  if(c->proc && c->slice <= now){
+    c->slice = now + SLICE;
+    over = 1;
+  }
+  if(c->proc && profhz && c->profnext <= now){
+    c->profdue = 1;
+    c->profnext = now + TIMEHZ / profhz;
+  }
+  arm();
+  release(&sleepers.lock);
+  return over;
+}
+
+// Ticks since boot.
+uint
+uptimeticks(void)
+{
+  return r_time() / TICK;
+}
@@ -0,0 +1,217 @@
+// In-memory file system, for scratch files.
+//
+// A tmpfs keeps its inodes in a table here and their contents in
+// pages from kalloc(), so nothing it does reaches the log or the
+// disk. Its inodes are ordinary in-memory inodes on device
+// TMPDEV: fs.c hands ialloc(), ilock(), iupdate(), itrunc(),
+// readi() and writei() for them to the functions below, which
+// play the part of the on-disk inodes and blocks, and everything
+// above, such as directories, path lookup and file.c, works
+// unchanged. Directories are always linear.
+//
+// One tmpfs can be mounted, on a directory of the root file
+// system (tmpmount()); namex() steps into the tmpfs root when it
+// meets that directory, and back out of it on "..". The tmpfs
+// lasts until reboot.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+
+#define NTPAGE    (PGSIZE / sizeof(char*))  // pages in a file's index
+#define TMPMAXFILE (NTPAGE * PGSIZE)         // largest tmpfs file
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// What a dinode holds, for a tmpfs inode.
+struct tnode {
+  short type;           // 0 if free
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char **pages;         // page of NTPAGE data page pointers, or 0
+};
+
+struct {
+  struct spinlock lock; // allocation of nodes
+  struct tnode node[NTMPINODE];
+} tmpfs;
+
+uint tmpmnt;            // root file system directory mounted on; 0 if none
+
+static char zeroes[PGSIZE];
+
+void
+tmpinit(void)
+{
+  initlock(&tmpfs.lock, "tmpfs");
+}
+
+// Mount the tmpfs on directory dp of the root file system.
+// Caller holds dp->lock.
+int
+tmpmount(struct inode *dp)
+{
+  struct tnode *t = &tmpfs.node[ROOTINO];
+  struct dirent *de;
+  char *pg, **pages;
+
+  if(dp->type != T_DIR || dp->dev != ROOTDEV || dp->inum == ROOTINO)
+    return -1;
+  if((pg = kzalloc()) == 0)
+    return -1;
+  if((pages = kzalloc()) == 0){
+    kfree(pg);
+    return -1;
+  }
+  acquire(&tmpfs.lock);
+  if(tmpmnt != 0){
+    release(&tmpfs.lock);
+    kfree(pg);
+    kfree((char*)pages);
+    return -1;
+  }
+  // The root's ".." is never read: namex() leaves by the mount point.
+  de = (struct dirent*)pg;
+  de[0].inum = ROOTINO;
+  strncpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = ROOTINO;
+  strncpy(de[1].name, "..", DIRSIZ);
+  pages[0] = pg;
+  t->pages = pages;
+  t->size = 2 * sizeof(*de);
+  t->type = T_DIR;
+  t->nlink = 1;
+  tmpmnt = dp->inum;
+  release(&tmpfs.lock);
+  return 0;
+}
+
+// Allocate a tmpfs inode of the given type. Returns its
+// number, or 0 if the table is full.
+uint
+tmpialloc(short type)
+{
+  uint inum;
+  struct tnode *t;
+
+  acquire(&tmpfs.lock);
+  for(inum = ROOTINO + 1; inum < NTMPINODE; inum++){
+    t = &tmpfs.node[inum];
+    if(t->type == 0){
+      memset(t, 0, sizeof(*t));
+      t->type = type;
+      release(&tmpfs.lock);
+      return inum;
+    }
+  }
+  release(&tmpfs.lock);
+  return 0;
+}
+
+// ilock() for a tmpfs inode: fill in ip from its node.
+void
+tmpiload(struct inode *ip)
+{
+  struct tnode *t = &tmpfs.node[ip->inum];
+
+  ip->type = t->type;
+  ip->major = t->major;
+  ip->minor = t->minor;
+  ip->nlink = t->nlink;
+  ip->size = t->size;
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  memset(ip->data, 0, sizeof(ip->data));
+}
+
+// iupdate() for a tmpfs inode. A type of 0 frees the node,
+// which itrunc() has already emptied. Caller holds ip->lock.
+void
+tmpiupdate(struct inode *ip)
+{
+  struct tnode *t = &tmpfs.node[ip->inum];
+
+  t->major = ip->major;
+  t->minor = ip->minor;
+  t->nlink = ip->nlink;
+  t->size = ip->size;
+  acquire(&tmpfs.lock);
+  t->type = ip->type;
+  release(&tmpfs.lock);
+}
+
+// itrunc() for a tmpfs inode: free its pages.
+// Caller holds ip->lock.
+void
+tmpitrunc(struct inode *ip)
+{
+  struct tnode *t = &tmpfs.node[ip->inum];
+  int i;
+
+  if(t->pages){
+    for(i = 0; i < NTPAGE; i++)
+      if(t->pages[i])
+        kfree(t->pages[i]);
+    kfree((char*)t->pages);
+    t->pages = 0;
+  }
+  ip->size = 0;
+  tmpiupdate(ip);
+}
+
+// readi() for a tmpfs inode, with off and n already clipped
+// to the file. A page that a failed write never filled reads
+// as zeroes. Caller holds ip->lock.
+int
+tmpreadi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  struct tnode *t = &tmpfs.node[ip->inum];
+  uint tot, m;
+  char *pg;
+
+  for(tot = 0; tot < n; tot += m, off += m, dst += m){
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    pg = t->pages ? t->pages[off / PGSIZE] : 0;
+    if(pg == 0)
+      pg = zeroes;
+    if(either_copyout(user_dst, dst, pg + off % PGSIZE, m) == -1)
+      break;
+  }
+  return tot;
+}
+
+// writei() for a tmpfs inode; off is at most ip->size.
+// Returns the number of bytes written, or -1 if the file
+// would grow too big. Caller holds ip->lock.
+int
+tmpwritei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  struct tnode *t = &tmpfs.node[ip->inum];
+  uint tot, m;
+  char **pp;
+
+  if(off + n > TMPMAXFILE)
+    return -1;
+  if(t->pages == 0 && n > 0 && (t->pages = kzalloc()) == 0)
+    return 0;
+  for(tot = 0; tot < n; tot += m, off += m, src += m){
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    pp = &t->pages[off / PGSIZE];
+    if(*pp == 0 && (*pp = kzalloc()) == 0)
+      break;
+    if(either_copyin(*pp + off % PGSIZE, user_src, src, m) == -1)
+      break;
+  }
+  if(off > ip->size){
+    ip->size = off;
+    tmpiupdate(ip);
+  }
+  return tot;
+}
@@ -0,0 +1,10 @@
+// System call trace records, see tracebuf.c.
+
+#define TRACE_RING 1   // trace() flag: trace to the ring, not the console
+
+struct tracerec {
+  uint64 time;  // r_time() at system call return
+  int pid;
+  int num;      // system call number
+  uint64 ret;   // return value
+};
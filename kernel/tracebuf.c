@@ -0,0 +1,104 @@
+// Per-CPU ring buffers of system call trace records.
+//
+// syscall() pushes a record onto the current CPU's ring,
+// with interrupts off, instead of printing it; the CPU is
+// the ring's only writer and needs no lock. Readers drain
+// the rings with traceread(), serialized by a sleep-lock so
+// that they may copy out to user space. When a ring is full
+// new records are dropped and counted.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "trace.h"
+#include "defs.h"
+
+#define NTRACEREC 512   // records per ring
+
+struct tracering {
+  struct tracerec rec[NTRACEREC];
+  uint head;      // next record to read; written by readers
+  uint tail;      // next record to write; written by the owning cpu
+  uint64 ndrop;   // records lost to a full ring
+};
+
+struct {
+  struct sleeplock lock;  // serializes readers
+  struct tracering ring[NCPU];
+} tbuf;
+
+void
+traceinit(void)
+{
+  initsleeplock(&tbuf.lock, "tracebuf");
+}
+
+// Record a system call's return on this CPU's ring.
+void
+tracepush(int pid, int num, uint64 ret)
+{
+  struct tracering *r;
+  struct tracerec *e;
+  uint t;
+
+  push_off();
+  r = &tbuf.ring[cpuid()];
+  t = r->tail;
+  if(t - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= NTRACEREC){
+    r->ndrop++;
+    pop_off();
+    return;
+  }
+  e = &r->rec[t % NTRACEREC];
+  e->time = r_time();
+  e->pid = pid;
+  e->num = num;
+  e->ret = ret;
+  __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+// Copy up to n trace records to user address dst, ring by ring.
+// Returns the number of records copied, or -1.
+int
+traceread(uint64 dst, int n)
+{
+  struct proc *p = myproc();
+  struct tracering *r;
+  struct tracerec e;
+  int i, got = 0;
+  uint h;
+
+  acquiresleep(&tbuf.lock);
+  for(i = 0; i < NCPU && got < n; i++){
+    r = &tbuf.ring[i];
+    h = r->head;
+    while(got < n && h != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)){
+      e = r->rec[h % NTRACEREC];
+      if(copyout(p->pagetable, dst + got * sizeof(e), (char *)&e, sizeof(e)) < 0){
+        releasesleep(&tbuf.lock);
+        return -1;
+      }
+      h++;
+      got++;
+      // hand the slot back to the writer.
+      __atomic_store_n(&r->head, h, __ATOMIC_RELEASE);
+    }
+  }
+  releasesleep(&tbuf.lock);
+  return got;
+}
+
+// Total records dropped because a ring was full.
+uint64
+tracedrops(void)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    n += __atomic_load_n(&tbuf.ring[i].ndrop, __ATOMIC_RELAXED);
+  return n;
+}
@@ -5,21 +5,23 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
-
-struct spinlock tickslock;
-uint ticks;
+#include "sysinfo.h"
 
 extern char trampoline[], uservec[], userret[];
+extern char ucopyfault[], ucopyend[];
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
 extern int devintr();
 
+extern uint64 mscratch0[];  // start.c
+
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  timersinit();
+  profinit();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -41,6 +43,8 @@ usertrap(void)
   if((r_sstatus() & SSTATUS_SPP) != 0)
     panic("usertrap: not from user mode");
 
+  cputime(1);
+
   // send interrupts and exceptions to kerneltrap(),
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
@@ -67,18 +71,46 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            mmfault(p->mm, r_stval(), r_scause() == 15 ? PTE_W :
+                    r_scause() == 12 ? PTE_X : PTE_R) == 0){
+    // page fault on a lazily allocated or copy-on-write page,
+    // which is now mapped. Other threads must drop the old
+    // copy-on-write page from their TLBs before we write.
+    statinc(ST_PGFAULT);
+    if(r_scause() == 15)
+      mmflush(p->mm);
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            execfault(p, r_stval()) == 0){
+    // first touch of a page of the program, now read in.
+    statinc(ST_PGFAULT);
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            mmapfault(p->mm, r_stval(), r_scause() == 15) == 0){
+    // first touch of a page of an mmap()ed file.
+    statinc(ST_PGFAULT);
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            swapfault(p->mm, r_stval(), r_scause() == 15 ? PTE_W :
+                      r_scause() == 12 ? PTE_X : PTE_R) == 0){
+    // a page swapped out to disk, now read back in; or a lazily
+    // allocated page that had to wait for memory to be freed.
+    statinc(ST_PGFAULT);
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
     p->killed = 1;
   }
 
+  if(which_dev && mycpu()->profdue){
+    mycpu()->profdue = 0;
+    profsample(p, p->trapframe->epc, p->trapframe->s0, 1);
+  }
+
   if(p->killed)
     exit(-1);
 
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    preempt();
 
   usertrapret();
 }
@@ -95,6 +127,7 @@ usertrapret(void)
   // kerneltrap() to usertrap(), so turn off interrupts until
   // we're back in user space, where usertrap() is correct.
   intr_off();
+  cputime(0);
 
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
@@ -125,7 +158,8 @@ usertrapret(void)
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  mycpu()->tlbgen++;  // userret flushes the TLB; see mmflush()
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,15 +177,38 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  // copyin() touching an untouched lazy heap page?
+  if((scause == 13 || scause == 15) && kvmfault(r_stval(), scause == 15) == 0){
+    statinc(ST_PGFAULT);
+    w_sepc(sepc);
+    w_sstatus(sstatus);
+    return;
+  }
+  // or one it can't have, or can't have without sleeping
+  // under a spinlock: the copy returns -1.
+  if((scause == 13 || scause == 15) && myproc() && myproc()->ucopy &&
+     sepc >= (uint64)ucopyin && sepc < (uint64)ucopyend){
+    w_sepc((uint64)ucopyfault);
+    w_sstatus(sstatus);
+    return;
+  }
+
   if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
+  // kernelvec leaves s0 as it was, so our caller's frame
+  // pointer, saved just below ours, is the interrupted one.
+  if(mycpu()->profdue){
+    mycpu()->profdue = 0;
+    profsample(myproc(), sepc, *(uint64*)(r_fp() - 16), 0);
+  }
+
   // give up the CPU if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+    preempt();
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -159,15 +216,6 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
-{
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
-}
-
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -196,23 +244,27 @@ devintr()
     // the PLIC allows each device to raise at most one
     // interrupt at a time; tell the PLIC the device is
     // now allowed to interrupt again.
-    if(irq)
+    if(irq){
       plic_complete(irq);
+      statinc(ST_INTR);
+    }
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer interrupt
+    // or IPI, forwarded by timervec in kernelvec.S.
+    // timervec sets scratch[7] for a timer interrupt; an IPI
+    // only needs to get an idle CPU out of wfi.
+    int tick = __atomic_exchange_n(&mscratch0[32 * cpuid() + 7], 0, __ATOMIC_ACQ_REL);
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before timerintr() re-arms
+    // the timer.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    if(tick && timerintr())
+      return 2;
+    return 1;
   } else {
     return 0;
   }
@@ -34,20 +34,25 @@
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
 #define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+                              // (with FIFOs on: the TX FIFO is empty)
+#define UART_FIFO 16          // bytes the TX FIFO holds
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
-// the transmit output buffer.
+// the transmit output buffer, a ring indexed by
+// free-running byte counts.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE PGSIZE
 char uart_tx_buf[UART_TX_BUF_SIZE];
-int uart_tx_w; // write next to uart_tx_buf[uart_tx_w++]
-int uart_tx_r; // read next from uart_tx_buf[uar_tx_r++]
+uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
+uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
+int uart_tx_wait; // a writer sleeps on uart_tx_r
 
 extern volatile int panicked; // from printf.c
 
 void uartstart();
+static void uartfill();
 
 void
 uartinit(void)
@@ -93,19 +98,65 @@ uartputc(int c)
       ;
   }
 
-  while(1){
-    if(((uart_tx_w + 1) % UART_TX_BUF_SIZE) == uart_tx_r){
-      // buffer is full.
-      // wait for uartstart() to open up space in the buffer.
+  while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+    // buffer is full.
+    // wait for uartstart() to open up space in the buffer.
+    uart_tx_wait = 1;
+    sleep(&uart_tx_r, &uart_tx_lock);
+  }
+  uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
+  uart_tx_w++;
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// copy n bytes from src, a user address if user_src is set,
+// into the output buffer, as many as fit at a time, and start
+// sending. blocks while the buffer is full; like uartputc(),
+// only suitable for use by write().
+// returns the number of bytes copied, short only if
+// copying from user space fails.
+int
+uartwrite(int user_src, uint64 src, int n)
+{
+  int i, m, r;
+  uint64 w;
+
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  for(i = 0; i < n; i += m){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      uart_tx_wait = 1;
       sleep(&uart_tx_r, &uart_tx_lock);
-    } else {
-      uart_tx_buf[uart_tx_w] = c;
-      uart_tx_w = (uart_tx_w + 1) % UART_TX_BUF_SIZE;
-      uartstart();
+    }
+    // free space up to the end of the ring.
+    w = uart_tx_w % UART_TX_BUF_SIZE;
+    m = UART_TX_BUF_SIZE - (uart_tx_w - uart_tx_r);
+    if(m > UART_TX_BUF_SIZE - w)
+      m = UART_TX_BUF_SIZE - w;
+    if(m > n - i)
+      m = n - i;
+    if(either_copyin(&uart_tx_buf[w], user_src, src + i, m) == -1){
+      // maybe a page that can't be read in under uart_tx_lock.
       release(&uart_tx_lock);
-      return;
+      r = uvmtouch(src + i, m, 0);
+      acquire(&uart_tx_lock);
+      if(r < 0)
+        break;
+      m = 0;
+      continue;
     }
+    uart_tx_w += m;
+    uartstart();
   }
+
+  release(&uart_tx_lock);
+  return i;
 }
 
 // alternate version of uartputc() that doesn't 
@@ -130,33 +181,69 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// add n bytes of kernel output to the output buffer, for
+// printf(). never sleeps and wakes no one, since the caller
+// may hold any lock; if the buffer is full, it makes room by
+// polling the UART.
+void
+uartputs(const char *s, int n)
+{
+  int i;
+
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  for(i = 0; i < n; i++){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE)
+      uartfill();
+    uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = s[i];
+    uart_tx_w++;
+  }
+  uartfill();
+
+  release(&uart_tx_lock);
+}
+
+// if the UART's transmit FIFO is empty, and characters are
+// waiting in the transmit buffer, refill the FIFO with up to
+// UART_FIFO of them.
+// caller must hold uart_tx_lock.
+static void
+uartfill()
+{
+  int n;
+
+  while(uart_tx_w != uart_tx_r){
+    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+      // the UART transmit FIFO still holds bytes.
+      // it will interrupt when it has drained.
+      break;
+    }
+
+    for(n = 0; n < UART_FIFO && uart_tx_w != uart_tx_r; n++){
+      WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
+      uart_tx_r++;
+    }
+  }
+}
+
+// send what the UART will take from the transmit buffer.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r];
-    uart_tx_r = (uart_tx_r + 1) % UART_TX_BUF_SIZE;
-    
-    // maybe uartputc() is waiting for space in the buffer.
+  uartfill();
+
+  // maybe uartputc() or uartwrite() is waiting for
+  // space in the buffer; wake it once half is free.
+  if(uart_tx_wait && uart_tx_w - uart_tx_r <= UART_TX_BUF_SIZE / 2){
+    uart_tx_wait = 0;
     wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
   }
 }
 
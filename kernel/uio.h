@@ -0,0 +1,8 @@
+// readv() and writev(): one segment of a scattered buffer.
+
+#define NIOV 16   // max segments per readv()/writev()
+
+struct iovec {
+  uint64 base;   // user address
+  uint64 len;    // bytes
+};
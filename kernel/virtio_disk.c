@@ -3,6 +3,21 @@
 // uses qemu's mmio interface to virtio.
 // qemu presents a "legacy" virtio interface.
 //
+// requests are queued with virtio_disk_submit(), handed to
+// the device in one notification by virtio_disk_kick(), and
+// awaited with virtio_disk_wait(), so a caller can keep many
+// requests in flight. virtio_disk_rw() does all three for a
+// single buffer.
+//
+// submitted requests wait in a queue sorted by block. kicking
+// the device sends them in elevator order, each run of
+// adjacent blocks going the same way as one request with a
+// descriptor per buffer.
+//
+// if the device offers several virtqueues, each CPU submits to
+// its own, under its own lock. they share one interrupt, so
+// whichever hart takes it reaps them all.
+//
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
 
@@ -16,12 +31,20 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "sysinfo.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
-static struct disk {
- // memory for virtio descriptors &c for queue 0.
+// the device's configuration space: virtio_blk_config.
+#define VIRTIO_MMIO_CONFIG 0x100
+#define VIRTIO_BLK_CFG_NUM_QUEUES 34   // uint16
+
+#define NMERGE 16  // most buffers in one request; at most NUM-2
+
+// one virtqueue.
+struct vq {
+ // memory for virtio descriptors &c for the queue.
  // this is a global instead of allocated because it must
  // be multiple contiguous pages, which kalloc()
  // doesn't support, and page aligned.
@@ -38,21 +61,64 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // the request's buffers, linked by qnext
     char status;
   } info[NUM];
-  
-  struct spinlock vdisk_lock;
-  
-} __attribute__ ((aligned (PGSIZE))) disk;
+
+  // requests submitted but not yet sent, sorted by qblock,
+  // and the block after the last one sent.
+  struct buf *queue;
+  uint head;
+
+  // disk command headers.
+  // one-for-one with descriptors, for convenience.
+  struct virtio_blk_req ops[NUM];
+
+  // requests added to the avail ring since the last notify.
+  int unkicked;
+
+  int n;  // queue number
+  struct spinlock lock;
+} __attribute__ ((aligned (PGSIZE)));
+
+static struct disk {
+  struct vq vq[NCPU];
+  int nvq;  // queues in use
+} disk;
+
+static void
+vq_init(struct vq *q, int n)
+{
+  initlock(&q->lock, "virtio_disk");
+  q->n = n;
+
+  *R(VIRTIO_MMIO_QUEUE_SEL) = n;
+  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+    panic("virtio disk has no queue");
+  if(max < NUM)
+    panic("virtio disk max queue too short");
+  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  memset(q->pages, 0, sizeof(q->pages));
+  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)q->pages) >> PGSHIFT;
+
+  // desc = pages -- num * VRingDesc
+  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
+  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+
+  q->desc = (struct VRingDesc *) q->pages;
+  q->avail = (uint16*)(((char*)q->desc) + NUM*sizeof(struct VRingDesc));
+  q->used = (struct UsedArea *) (q->pages + PGSIZE);
+
+  for(int i = 0; i < NUM; i++)
+    q->free[i] = 1;
+}
 
 void
 virtio_disk_init(void)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
-
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 1 ||
      *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
@@ -71,7 +137,6 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
@@ -87,38 +152,28 @@ virtio_disk_init(void)
 
   *R(VIRTIO_MMIO_GUEST_PAGE_SIZE) = PGSIZE;
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
-
-  // desc = pages -- num * VRingDesc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
-
-  disk.desc = (struct VRingDesc *) disk.pages;
-  disk.avail = (uint16*)(((char*)disk.desc) + NUM*sizeof(struct VRingDesc));
-  disk.used = (struct UsedArea *) (disk.pages + PGSIZE);
-
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+  // a queue per CPU, if the device has that many.
+  disk.nvq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ)){
+    disk.nvq = *(volatile uint16 *)(VIRTIO0 + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CFG_NUM_QUEUES);
+    if(disk.nvq > NCPU)
+      disk.nvq = NCPU;
+    if(disk.nvq < 1)
+      disk.nvq = 1;
+  }
+  for(int i = 0; i < disk.nvq; i++)
+    vq_init(&disk.vq[i], i);
 
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *q)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -127,144 +182,255 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *q, int i)
 {
   if(i >= NUM)
     panic("virtio_disk_intr 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("virtio_disk_intr 2");
-  disk.desc[i].addr = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->free[i] = 1;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *q, int i)
 {
   while(1){
-    free_desc(i);
-    if(disk.desc[i].flags & VRING_DESC_F_NEXT)
-      i = disk.desc[i].next;
+    free_desc(q, i);
+    if(q->desc[i].flags & VRING_DESC_F_NEXT)
+      i = q->desc[i].next;
     else
       break;
   }
 }
 
 static int
-alloc3_desc(int *idx)
+allocn_desc(struct vq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
+// queue a read or write of b's data from or to disk block
+// blockno (normally b->blockno), without waiting for it and
+// without necessarily notifying the device; follow with
+// virtio_disk_kick() and virtio_disk_wait().
+// b must be locked, and stay locked until the request finishes.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_submit(struct buf *b, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  struct buf **pp;
+  struct vq *q;
 
-  acquire(&disk.vdisk_lock);
+  statinc(write ? ST_DWRITE : ST_DREAD);
 
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
+  // this CPU's queue. b remembers it, should we move on.
+  push_off();
+  q = &disk.vq[cpuid() % disk.nvq];
+  pop_off();
+  acquire(&q->lock);
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-  
-  // format the three descriptors.
+  b->disk = 1;
+  b->vq = q->n;
+  b->qblock = blockno;
+  b->qwrite = write;
+  // after any others for the same block, which must go first.
+  for(pp = &q->queue; *pp && (*pp)->qblock <= blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+
+  release(&q->lock);
+}
+
+// hand the device one request for the n buffers linked from
+// b, for consecutive blocks from b->qblock, using descriptors
+// idx[0..n+1]. caller must hold q->lock.
+static void
+send(struct vq *q, struct buf *b, int n, int *idx)
+{
+  // the spec says that legacy block operations use a
+  // descriptor for type/reserved/sector, then the data,
+  // here one descriptor per buffer, then a 1-byte status.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
-  if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+  if(b->qwrite)
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
-
-  disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = (uint64)b->qblock * (BSIZE / 512);
+
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  q->desc[idx[0]].next = idx[1];
+
+  // record the buffers for virtio_disk_intr().
+  q->info[idx[0]].b = b;
+
+  for(int i = 1; i <= n; i++, b = b->qnext){
+    q->desc[idx[i]].addr = (uint64) b->data;
+    q->desc[idx[i]].len = BSIZE;
+    if(b->qwrite)
+      q->desc[idx[i]].flags = 0; // device reads b->data
+    else
+      q->desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    q->desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    q->desc[idx[i]].next = idx[i+1];
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  q->info[idx[0]].status = 0;
+  q->desc[idx[n+1]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[n+1]].len = 1;
+  q->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  q->desc[idx[n+1]].next = 0;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
   // avail[2...] are desc[] indices the device should process.
   // we only tell device the first index in our chain of descriptors.
-  disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
+  q->avail[2 + (q->avail[1] % NUM)] = idx[0];
   __sync_synchronize();
-  disk.avail[1] = disk.avail[1] + 1;
+  q->avail[1] = q->avail[1] + 1;
+  q->unkicked = 1;
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// send the queued requests in one sweep up the disk from
+// where the last one sent ended, then from the bottom (C-LOOK),
+// merging each run of up to NMERGE adjacent blocks going the
+// same way into one request. stops when the descriptors run
+// out; virtio_disk_intr() carries on as they free up.
+// caller must hold q->lock.
+static void
+dispatch(struct vq *q)
+{
+  struct buf **pp, *b, *last;
+  int n, idx[NMERGE+2];
+
+  while(q->queue){
+    for(pp = &q->queue; *pp && (*pp)->qblock < q->head; pp = &(*pp)->qnext)
+      ;
+    if(*pp == 0)
+      pp = &q->queue;
+    b = last = *pp;
+    for(n = 1; n < NMERGE && last->qnext; n++){
+      if(last->qnext->qblock != last->qblock + 1 || last->qnext->qwrite != b->qwrite)
+        break;
+      last = last->qnext;
+    }
+    if(allocn_desc(q, idx, n + 2) < 0)
+      break;
+    *pp = last->qnext;
+    last->qnext = 0;
+    q->head = last->qblock + 1;
+    send(q, b, n, idx);
+  }
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// send q's queued requests, and tell the device about them.
+// caller must hold q->lock.
+static void
+kick(struct vq *q)
+{
+  dispatch(q);
+  if(q->unkicked){
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = q->n; // value is queue number
+    q->unkicked = 0;
   }
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// notify the device of all requests queued by
+// virtio_disk_submit(). the caller may have moved CPUs
+// since, so look at every queue; only those with requests
+// waiting take their lock.
+void
+virtio_disk_kick(void)
+{
+  for(int i = 0; i < disk.nvq; i++){
+    struct vq *q = &disk.vq[i];
+    if(__atomic_load_n(&q->queue, __ATOMIC_RELAXED) == 0)
+      continue;
+    acquire(&q->lock);
+    kick(q);
+    release(&q->lock);
+  }
+}
+
+// wait for a submitted request on b to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  struct vq *q = &disk.vq[b->vq];
 
-  release(&disk.vdisk_lock);
+  acquire(&q->lock);
+  kick(q);
+  // Wait for virtio_disk_intr() to say request has finished.
+  while(b->disk == 1) {
+    sleep(b, &q->lock);
+  }
+  release(&q->lock);
 }
 
 void
-virtio_disk_intr()
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, b->blockno, write);
+  virtio_disk_wait(b);
+}
+
+// finish q's completed requests, and send it more.
+static void
+reap(struct vq *q)
 {
-  acquire(&disk.vdisk_lock);
+  acquire(&q->lock);
 
-  while((disk.used_idx % NUM) != (disk.used->id % NUM)){
-    int id = disk.used->elems[disk.used_idx].id;
+  while((q->used_idx % NUM) != (q->used->id % NUM)){
+    int id = q->used->elems[q->used_idx].id;
 
-    if(disk.info[id].status != 0)
+    if(q->info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+    struct buf *b = q->info[id].b, *nb;
+    for(; b; b = nb){
+      nb = b->qnext;
+      b->disk = 0;   // disk is done with buf
+      if(b->async){
+        // nobody waits for a read-ahead; finish it here.
+        b->async = 0;
+        bdone(b);
+      } else {
+        wakeup(b);
+      }
+    }
+    q->info[id].b = 0;
+    free_chain(q, id);
 
-    disk.used_idx = (disk.used_idx + 1) % NUM;
+    q->used_idx = (q->used_idx + 1) % NUM;
   }
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  // descriptors have come free for what is still queued.
+  kick(q);
+
+  release(&q->lock);
+}
 
-  release(&disk.vdisk_lock);
+void
+virtio_disk_intr()
+{
+  // acknowledge first: a completion that lands while we
+  // look at the used rings raises a new interrupt.
+  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  __sync_synchronize();
+  for(int i = 0; i < disk.nvq; i++)
+    reap(&disk.vq[i]);
 }
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -30,8 +32,8 @@ kvminit()
   // virtio mmio disk interface
   kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
-  // CLINT
-  kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+  // CLINT, away from user addresses
+  kvmmap(CLINTVA, CLINT, 0x10000, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
@@ -54,6 +56,128 @@ kvminithart()
 {
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
+  // let copyin() read user memory through a process's
+  // kernel page table.
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+}
+
+// Per-process kernel page tables.
+//
+// A process's kernel page table is kernel_pagetable with its
+// first level-1 page replaced by a private one, whose entries
+// below MAXUVA point at the process's own level-0 page-table
+// pages. The scheduler runs the process on this table, so the
+// kernel can dereference user addresses directly; changes to
+// user PTEs are seen at once, and only new or freed level-0
+// pages need kvmsync().
+
+#define NUL1 (MAXUVA / MEGAPGSIZE)  // level-1 entries for user memory
+
+// Create a kernel page table with no user memory.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpt, l1;
+
+  if((kpt = (pagetable_t)kalloc()) == 0)
+    return 0;
+  if((l1 = (pagetable_t)kalloc()) == 0){
+    kfree(kpt);
+    return 0;
+  }
+  memmove(kpt, kernel_pagetable, PGSIZE);
+  memmove(l1, (void*)PTE2PA(kernel_pagetable[0]), PGSIZE);
+  memset(l1, 0, NUL1*sizeof(pte_t));
+  kpt[0] = PA2PTE(l1) | PTE_V;
+  return kpt;
+}
+
+// Free a table made by kvmcreate(). The pages below its
+// top two levels belong to the kernel or the user page table.
+void
+kvmfree(pagetable_t kpt)
+{
+  kfree((void*)PTE2PA(kpt[0]));
+  kfree(kpt);
+}
+
+// Make kernel page table kpt map user page table upt's memory,
+// or no user memory if upt is 0.
+void
+kvmsync(pagetable_t kpt, pagetable_t upt)
+{
+  pagetable_t l1 = (pagetable_t)PTE2PA(kpt[0]);
+
+  if(upt && (upt[0] & PTE_V))
+    memmove(l1, (void*)PTE2PA(upt[0]), NUL1*sizeof(pte_t));
+  else
+    memset(l1, 0, NUL1*sizeof(pte_t));
+}
+
+// pagetable's PTEs have changed; if it is the current
+// process's, update the process's kernel page table and
+// flush stale translations.
+void
+uvmsync(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable && p->kpagetable){
+    kvmsync(p->kpagetable, pagetable);
+    sfence_vma();
+  }
+}
+
+// A kernel page fault at va. If it happened while copyin()
+// was reading user memory directly, fault in the lazy heap
+// page and return 0 so the access is retried; if this
+// returns -1 instead, kerneltrap() makes the copy fail. Another thread
+// may have mapped the page, with a page-table page this
+// process's kernel page table doesn't have yet: mmfault()
+// succeeds, and uvmsync() picks the page-table page up.
+int
+kvmfault(uint64 va, int write)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->ucopy == 0 || va >= p->mm->sz)
+    return -1;
+  if(mmfault(p->mm, va, write ? PTE_W : PTE_R) == 0){
+    uvmsync(p->pagetable);
+    return 0;
+  }
+  // reading a program or swapped-out page sleeps, so only
+  // without spinlocks.
+  if(holdinglocks())
+    return -1;
+  if(execfault(p, va) == 0)
+    return 0;
+  return swapfault(p->mm, va, write ? PTE_W : PTE_R);
+}
+
+// Like walk(), but stop at the PTE for va in the
+// level-`level` page-table page.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int level)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;  // superpage
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+        return 0;
+      memset(pagetable, 0, PGSIZE);
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(level, va)];
 }
 
 // Return the address of the PTE in page table pagetable
@@ -68,24 +192,13 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE above level 0 maps a superpage; walk() returns
+// it, so callers that care must check PTE_LEAF().
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
-
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
-    }
-  }
-  return &pagetable[PX(0, va)];
+  return walklevel(pagetable, va, alloc, 0);
 }
 
 // Look up a virtual address, return the physical address,
@@ -132,6 +245,9 @@ kvmpa(uint64 va)
   pte_t *pte;
   uint64 pa;
   
+  pte = walklevel(kernel_pagetable, va, 0, 1);
+  if(pte && (*pte & PTE_V) && PTE_LEAF(*pte))
+    return PTE2PA(*pte) + va % MEGAPGSIZE;  // direct-mapped superpage
   pte = walk(kernel_pagetable, va, 0);
   if(pte == 0)
     panic("kvmpa");
@@ -154,6 +270,23 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    // kernel mappings use a level-1 superpage leaf wherever
+    // va and pa are aligned and a whole superpage remains.
+    // user mappings stay 4KB, since uvmunmap() and friends
+    // expect level-0 leaves.
+    if((perm & PTE_U) == 0 && a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      if(last - a == MEGAPGSIZE - PGSIZE)
+        break;
+      a += MEGAPGSIZE;
+      pa += MEGAPGSIZE;
+      continue;
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -168,7 +301,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages of a lazily grown heap that were never
+// touched have no mapping and are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -181,9 +315,13 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP)
+        swapfree(PTE2SWAP(*pte));
+      *pte = 0;  // drop any PTE_FILE mark
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -233,15 +371,16 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(newsz < oldsz)
     return oldsz;
+  if(newsz > MAXUVA)
+    return 0;
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -264,6 +403,7 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
     uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    uvmsync(pagetable);
   }
 
   return newsz;
@@ -299,10 +439,12 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Writable pages are marked read-only and PTE_COW in
+// both page tables; the first write to such a page
+// takes a page fault and uvmcowfault() copies it.
+// Swapped-out pages share their swap slot instead.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -311,22 +453,29 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;  // lazily allocated, never touched
+    if((*pte & PTE_V) == 0){
+      // a program page not read in yet stays on demand.
+      if(*pte & (PTE_FILE|PTE_SWAP)){
+        pte_t *npte = walk(new, i, 1);
+        if(npte == 0)
+          goto err;
+        *npte = *pte;
+        if(*pte & PTE_SWAP)
+          swapdup(PTE2SWAP(*pte));
+      }
+      continue;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kaddref((void*)pa);
   }
   return 0;
 
@@ -348,17 +497,289 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Resolve a write to the copy-on-write page containing va:
+// if the page is still shared, give pagetable a private
+// copy; if this is the last reference, just make it
+// writable again.
+// Returns 0 on success, -1 if va is not a COW page or
+// memory is exhausted.
+int
+uvmcowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    uvmsync(pagetable);
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  uvmsync(pagetable);
+  return 0;
+}
+
+// Allocate and map a zeroed page for a user address in
+// [0, sz) that sbrk() handed out without backing memory.
+// Returns 0 on success, -1 if va is outside the heap,
+// already mapped, or memory is exhausted.
+int
+uvmlazyalloc(pagetable_t pagetable, uint64 va, uint64 sz)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= sz || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  // a valid PTE (e.g. the stack guard page) is a real fault,
+  // a program page must be read by execfault(), and a
+  // swapped-out page by swapfault().
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & (PTE_V|PTE_FILE|PTE_SWAP)))
+    return -1;
+  if((mem = kzalloc()) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  uvmsync(pagetable);
+  return 0;
+}
+
+// Handle a user page fault at va in a process of size sz.
+// access is the PTE bit the access needs: PTE_R for a load,
+// PTE_W for a store, PTE_X for an instruction fetch.
+// Returns 0 if the faulting access can be retried,
+// -1 if the process should be killed.
+int
+uvmfault(pagetable_t pagetable, uint64 va, uint64 sz, int access)
+{
+  pte_t *pte;
+
+  if(va >= sz || va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, PGROUNDDOWN(va), 0);
+  if(pte && (*pte & PTE_V)){
+    if(access == PTE_W && (*pte & PTE_COW))
+      return uvmcowfault(pagetable, va);
+    // another thread may have mapped the page since the fault.
+    if((*pte & (PTE_U|access)) == (PTE_U|access))
+      return 0;
+    return -1;
+  }
+  return uvmlazyalloc(pagetable, va, sz);
+}
+
+// Clock scan for mmevict(): look at pagetable's pages from *va
+// up to sz, moving *va on and counting each PTE against
+// *budget, for up to n pages to swap out. A page used since
+// the hand last passed (PTE_A) loses the bit and stays; one
+// that wasn't is taken if it is private anonymous memory: not
+// copy-on-write or shared with the text cache. Its PTE keeps
+// the permissions but names the slot from swapalloc() instead,
+// invalid, and its address goes in pa[] and the slot in slot[].
+// Returns the number taken. Empties *budget if swap is full.
+// Futex waiters on a taken page's words still meet their
+// wakers, who key a private word by its virtual address;
+// MAP_SHARED pages, keyed by physical address, lie above sz
+// and are never taken.
+// Caller holds the lock of pagetable's mm.
+int
+uvmevict(pagetable_t pagetable, uint64 *va, uint64 sz,
+         uint64 *pa, uint *slot, int n, int *budget)
+{
+  pte_t *pte;
+  int k, s;
+
+  for(k = 0; *va < sz && k < n && *budget > 0; ){
+    if((pte = walk(pagetable, *va, 0)) == 0){
+      // no level-0 page-table page, so nothing mapped up to the next.
+      *va = (*va / MEGAPGSIZE + 1) * MEGAPGSIZE;
+      continue;
+    }
+    *va += PGSIZE;
+    --*budget;
+    if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U) ||
+       krefcnt((void*)PTE2PA(*pte)) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    if((s = swapalloc()) < 0){
+      *budget = 0;
+      break;
+    }
+    pa[k] = PTE2PA(*pte);
+    slot[k++] = s;
+    *pte = SWAP2PTE(s) | (*pte & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_SWAP;
+  }
+  return k;
+}
+
+// uvmfault() for mm's page table, holding off mm's other
+// threads, which share it.
+int
+mmfault(struct mm *mm, uint64 va, int access)
+{
+  int r;
+
+  acquire(&mm->lock);
+  r = uvmfault(mm->pagetable, va, mm->sz, access);
+  release(&mm->lock);
+  return r;
+}
+
+// Translation state for one copyin()/copyout() call. It
+// remembers the level-0 page-table page of the last lookup,
+// so that successive pages of a range cost one PTE load
+// instead of a three-level walk.
+struct uvmwalker {
+  pagetable_t pagetable;
+  uint64 base;   // va >> 21 of the cached level-0 table
+  pte_t *l0;     // cached level-0 table, or 0
+};
+
+// Return the user PTE for page-aligned va0, using and
+// filling w's cache. Returns 0 if there is no level-0 table.
+static pte_t*
+uvmwalkpte(struct uvmwalker *w, uint64 va0)
+{
+  pte_t *pte;
+
+  if(w->l0 && (va0 >> 21) == w->base)
+    return &w->l0[PX(0, va0)];
+  if((pte = walk(w->pagetable, va0, 0)) == 0)
+    return 0;
+  w->l0 = pte - PX(0, va0);
+  w->base = va0 >> 21;
+  return pte;
+}
+
+// Whether no page of [va, va+n) in pagetable is mapped
+// without PTE_U, as the stack guard page is. The kernel page
+// table shares the user PTEs, and a page without PTE_U is a
+// supervisor page to it, so copyin() must check before it
+// reads directly. Pages not mapped yet are left to kvmfault().
+static int
+uvmuserok(pagetable_t pagetable, uint64 va, uint64 n)
+{
+  struct uvmwalker w = { pagetable, 0, 0 };
+  pte_t *pte;
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = uvmwalkpte(&w, a);
+    if(pte && (*pte & (PTE_V|PTE_U)) == PTE_V)
+      return 0;
+  }
+  return 1;
+}
+
+// Like walkaddr(), but if pagetable is the current
+// process's and va0 lies in its untouched lazy heap,
+// allocate the page first (or read it in, if it is a
+// program page or swapped out), and if write is set, break
+// copy-on-write sharing of the page.
+// Returns the physical address, or 0.
+static uint64
+uvmtranslate(struct uvmwalker *w, uint64 va0, int write)
+{
+  pte_t *pte;
+  struct proc *p;
+
+  if(va0 >= MAXVA)
+    return 0;
+  pte = uvmwalkpte(w, va0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    p = myproc();
+    if(p == 0 || p->pagetable != w->pagetable)
+      return 0;
+    if(mmfault(p->mm, va0, PTE_R) < 0 &&
+       (holdinglocks() || (execfault(p, va0) < 0 &&
+                           swapfault(p->mm, va0, PTE_R) < 0)))
+      return 0;
+    w->l0 = 0;  // may have added a level-0 table
+    pte = uvmwalkpte(w, va0);
+  }
+  if((*pte & PTE_U) == 0)
+    return 0;
+  if(write && (*pte & PTE_COW)){
+    p = myproc();
+    if(p && p->pagetable == w->pagetable){
+      if(mmfault(p->mm, va0, PTE_W) < 0 && mmapcow(p->mm, va0) < 0)
+        return 0;
+    } else if(uvmcowfault(w->pagetable, va0) < 0)
+      return 0;
+  }
+  return PTE2PA(*pte);
+}
+
+// The physical address of user virtual address va, faulting the
+// page in and breaking copy-on-write sharing like copyout().
+// Returns 0 on error.
+uint64
+uvmuseraddr(pagetable_t pagetable, uint64 va)
+{
+  struct uvmwalker w = { pagetable, 0, 0 };
+  uint64 pa0;
+
+  if((pa0 = uvmtranslate(&w, PGROUNDDOWN(va), 1)) == 0)
+    return 0;
+  return pa0 + (va - PGROUNDDOWN(va));
+}
+
+// Fault in the current process's pages of [va, va+n), which
+// copyin() and copyout() can't do under a spinlock if that
+// means reading a program or swapped-out page, since it
+// sleeps. A copier holding a spinlock that gets -1 releases
+// it, calls this, and tries again if it returns 0. write is
+// as for uvmtranslate().
+int
+uvmtouch(uint64 va, uint64 n, int write)
+{
+  struct uvmwalker w = { myproc()->pagetable, 0, 0 };
+  uint64 a;
+
+  if(va + n < va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if(uvmtranslate(&w, a, write) == 0)
+      return -1;
+  return 0;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// Breaks copy-on-write sharing of the destination pages.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct uvmwalker w = { pagetable, 0, 0 };
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmtranslate(&w, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -380,10 +801,25 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct uvmwalker w = { pagetable, 0, 0 };
+  struct proc *p = myproc();
+  int r;
+
+  if(p && pagetable == p->pagetable && r_satp() == MAKE_SATP(p->kpagetable) &&
+     srcva + len >= srcva && srcva + len <= p->mm->sz){
+    // user memory is mapped; kvmfault() handles lazy pages.
+    // mmap() regions above sz take the slow path.
+    if(!uvmuserok(pagetable, srcva, len))
+      return -1;
+    p->ucopy = 1;
+    r = ucopyin(dst, (char *)srcva, len);
+    p->ucopy = 0;
+    return r;
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmtranslate(&w, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -407,10 +843,26 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
+  struct uvmwalker w = { pagetable, 0, 0 };
+  struct proc *p = myproc();
+
+  if(p && pagetable == p->pagetable && r_satp() == MAKE_SATP(p->kpagetable) &&
+     srcva < p->mm->sz){
+    int r;
+
+    if(max > p->mm->sz - srcva)
+      max = p->mm->sz - srcva;
+    if(!uvmuserok(pagetable, srcva, max))
+      return -1;
+    p->ucopy = 1;
+    r = ucopyinstr(dst, (char *)srcva, max);
+    p->ucopy = 0;
+    return r;
+  }
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmtranslate(&w, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
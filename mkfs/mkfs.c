@@ -17,13 +17,17 @@
 
 #define NINODES 200
 
+// FSSIZE counts 1K blocks; the image is as big whatever BSIZE is.
+#define NFSBLOCKS (FSSIZE / (BSIZE / 1024))
+
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | swap | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
+int nbitmap = NFSBLOCKS/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nswap = SWAPSIZE / (BSIZE / 1024);
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap, swap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -32,6 +36,13 @@ char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
+// The root directory, built here and written out last: in the
+// kernel's hashed layout, or linear with -L.
+#define NROOTBLOCKS 64
+char rootdir[NROOTBLOCKS][BSIZE];
+uint rootsize;
+int linear;
+
 
 void balloc(int);
 void wsect(uint, void*);
@@ -40,6 +51,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void rootlink(char *name, uint inum);
 
 // convert to intel byte order
 ushort
@@ -69,18 +81,37 @@ main(int argc, char *argv[])
 {
   int i, cc, fd;
   uint rootino, inum, off;
-  struct dirent de;
   char buf[BSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  for(;;){
+    if(argc >= 3 && strcmp(argv[1], "-l") == 0){
+      // log blocks, including the header block.
+      nlog = atoi(argv[2]);
+      if(nlog < MAXOPBLOCKS + 1 || nlog > (int)((BSIZE - sizeof(int)) / sizeof(uint)) + 1){
+        fprintf(stderr, "mkfs: bad log size %d\n", nlog);
+        exit(1);
+      }
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 2 && strcmp(argv[1], "-L") == 0){
+      linear = 1;
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-L] fs.img files...\n");
     exit(1);
   }
 
+  assert(BSIZE % 1024 == 0);
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
@@ -91,42 +122,43 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nmeta = 2 + nlog + ninodeblocks + nbitmap + nswap;
+  nblocks = NFSBLOCKS - nmeta;
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(NFSBLOCKS);
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
+  sb.swapstart = xint(2+nlog+ninodeblocks+nbitmap);
+  sb.nswap = xint(nswap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u, swap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nswap, nblocks, NFSBLOCKS);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < NFSBLOCKS; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(buf + SBOFF % BSIZE, &sb, sizeof(sb));
+  wsect(SBOFF / BSIZE, buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  if(!linear){
+    struct dirmeta *m = (struct dirmeta*)rootdir[0];
+    m->w[0] = xshort(DIRMAGIC);
+    rootsize = BSIZE;
+  }
+  rootlink(".", rootino);
+  rootlink("..", rootino);
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -151,11 +183,7 @@ main(int argc, char *argv[])
       shortname += 1;
 
     inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootlink(shortname, inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -163,18 +191,63 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  iappend(rootino, rootdir, rootsize);
+  if(linear){
+    // fix size of root inode dir
+    rinode(rootino, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
   exit(0);
 }
 
+// Add name to the root directory the way the kernel's
+// dirlink() would.
+void
+rootlink(char *name, uint inum)
+{
+  struct dirent *de;
+  struct dirmeta *m;
+  ushort *link;
+  uint h, bn, i;
+
+  if(linear){
+    assert(rootsize < sizeof(rootdir));
+    de = (struct dirent*)rootdir[0] + rootsize / sizeof(*de);
+    rootsize += sizeof(*de);
+  } else {
+    // a free slot in the header block, or else in the
+    // name's chain, adding a block if that is full.
+    de = 0;
+    for(i = DIRTAB + 1; i < DIRSLOTS && de == 0; i++)
+      if(((struct dirent*)rootdir[0])[i].inum == 0)
+        de = (struct dirent*)rootdir[0] + i;
+    h = dirhash(name);
+    m = (struct dirmeta*)rootdir[0];
+    link = &m[1 + h/7].w[h%7];
+    while(de == 0 && (bn = xshort(*link)) != 0){
+      for(i = 1; i < DIRSLOTS && de == 0; i++)
+        if(((struct dirent*)rootdir[bn])[i].inum == 0)
+          de = (struct dirent*)rootdir[bn] + i;
+      link = &((struct dirmeta*)rootdir[bn])->w[0];
+    }
+    if(de == 0){
+      bn = rootsize / BSIZE;
+      assert(bn < NROOTBLOCKS);
+      rootsize += BSIZE;
+      *link = xshort(bn);
+      de = (struct dirent*)rootdir[bn] + 1;
+    }
+  }
+  de->inum = xshort(inum);
+  strncpy(de->name, name, DIRSIZ);
+}
+
 void
 wsect(uint sec, void *buf)
 {
@@ -246,16 +319,19 @@ void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int b, i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used < nbitmap*BSIZE*8);
+  // the swap area takes more than one bitmap block's worth.
+  for(b = 0; b * BSIZE*8 < used; b++){
+    bzero(buf, BSIZE);
+    for(i = 0; i < BSIZE*8 && b*BSIZE*8 + i < used; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart + b);
+    wsect(sb.bmapstart + b, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -273,9 +349,27 @@ iappend(uint inum, void *xp, int n)
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  // A small file lives in its dinode, as the kernel keeps it.
+  if(xshort(din.type) == T_FILE && din.addrs[0] == 0){
+    if(off + n <= NINLINE){
+      bcopy(p, din.data + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    if(off > 0){
+      // outgrown: start again with blocks.
+      bcopy(din.data, buf, off);
+      memset(din.data, 0, sizeof(din.data));
+      din.size = 0;
+      winode(inum, &din);
+      iappend(inum, buf, off);
+      rinode(inum, &din);
+    }
+  }
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
+    assert(fbn < NDIRECT + NINDIRECT);  // no doubly-indirect blocks here
     if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
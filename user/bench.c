@@ -0,0 +1,228 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/time.h"
+#include "kernel/ioring.h"
+#include "user/user.h"
+
+//
+// time the basic process, memory, pipe and file operations.
+// usage: bench [iters]
+//   each test runs iters times and reports the mean and the
+//   fastest single run, in ns.
+//
+
+#define PGSIZE 4096
+
+static inline uint64
+rdtime(void) {
+    uint64 x;
+    asm volatile("rdtime %0" : "=r" (x));
+    return x;
+}
+
+static uint64 t0, tot, best;
+
+static void
+start(void) {
+    t0 = rdtime();
+}
+
+static void
+stop(void) {
+    uint64 t = rdtime() - t0;
+
+    tot += t;
+    if (t < best)
+        best = t;
+}
+
+static void
+report(char *what, int iters) {
+    printf("%s: mean %l ns, best %l ns\n", what,
+           tot * (1000000000 / TIMEHZ) / iters, best * (1000000000 / TIMEHZ));
+    tot = 0;
+    best = ~0UL;
+}
+
+static void
+fail(char *what) {
+    fprintf(2, "bench: %s failed\n", what);
+    exit(1);
+}
+
+static void
+forkbench(int iters) {
+    int i, pid;
+
+    for (i = 0; i < iters; i++) {
+        start();
+        if ((pid = fork()) < 0)
+            fail("fork");
+        if (pid == 0)
+            exit(0);
+        wait(0);
+        stop();
+    }
+    report("fork+exit+wait", iters);
+}
+
+static void
+execbench(int iters) {
+    char *args[] = {"bench", "-x", 0};
+    int i, pid;
+
+    for (i = 0; i < iters; i++) {
+        start();
+        if ((pid = fork()) < 0)
+            fail("fork");
+        if (pid == 0) {
+            exec("bench", args);
+            fail("exec");
+        }
+        wait(0);
+        stop();
+    }
+    report("fork+exec+wait", iters);
+
+    for (i = 0; i < iters; i++) {
+        start();
+        if (spawn("bench", args, 0) < 0)
+            fail("spawn");
+        wait(0);
+        stop();
+    }
+    report("spawn+wait", iters);
+}
+
+// grow the heap a page at a time, touching each page.
+static void
+sbrkbench(int iters) {
+    char *p;
+    int i;
+
+    for (i = 0; i < iters; i++) {
+        start();
+        if ((p = sbrk(PGSIZE)) == (char *) -1)
+            fail("sbrk");
+        p[0] = 1;
+        stop();
+    }
+    sbrk(-iters * PGSIZE);
+    report("sbrk+touch page", iters);
+}
+
+// one byte to a child and back, over two pipes.
+static void
+pipebench(int iters) {
+    int to[2], from[2], i, pid;
+    char c = 0;
+
+    if (pipe(to) < 0 || pipe(from) < 0)
+        fail("pipe");
+    if ((pid = fork()) < 0)
+        fail("fork");
+    if (pid == 0) {
+        close(to[1]);
+        close(from[0]);
+        while (read(to[0], &c, 1) == 1)
+            write(from[1], &c, 1);
+        exit(0);
+    }
+    close(to[0]);
+    close(from[1]);
+    for (i = 0; i < iters; i++) {
+        start();
+        if (write(to[1], &c, 1) != 1 || read(from[0], &c, 1) != 1)
+            fail("pipe round trip");
+        stop();
+    }
+    close(to[1]);
+    close(from[0]);
+    wait(0);
+    report("pipe round trip", iters);
+}
+
+static void
+filebench(int iters) {
+    static char buf[512];
+    int fd, i;
+
+    for (i = 0; i < iters; i++) {
+        start();
+        if ((fd = open("bench.tmp", O_CREATE | O_WRONLY)) < 0)
+            fail("create");
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+            fail("write");
+        close(fd);
+        if (unlink("bench.tmp") < 0)
+            fail("unlink");
+        stop();
+    }
+    report("create+write+unlink", iters);
+}
+
+// NWRITES small writes, one system call each and then
+// all through one ioring_enter().
+#define NWRITES 16
+
+static void
+ringbench(int iters) {
+    static struct ioring r;
+    static char buf[32];
+    struct iosqe *e;
+    int fd, i, j;
+
+    if ((fd = open("bench.tmp", O_CREATE | O_WRONLY)) < 0)
+        fail("create");
+    for (i = 0; i < iters; i++) {
+        start();
+        for (j = 0; j < NWRITES; j++)
+            if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+                fail("write");
+        stop();
+    }
+    report("16 writes", iters);
+
+    for (i = 0; i < iters; i++) {
+        start();
+        for (j = 0; j < NWRITES; j++) {
+            e = &r.sq[r.sqtail % NIORING];
+            e->op = IO_WRITE;
+            e->fd = fd;
+            e->addr = (uint64) buf;
+            e->len = sizeof(buf);
+            r.sqtail++;
+        }
+        if (ioring_enter(&r) != NWRITES)
+            fail("ioring_enter");
+        r.cqhead = r.cqtail;
+        stop();
+    }
+    report("16 writes, one ioring_enter", iters);
+    close(fd);
+    unlink("bench.tmp");
+}
+
+int
+main(int argc, char *argv[]) {
+    int iters = 100;
+
+    // the program that execbench runs.
+    if (argc > 1 && strcmp(argv[1], "-x") == 0)
+        exit(0);
+    if (argc > 1)
+        iters = atoi(argv[1]);
+    if (iters < 1) {
+        fprintf(2, "usage: bench [iters]\n");
+        exit(1);
+    }
+
+    best = ~0UL;
+    forkbench(iters);
+    execbench(iters);
+    sbrkbench(iters);
+    pipebench(iters);
+    filebench(iters);
+    ringbench(iters);
+    exit(0);
+}
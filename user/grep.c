@@ -1,52 +1,302 @@
-// Simple grep.  Only supports ^ . * $ operators.
+// Simple grep.  Supports ^ $ . [] * + ? and \ escapes.
+//
+// The pattern is a sequence of atoms, each a set of characters
+// that may be repeated or optional, so its NFA state is just
+// the set of atoms matched so far, a bitmask. A DFA built from
+// it lazily, one transition at a time, runs over each line in
+// a single pass, so matching takes linear time whatever the
+// pattern. While no atom has matched, the line is skipped
+// ahead to the pattern's first character, if it has one.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
-int match(char*, char*);
+#define NATOM   63    // bit NATOM is left for the accepting state
+#define NDSTATE 64    // DFA states cached at once
+
+struct atom {
+  uchar set[32];      // characters matched, one bit each
+  char rep;           // '*' for any number, '?' for at most one
+};
+
+struct dstate {
+  uint64 nfa;         // atoms matched so far: bit i = i atoms
+  int accept;
+  short next[256];    // DFA state after each character; -1 if unknown
+};
+
+struct atom atoms[NATOM];
+int natom;
+int bol, eol;         // pattern anchored by ^ and $
+int first = -1;       // character every match starts with, or -1
+
+struct dstate dstates[NDSTATE];
+int ndstate;
+int nflush;           // times the cache has been emptied
+int start = -1;       // DFA state of an empty match; -1 if not made
+
+char buf[8192];
+
+static void
+setbit(uchar *set, int c)
+{
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+static int
+hasbit(uchar *set, int c)
+{
+  return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static void
+badpattern(char *why)
+{
+  fprintf(2, "grep: %s\n", why);
+  exit(1);
+}
+
+// Parse the bracket expression at re, just past the '[', into
+// set; returns the text after the closing ']'.
+static char*
+parseclass(char *re, uchar *set)
+{
+  int neg = 0, c, i;
+
+  if(*re == '^'){
+    neg = 1;
+    re++;
+  }
+  // a ']' straight after the '[' stands for itself.
+  if(*re == ']')
+    setbit(set, *re++);
+  while(*re && *re != ']'){
+    c = (uchar)*re++;
+    if(*re == '-' && re[1] && re[1] != ']'){
+      for(i = c; i <= (uchar)re[1]; i++)
+        setbit(set, i);
+      re += 2;
+    } else
+      setbit(set, c);
+  }
+  if(*re != ']')
+    badpattern("missing ]");
+  if(neg)
+    for(i = 0; i < 32; i++)
+      set[i] = ~set[i];
+  return re + 1;
+}
+
+static void
+compile(char *re)
+{
+  struct atom *a;
+  int i;
+
+  if(*re == '^'){
+    bol = 1;
+    re++;
+  }
+  while(*re){
+    if(re[0] == '$' && re[1] == '\0'){
+      eol = 1;
+      break;
+    }
+    // a leading '*' stands for itself, as in the old grep.
+    if((*re == '*' || *re == '+' || *re == '?') && natom > 0){
+      a = &atoms[natom-1];
+      if(*re == '+'){
+        // x+ is x followed by x*
+        if(natom == NATOM)
+          badpattern("pattern too long");
+        atoms[natom] = *a;
+        atoms[natom++].rep = '*';
+      } else if(a->rep == 0 || *re == '*')
+        a->rep = *re;
+      re++;
+      continue;
+    }
+    if(natom == NATOM)
+      badpattern("pattern too long");
+    a = &atoms[natom++];
+    if(*re == '.'){
+      for(i = 0; i < 32; i++)
+        a->set[i] = 0xff;
+      re++;
+    } else if(*re == '['){
+      re = parseclass(re + 1, a->set);
+    } else {
+      if(*re == '\\' && re[1])
+        re++;
+      setbit(a->set, (uchar)*re++);
+    }
+  }
+
+  // The first atom must match one given character to skip by it.
+  if(natom > 0 && !bol && atoms[0].rep == 0){
+    for(i = 0; i < 256; i++){
+      if(hasbit(atoms[0].set, i)){
+        if(first >= 0){
+          first = -1;
+          break;
+        }
+        first = i;
+      }
+    }
+  }
+}
+
+// Follow every optional atom from the states in s.
+static uint64
+closure(uint64 s)
+{
+  int i;
+
+  for(i = 0; i < natom; i++)
+    if((s >> i) & 1 && atoms[i].rep)
+      s |= 1UL << (i + 1);
+  return s;
+}
+
+// The NFA states reached from s on c.
+static uint64
+step(uint64 s, int c)
+{
+  uint64 t = 0;
+  int i;
+
+  for(i = 0; i < natom; i++){
+    if(((s >> i) & 1) == 0 || !hasbit(atoms[i].set, c))
+      continue;
+    t |= 1UL << (i + 1);
+    if(atoms[i].rep == '*')
+      t |= 1UL << i;
+  }
+  // without ^, a match may begin at any character.
+  if(!bol)
+    t |= 1;
+  return closure(t);
+}
+
+// Find or make the DFA state for NFA states s. When the cache
+// is full it is emptied and refilled as the lines need it.
+static int
+dstate(uint64 s)
+{
+  struct dstate *d;
+  int i;
+
+  for(i = 0; i < ndstate; i++)
+    if(dstates[i].nfa == s)
+      return i;
+  if(ndstate == NDSTATE){
+    ndstate = 0;
+    nflush++;
+    start = -1;
+  }
+  d = &dstates[ndstate];
+  d->nfa = s;
+  d->accept = (s >> natom) & 1;
+  memset(d->next, 0xff, sizeof(d->next));
+  return ndstate++;
+}
+
+// Transition of DFA state d on c, computing it the first time.
+// May empty the cache, so the caller must reload start.
+static int
+next(int d, int c)
+{
+  int n, f = nflush;
+
+  if((n = dstates[d].next[c]) >= 0)
+    return n;
+  n = dstate(step(dstates[d].nfa, c));
+  if(nflush == f)  // else d is gone with the rest of the cache
+    dstates[d].next[c] = n;
+  return n;
+}
+
+// Does line p, of n bytes without its newline, match?
+static int
+match(char *p, int n)
+{
+  char *e = p + n;
+  int d;
+
+  if(start < 0)
+    start = dstate(closure(1));
+  d = start;
+  while(p < e){
+    if(dstates[d].accept && !eol)
+      return 1;
+    if(dstates[d].nfa == 0)
+      return 0;  // only after ^: no match can start later
+    if(d == start && first >= 0){
+      while(p < e && (uchar)*p != first)
+        p++;
+      if(p == e)
+        break;
+    }
+    d = next(d, (uchar)*p++);
+    if(start < 0)
+      start = dstate(closure(1));
+  }
+  return dstates[d].accept;
+}
 
 void
-grep(char *pattern, int fd)
+grep(int fd)
 {
   int n, m;
-  char *p, *q;
+  char *p, *q, *e;
 
   m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
+  while((n = read(fd, buf+m, sizeof(buf)-m)) > 0){
     m += n;
-    buf[m] = '\0';
     p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
+    e = buf + m;
+    for(;;){
+      for(q = p; q < e && *q != '\n'; q++)
+        ;
+      if(q == e)
+        break;
+      if(match(p, q - p))
+        fwrite(p, 1, q+1 - p, stdout);
       p = q+1;
     }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    if(p == buf && m == sizeof(buf)){
+      // a line longer than buf: take what there is as a line.
+      if(match(buf, m)){
+        fwrite(buf, 1, m, stdout);
+        fwrite("\n", 1, 1, stdout);
+      }
+      p = e;
     }
+    m -= p - buf;
+    if(m > 0 && p != buf)
+      memmove(buf, p, m);
   }
+  if(m > 0 && match(buf, m)){
+    fwrite(buf, 1, m, stdout);
+    fwrite("\n", 1, 1, stdout);
+  }
+  fflush(stdout);
 }
 
 int
 main(int argc, char *argv[])
 {
   int fd, i;
-  char *pattern;
 
   if(argc <= 1){
     fprintf(2, "usage: grep pattern [file ...]\n");
     exit(1);
   }
-  pattern = argv[1];
+  compile(argv[1]);
 
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(0);
     exit(0);
   }
 
@@ -55,51 +305,8 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    grep(fd);
     close(fd);
   }
   exit(0);
 }
-
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
-
-int matchhere(char*, char*);
-int matchstar(int, char*, char*);
-
-int
-match(char *re, char *text)
-{
-  if(re[0] == '^')
-    return matchhere(re+1, text);
-  do{  // must look at empty string
-    if(matchhere(re, text))
-      return 1;
-  }while(*text++ != '\0');
-  return 0;
-}
-
-// matchhere: search for re at beginning of text
-int matchhere(char *re, char *text)
-{
-  if(re[0] == '\0')
-    return 1;
-  if(re[1] == '*')
-    return matchstar(re[0], re+2, text);
-  if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
-    return matchhere(re+1, text+1);
-  return 0;
-}
-
-// matchstar: search for c*re at beginning of text
-int matchstar(int c, char *re, char *text)
-{
-  do{  // a * matches zero or more instances
-    if(matchhere(re, text))
-      return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
-  return 0;
-}
-
@@ -23,6 +23,11 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // scratch files live in memory.
+  mkdir("/tmp");
+  if(mount("tmpfs", "/tmp") < 0)
+    printf("init: mount /tmp failed\n");
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
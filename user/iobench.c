@@ -0,0 +1,103 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+//
+// measure pipe and file throughput.
+// usage: iobench [kbytes [chunk]]
+//
+
+#define TICKHZ 10   // timer interrupts per second in qemu
+
+static char buf[16 * 1024];
+
+static void
+report(char *what, int bytes, int ticks) {
+    if (ticks == 0)
+        ticks = 1;
+    printf("%s: %d KB in %d ticks, %d KB/s\n", what, bytes / 1024, ticks,
+           (bytes / 1024) * TICKHZ / ticks);
+}
+
+// a child writes kbytes through a pipe that the parent drains.
+static void
+pipebench(int kbytes, int chunk) {
+    int fds[2], pid, n, tot, t0;
+
+    if (pipe(fds) < 0) {
+        fprintf(2, "iobench: pipe failed\n");
+        exit(1);
+    }
+    t0 = uptime();
+    pid = fork();
+    if (pid < 0) {
+        fprintf(2, "iobench: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        for (tot = 0; tot < kbytes * 1024; tot += chunk) {
+            if (write(fds[1], buf, chunk) != chunk) {
+                fprintf(2, "iobench: pipe write failed\n");
+                exit(1);
+            }
+        }
+        exit(0);
+    }
+    close(fds[1]);
+    tot = 0;
+    while ((n = read(fds[0], buf, chunk)) > 0)
+        tot += n;
+    close(fds[0]);
+    wait(0);
+    report("pipe", tot, uptime() - t0);
+}
+
+// write a kbytes file, then read it back.
+static void
+filebench(int kbytes, int chunk) {
+    int fd, n, tot, t0;
+
+    if ((fd = open("iobench.tmp", O_CREATE | O_WRONLY)) < 0) {
+        fprintf(2, "iobench: create failed\n");
+        exit(1);
+    }
+    t0 = uptime();
+    for (tot = 0; tot < kbytes * 1024; tot += chunk) {
+        if (write(fd, buf, chunk) != chunk) {
+            fprintf(2, "iobench: file write failed\n");
+            exit(1);
+        }
+    }
+    close(fd);
+    report("file write", tot, uptime() - t0);
+
+    if ((fd = open("iobench.tmp", O_RDONLY)) < 0) {
+        fprintf(2, "iobench: open failed\n");
+        exit(1);
+    }
+    t0 = uptime();
+    tot = 0;
+    while ((n = read(fd, buf, chunk)) > 0)
+        tot += n;
+    close(fd);
+    report("file read", tot, uptime() - t0);
+    unlink("iobench.tmp");
+}
+
+int
+main(int argc, char *argv[]) {
+    int kbytes = 1024, chunk = 4096;
+
+    if (argc > 1)
+        kbytes = atoi(argv[1]);
+    if (argc > 2)
+        chunk = atoi(argv[2]);
+    if (kbytes <= 0 || chunk <= 0 || chunk > sizeof(buf)) {
+        fprintf(2, "usage: iobench [kbytes [chunk]]\n");
+        exit(1);
+    }
+    pipebench(kbytes, chunk);
+    filebench(kbytes, chunk);
+    exit(0);
+}
@@ -0,0 +1,111 @@
+#include "kernel/types.h"
+#include "kernel/lockstat.h"
+#include "kernel/time.h"
+#include "user/user.h"
+
+//
+// compare test-and-set and ticket spinlocks under contention.
+// usage: lockbench [nproc [iters]]
+//   nproc processes each acquire and release one kernel lock
+//   iters times; reports throughput and the wait distribution.
+//
+
+// wait, in ticks, below which a fraction num/den of the
+// acquisitions fell: the top of the histogram bucket that
+// reaches it.
+static uint64
+percentile(struct lockbench *lb, uint64 num, uint64 den) {
+    uint64 need, sum = 0;
+    int i;
+
+    need = (lb->n * num + den - 1) / den;
+    for (i = 0; i < NLBHIST; i++) {
+        sum += lb->hist[i];
+        if (sum >= need)
+            return (2UL << i) - 1;
+    }
+    return lb->maxwait;
+}
+
+static void
+run(char *name, int ticket, int nproc, int iters) {
+    struct lockbench lb, tot;
+    uint64 slow = 0, fast = ~0UL;
+    int fds[2], i, j, pid;
+
+    if (pipe(fds) < 0) {
+        fprintf(2, "lockbench: pipe failed\n");
+        exit(1);
+    }
+    for (i = 0; i < nproc; i++) {
+        pid = fork();
+        if (pid < 0) {
+            fprintf(2, "lockbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            if (lockbench(ticket, iters, &lb) < 0) {
+                fprintf(2, "lockbench: lockbench failed\n");
+                exit(1);
+            }
+            write(fds[1], &lb, sizeof(lb));
+            exit(0);
+        }
+    }
+    close(fds[1]);
+
+    memset(&tot, 0, sizeof(tot));
+    for (i = 0; i < nproc; i++) {
+        if (read(fds[0], &lb, sizeof(lb)) != sizeof(lb)) {
+            fprintf(2, "lockbench: short read\n");
+            exit(1);
+        }
+        tot.n += lb.n;
+        tot.wait += lb.wait;
+        if (lb.maxwait > tot.maxwait)
+            tot.maxwait = lb.maxwait;
+        for (j = 0; j < NLBHIST; j++)
+            tot.hist[j] += lb.hist[j];
+        // the processes run side by side, so the slowest one
+        // bounds the run; the spread between fastest and slowest
+        // shows how evenly the lock was shared.
+        if (lb.time > slow)
+            slow = lb.time;
+        if (lb.time < fast)
+            fast = lb.time;
+    }
+    close(fds[0]);
+    for (i = 0; i < nproc; i++)
+        wait(0);
+
+    if (slow == 0)
+        slow = 1;
+    if (tot.n == 0)
+        tot.n = 1;
+    printf("%s: %l acquires in %l us, %l acquires/ms\n", name, tot.n,
+           slow / (TIMEHZ / 1000000), tot.n * (TIMEHZ / 1000) / slow);
+    printf("  wait ticks: mean %l p50 %l p99 %l p99.9 %l max %l\n",
+           tot.wait / tot.n, percentile(&tot, 1, 2), percentile(&tot, 99, 100),
+           percentile(&tot, 999, 1000), tot.maxwait);
+    printf("  per-process time: fastest %l us, slowest %l us\n",
+           fast / (TIMEHZ / 1000000), slow / (TIMEHZ / 1000000));
+}
+
+int
+main(int argc, char *argv[]) {
+    int nproc = 4, iters = 20000;
+
+    if (argc > 1)
+        nproc = atoi(argv[1]);
+    if (argc > 2)
+        iters = atoi(argv[2]);
+    if (nproc < 1 || iters < 1) {
+        fprintf(2, "usage: lockbench [nproc [iters]]\n");
+        exit(1);
+    }
+
+    run("test-and-set", 0, nproc, iters);
+    run("ticket", 1, nproc, iters);
+    exit(0);
+}
@@ -0,0 +1,80 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+//
+// print spinlock contention and hold-time counters, per lock
+// name, then the time spent in sleep() per call site.
+// usage: lockstat [-r] [command ...]
+//   -r       zero the counters after printing them
+//   command  zero the counters, run command, then print
+// times are in timer ticks (100ns); pcs are kernel addresses,
+// for kernel/kernel.asm.
+//
+
+struct lockstat ls[NLOCKSTAT];
+struct waitstat ws[NWAITSTAT];
+
+int
+main(int argc, char *argv[]) {
+    int i, j, n, pid, reset = 0;
+    char *nargv[MAXARG];
+
+    if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+        reset = 1;
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1) {
+        lockstat(0, NLOCKSTAT, 1);
+        waitstat(0, NWAITSTAT, 1);
+        pid = fork();
+        if (pid < 0) {
+            fprintf(2, "lockstat: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            for (i = 1; i < argc && i < MAXARG; i++)
+                nargv[i - 1] = argv[i];
+            nargv[i - 1] = 0;
+            exec(nargv[0], nargv);
+            fprintf(2, "lockstat: exec %s failed\n", nargv[0]);
+            exit(1);
+        }
+        wait(0);
+    }
+
+    if ((n = lockstat(ls, NLOCKSTAT, reset)) < 0) {
+        fprintf(2, "lockstat: failed\n");
+        exit(1);
+    }
+    printf("lock          locks  acquires  contended  spins  slow  maxhold  at\n");
+    for (i = 0; i < n; i++) {
+        if (ls[i].acquire == 0)
+            continue;
+        printf("%s", ls[i].name);
+        for (j = strlen(ls[i].name); j < 12; j++)
+            printf(" ");
+        printf("  %d  %d  %d  %d  %d  %l", (int) ls[i].nlocks, (int) ls[i].acquire,
+               (int) ls[i].contended, (int) ls[i].spins, (int) ls[i].slow,
+               ls[i].maxhold);
+        if (ls[i].maxhold)
+            printf("  %p", ls[i].maxpc);
+        printf("\n");
+    }
+
+    if ((n = waitstat(ws, NWAITSTAT, reset)) < 0) {
+        fprintf(2, "lockstat: waitstat failed\n");
+        exit(1);
+    }
+    printf("\nsleep site                            sleeps  mean  max\n");
+    for (i = 0; i < n; i++) {
+        if (ws[i].n == 0)
+            continue;
+        printf("%p %p  %d  %l  %l\n", ws[i].pc[0], ws[i].pc[1], (int) ws[i].n,
+               ws[i].time / ws[i].n, ws[i].maxtime);
+    }
+    exit(0);
+}
@@ -0,0 +1,27 @@
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+//
+// print file system log statistics.
+//
+int
+main(int argc, char *argv[]) {
+    struct sysinfo info;
+
+    if (sysinfo(&info) < 0) {
+        fprintf(2, "logstat: sysinfo failed\n");
+        exit(1);
+    }
+    printf("log size:      %d blocks\n", (int) info.logsize);
+    printf("commits:       %d\n", (int) info.ncommit);
+    printf("blocks:        %d\n", (int) info.logblocks);
+    if (info.ncommit > 0) {
+        printf("avg txn size:  %d blocks\n", (int) (info.logblocks / info.ncommit));
+        printf("avg commit:    %d cycles\n", (int) (info.commitcycles / info.ncommit));
+    }
+    printf("max commit:    %d cycles\n", (int) info.maxcommitcycles);
+    printf("absorbed:      %d writes\n", (int) info.logabsorb);
+    printf("space stalls:  %d\n", (int) info.logstall);
+    exit(0);
+}
@@ -0,0 +1,77 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+//
+// measure page allocation and memory copy speed.
+// usage: memspeed [pages]
+//
+
+#define TICKHZ 10   // timer interrupts per second in qemu
+#define PGSIZE 4096
+
+static char src[PGSIZE], dst[PGSIZE];
+
+static void
+report(char *what, int pages, int ticks) {
+    if (ticks == 0)
+        ticks = 1;
+    printf("%s: %d pages in %d ticks, %d pages/s\n", what, pages, ticks,
+           pages * TICKHZ / ticks);
+}
+
+// grow by pages, touching each so that the kernel allocates
+// and zeroes it (kalloc+memset), then give the memory back
+// (kfree's junk fill).
+static void
+allocbench(int pages) {
+    int i, t0, tot = 0;
+    char *p;
+
+    t0 = uptime();
+    while (tot < pages) {
+        if ((p = sbrk(64 * PGSIZE)) == (char *) -1) {
+            fprintf(2, "memspeed: sbrk failed\n");
+            exit(1);
+        }
+        for (i = 0; i < 64; i++)
+            p[i * PGSIZE] = 1;
+        sbrk(-64 * PGSIZE);
+        tot += 64;
+    }
+    report("alloc+free", tot, uptime() - t0);
+}
+
+static void
+copybench(int pages) {
+    int i, t0;
+
+    t0 = uptime();
+    for (i = 0; i < pages; i++)
+        memmove(dst, src, PGSIZE);
+    report("memmove", pages, uptime() - t0);
+
+    t0 = uptime();
+    for (i = 0; i < pages; i++)
+        memmove(dst + 1, src + 1, PGSIZE - 8);
+    report("memmove offset 1", pages, uptime() - t0);
+
+    t0 = uptime();
+    for (i = 0; i < pages; i++)
+        memset(dst, i, PGSIZE);
+    report("memset", pages, uptime() - t0);
+}
+
+int
+main(int argc, char *argv[]) {
+    int pages = 16384;
+
+    if (argc > 1)
+        pages = atoi(argv[1]);
+    if (pages <= 0) {
+        fprintf(2, "usage: memspeed [pages]\n");
+        exit(1);
+    }
+    allocbench(pages);
+    copybench(pages);
+    exit(0);
+}
@@ -0,0 +1,22 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// nice prio command: run command at base scheduling level
+// prio, from 0 (most favoured) to NPRIO-1.
+int
+main(int argc, char *argv[])
+{
+  if(argc < 3 || argv[1][0] < '0' || argv[1][0] > '9'){
+    fprintf(2, "Usage: nice prio command\n");
+    exit(1);
+  }
+
+  if(setpriority(getpid(), atoi(argv[1])) < 0){
+    fprintf(2, "nice: bad priority %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -6,14 +6,37 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output of one vprintf(), collected so that it reaches the
+// stream (and for unbuffered streams, write()) in one piece.
+struct out {
+  int fd;
+  FILE *f;       // fd's stream, or 0 to write() directly
+  int n;
+  char buf[256];
+};
+
+static void
+flushout(struct out *o)
+{
+  if(o->n == 0)
+    return;
+  if(o->f)
+    fwrite(o->buf, 1, o->n, o->f);
+  else
+    write(o->fd, o->buf, o->n);
+  o->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct out *o, char c)
 {
-  write(fd, &c, 1);
+  if(o->n == sizeof(o->buf))
+    flushout(o);
+  o->buf[o->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *fd, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -39,7 +62,7 @@ printint(int fd, int xx, int base, int sgn)
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct out *fd, uint64 x) {
   int i;
   putc(fd, '0');
   putc(fd, 'x');
@@ -47,13 +70,18 @@ printptr(int fd, uint64 x) {
     putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
+// Print to the given fd, through its stdio stream.
+// Only understands %d, %x, %p, %s.
 void
-vprintf(int fd, const char *fmt, va_list ap)
+vprintf(int fdnum, const char *fmt, va_list ap)
 {
   char *s;
   int c, i, state;
+  struct out out, *fd = &out;
 
+  out.fd = fdnum;
+  out.f = fdstream(fdnum);
+  out.n = 0;
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -92,6 +120,7 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  flushout(fd);
 }
 
 void
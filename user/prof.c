@@ -0,0 +1,103 @@
+#include "kernel/types.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+//
+// profile a command: sample the pc of every CPU running a
+// process, then print a flat histogram by address.
+// usage: prof [-h hz] cmd [args...]
+//   K marks kernel addresses, U addresses in user programs;
+//   look them up with addr2line or kernel/kernel.asm.
+//
+
+#define NHASH 1024   // distinct addresses kept
+#define NTOP    20   // lines printed
+
+struct entry {
+    uint64 pc;
+    int user;
+    int n;
+};
+
+static struct entry tab[NHASH];
+static struct profsample buf[64];
+static int nsamples, nlost;
+
+static void
+count(uint64 pc, int user) {
+    uint h = (pc >> 1) * 2654435761U % NHASH;
+    int i;
+
+    for (i = 0; i < NHASH; i++) {
+        struct entry *e = &tab[(h + i) % NHASH];
+        if (e->n == 0) {
+            e->pc = pc;
+            e->user = user;
+        }
+        if (e->pc == pc && e->user == user) {
+            e->n++;
+            return;
+        }
+    }
+    nlost++;
+}
+
+int
+main(int argc, char *argv[]) {
+    int hz = 100, i, j, n, best;
+    uint64 drops;
+    struct entry t;
+
+    if (argc > 2 && strcmp(argv[1], "-h") == 0) {
+        hz = atoi(argv[2]);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc < 2 || hz < 1) {
+        fprintf(2, "usage: prof [-h hz] cmd [args...]\n");
+        exit(1);
+    }
+
+    if (profctl(hz) < 0) {
+        fprintf(2, "prof: profctl failed\n");
+        exit(1);
+    }
+    if (spawn(argv[1], argv + 1, 0) < 0) {
+        profctl(0);
+        fprintf(2, "prof: cannot run %s\n", argv[1]);
+        exit(1);
+    }
+    wait(0);
+    drops = profctl(0);
+
+    while ((n = profread(buf, sizeof(buf) / sizeof(buf[0]))) > 0) {
+        for (i = 0; i < n; i++)
+            count(buf[i].pc[0], buf[i].user);
+        nsamples += n;
+    }
+    if (drops)
+        printf("prof: %l samples dropped, buffers full\n", drops);
+    if (nlost)
+        printf("prof: %d samples not counted, table full\n", nlost);
+    if (nsamples == 0) {
+        printf("prof: no samples\n");
+        exit(0);
+    }
+
+    // selection sort of the top NTOP.
+    printf("%d samples\n", nsamples);
+    for (i = 0; i < NTOP && i < NHASH; i++) {
+        best = i;
+        for (j = i + 1; j < NHASH; j++)
+            if (tab[j].n > tab[best].n)
+                best = j;
+        if (tab[best].n == 0)
+            break;
+        t = tab[i];
+        tab[i] = tab[best];
+        tab[best] = t;
+        printf("%d\t%d%%\t%c %p\n", tab[i].n, tab[i].n * 100 / nsamples,
+               tab[i].user ? 'U' : 'K', tab[i].pc);
+    }
+    exit(0);
+}
@@ -0,0 +1,67 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/scstat.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+#define NSC 64
+
+struct scstat before[NSC], after[NSC];
+
+//
+// run a command with the system calls in mask recorded
+// quietly, then print their latency statistics.
+//
+int
+main(int argc, char *argv[]) {
+    int i, b, n, pid;
+    char *nargv[MAXARG];
+
+    if (argc < 3 || (argv[1][0] < '0' || argv[1][0] > '9')) {
+        fprintf(2, "Usage: %s mask command\n", argv[0]);
+        exit(1);
+    }
+
+    if ((n = scstat(before, NSC)) < 0) {
+        fprintf(2, "%s: scstat failed\n", argv[0]);
+        exit(1);
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        fprintf(2, "%s: fork failed\n", argv[0]);
+        exit(1);
+    }
+    if (pid == 0) {
+        trace(atoi(argv[1]), TRACE_RING);
+        for (i = 2; i < argc && i < MAXARG; i++)
+            nargv[i - 2] = argv[i];
+        nargv[i - 2] = 0;
+        exec(nargv[0], nargv);
+        fprintf(2, "%s: exec %s failed\n", argv[0], nargv[0]);
+        exit(1);
+    }
+    wait(0);
+    scstat(after, n);
+
+    // the statistics are system-wide, so concurrent traced
+    // processes are counted too.
+    printf("syscall     count   avg cycles  max cycles\n");
+    for (i = 0; i < n; i++) {
+        struct scstat *s0 = &before[i], *s1 = &after[i];
+        int count = s1->count - s0->count;
+
+        if (count == 0)
+            continue;
+        printf("%s", s1->name);
+        for (b = strlen(s1->name); b < 10; b++)
+            printf(" ");
+        printf("  %d  %d  %d\n", count, (int) ((s1->cycles - s0->cycles) / count),
+               (int) s1->maxcycles);
+        printf("   hist:");
+        for (b = 0; b < SCSTAT_NHIST; b++)
+            printf(" %d", (int) (s1->hist[b] - s0->hist[b]));
+        printf("\n");
+    }
+    exit(0);
+}
@@ -0,0 +1,400 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+// Buffered I/O on file descriptors.
+//
+// There is at most one stream per descriptor, iob[fd]; stdin,
+// stdout and stderr open themselves on first use. A stream is
+// either read or written, and reading one that holds output
+// (or the reverse) drops what is buffered in the other
+// direction. Streams are fully buffered, except that stdout is
+// line buffered when it is the console, and that stderr and
+// the streams printf() opens for descriptors it is handed are
+// unbuffered: each fwrite() or printf() on them ends with a
+// single write(). Reading stdin flushes stdout, and exit(),
+// exec() and fork() flush all streams, so that no output is
+// lost or inherited by a child.
+
+#define BUFSIZ 512
+
+enum { IOFBF = 1, IOLBF, IONBF };
+
+struct iobuf {
+  int open;
+  int fd;
+  int mode;        // IOFBF, IOLBF or IONBF
+  int writing;     // buf holds output rather than input
+  char *buf;       // BUFSIZ bytes
+  int pos;         // next byte of input, or bytes of output
+  int len;         // bytes of input in buf
+  int eof;
+  int err;
+};
+
+static struct iobuf iob[NOFILE];
+static char stdbuf[3][BUFSIZ];
+static char unbuf[BUFSIZ];   // shared by unbuffered streams, empty between calls
+
+FILE *stdin = &iob[0];
+FILE *stdout = &iob[1];
+FILE *stderr = &iob[2];
+
+static void flushall(void);
+
+static void
+setup(FILE *f, int fd, int mode, char *buf)
+{
+  f->open = 1;
+  f->fd = fd;
+  f->mode = mode;
+  f->writing = 0;
+  f->buf = buf;
+  f->pos = f->len = 0;
+  f->eof = f->err = 0;
+  stdioflush = flushall;
+}
+
+// Open stdin, stdout or stderr on first use.
+static int
+ready(FILE *f)
+{
+  struct stat st;
+
+  if(f->open)
+    return 0;
+  if(f == stdin)
+    setup(f, 0, IOFBF, stdbuf[0]);
+  else if(f == stdout)
+    setup(f, 1, fstat(1, &st) == 0 && st.type == T_DEVICE ? IOLBF : IOFBF, stdbuf[1]);
+  else if(f == stderr)
+    setup(f, 2, IONBF, unbuf);
+  else
+    return -1;
+  return 0;
+}
+
+int
+fflush(FILE *f)
+{
+  int n, off;
+
+  if(f == 0){
+    flushall();
+    return 0;
+  }
+  if(ready(f) < 0)
+    return -1;
+  if(!f->writing){
+    f->pos = f->len = 0;  // drop read-ahead
+    return 0;
+  }
+  for(off = 0; off < f->pos; off += n){
+    if((n = write(f->fd, f->buf + off, f->pos - off)) <= 0){
+      f->err = 1;
+      f->pos = 0;
+      return -1;
+    }
+  }
+  f->pos = 0;
+  return 0;
+}
+
+static void
+flushall(void)
+{
+  int fd;
+
+  for(fd = 0; fd < NOFILE; fd++)
+    if(iob[fd].open && iob[fd].writing && iob[fd].pos > 0)
+      fflush(&iob[fd]);
+}
+
+// Switch f to writing, and make room for a byte.
+static int
+wready(FILE *f)
+{
+  if(ready(f) < 0)
+    return -1;
+  if(!f->writing){
+    f->pos = f->len = 0;
+    f->writing = 1;
+  }
+  if(f->pos == BUFSIZ && fflush(f) < 0)
+    return -1;
+  return 0;
+}
+
+// End of one output operation on f.
+static int
+wdone(FILE *f)
+{
+  if(f->mode == IONBF){
+    if(f == stderr)
+      fflush(stdout);  // keep the console in order
+    return fflush(f);
+  }
+  return 0;
+}
+
+// Switch f to reading, and fill the buffer if it is empty.
+// Returns the number of buffered bytes, 0 at end of file.
+static int
+rready(FILE *f)
+{
+  int n;
+
+  if(ready(f) < 0)
+    return -1;
+  if(f->writing){
+    fflush(f);
+    f->writing = 0;
+  }
+  if(f->pos < f->len)
+    return f->len - f->pos;
+  if(f->eof || f->err)
+    return 0;
+  if(f == stdin)
+    fflush(stdout);  // show a prompt before waiting for input
+  f->pos = f->len = 0;
+  if((n = read(f->fd, f->buf, BUFSIZ)) <= 0){
+    if(n < 0)
+      f->err = 1;
+    else
+      f->eof = 1;
+    return 0;
+  }
+  f->len = n;
+  return n;
+}
+
+// Does f have a buffer of its own from malloc()?
+static int
+ownbuf(FILE *f)
+{
+  return f->buf && f->buf != unbuf && f->buf != stdbuf[0] && f->buf != stdbuf[1];
+}
+
+// Start a stream on fd, which must be open, for reading ("r")
+// or writing ("w").
+FILE*
+fdopen(int fd, const char *mode)
+{
+  FILE *f;
+  char *buf;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  f = &iob[fd];
+  if(f->open)
+    fflush(f);
+  if(fd < 3){
+    f->open = 0;
+    ready(f);
+  } else {
+    if(ownbuf(f))
+      buf = f->buf;
+    else if((buf = malloc(BUFSIZ)) == 0)
+      return 0;
+    setup(f, fd, IOFBF, buf);
+  }
+  f->writing = mode[0] != 'r';
+  return f;
+}
+
+// Open a file: "r" to read it, "w" to create or truncate it.
+FILE*
+fopen(const char *path, const char *mode)
+{
+  int fd;
+  FILE *f;
+
+  if(mode[0] == 'r')
+    fd = open(path, O_RDONLY);
+  else if(mode[0] == 'w')
+    fd = open(path, O_WRONLY|O_CREATE|O_TRUNC);
+  else
+    return 0;
+  if(fd < 0)
+    return 0;
+  if((f = fdopen(fd, mode)) == 0)
+    close(fd);
+  return f;
+}
+
+int
+fclose(FILE *f)
+{
+  int r;
+
+  if(ready(f) < 0)
+    return -1;
+  r = f->writing ? fflush(f) : 0;
+  if(close(f->fd) < 0)
+    r = -1;
+  if(ownbuf(f))
+    free(f->buf);
+  f->open = 0;
+  f->buf = 0;
+  return r;
+}
+
+int
+fgetc(FILE *f)
+{
+  if(rready(f) <= 0)
+    return -1;
+  return (uchar)f->buf[f->pos++];
+}
+
+// Read a line of at most n-1 bytes, keeping the newline.
+// Returns 0 at end of file.
+char*
+fgets(char *s, int n, FILE *f)
+{
+  int i, c;
+
+  for(i = 0; i + 1 < n; ){
+    if((c = fgetc(f)) < 0)
+      break;
+    s[i++] = c;
+    if(c == '\n')
+      break;
+  }
+  s[i] = '\0';
+  return i == 0 && n > 1 ? 0 : s;
+}
+
+// Read n items of size bytes. Returns the number of whole
+// items read.
+int
+fread(void *buf, int size, int n, FILE *f)
+{
+  char *p = buf;
+  int want, got, m;
+
+  want = size * n;
+  for(got = 0; got < want; got += m){
+    if(rready(f) <= 0)
+      break;
+    m = f->len - f->pos;
+    if(m > want - got)
+      m = want - got;
+    memmove(p + got, f->buf + f->pos, m);
+    f->pos += m;
+  }
+  return size > 0 ? got / size : 0;
+}
+
+int
+fputc(int c, FILE *f)
+{
+  if(wready(f) < 0)
+    return -1;
+  f->buf[f->pos++] = c;
+  if(f->mode == IOLBF && c == '\n'){
+    if(fflush(f) < 0)
+      return -1;
+  } else if(wdone(f) < 0)
+    return -1;
+  return (uchar)c;
+}
+
+// Write n items of size bytes. Large writes on an empty
+// buffer go straight to write().
+int
+fwrite(const void *buf, int size, int n, FILE *f)
+{
+  const char *p = buf;
+  struct iovec iov[2];
+  int want, done, m, nl = 0;
+
+  want = size * n;
+  if(wready(f) < 0)
+    return 0;
+  if(want >= BUFSIZ){
+    if(f == stderr)
+      fflush(stdout);
+    done = 0;
+    if(f->pos > 0){
+      // what is buffered, then buf, in one system call.
+      iov[0].base = (uint64)f->buf;
+      iov[0].len = f->pos;
+      iov[1].base = (uint64)p;
+      iov[1].len = want;
+      m = writev(f->fd, iov, 2);
+      if(m < f->pos){
+        f->err = 1;
+        f->pos = 0;
+        return 0;
+      }
+      done = m - f->pos;
+      f->pos = 0;
+    }
+    for(; done < want; done += m)
+      if((m = write(f->fd, p + done, want - done)) <= 0){
+        f->err = 1;
+        break;
+      }
+    return size > 0 ? done / size : 0;
+  }
+  for(done = 0; done < want; done += m){
+    if(wready(f) < 0)
+      break;
+    m = BUFSIZ - f->pos;
+    if(m > want - done)
+      m = want - done;
+    memmove(f->buf + f->pos, p + done, m);
+    f->pos += m;
+  }
+  if(f->mode == IOLBF)
+    for(m = 0; m < want; m++)
+      if(p[m] == '\n')
+        nl = 1;
+  if(nl)
+    fflush(f);
+  wdone(f);
+  return size > 0 ? done / size : 0;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+  int n = strlen(s);
+
+  return fwrite(s, 1, n, f) == n ? n : -1;
+}
+
+// The stream printf() writes to for fd: the one already open,
+// or a new unbuffered one. 0 if fd is out of range.
+FILE*
+fdstream(int fd)
+{
+  FILE *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  f = &iob[fd];
+  if(!f->open && ready(f) < 0)
+    setup(f, fd, IONBF, unbuf);
+  return f;
+}
+
+char*
+gets(char *buf, int max)
+{
+  int i, c;
+
+  for(i=0; i+1 < max; ){
+    if((c = fgetc(stdin)) < 0)
+      break;
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  return buf;
+}
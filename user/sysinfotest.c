@@ -13,63 +13,56 @@ sinfo(struct sysinfo *info) {
 }
 
 //
-// use sbrk() to count how many free physical memory pages there are.
+// sbrk() only reserves address space, and pages are allocated
+// as they are first touched: freemem stays put when the heap
+// grows, drops a page per page touched, and comes back when
+// sbrk() gives the pages back.
 //
-int
-countfree() {
-    uint64 sz0 = (uint64) sbrk(0);
-    struct sysinfo info;
-    int n = 0;
-
-    while (1) {
-        if ((uint64) sbrk(PGSIZE) == 0xffffffffffffffff) {
-            break;
-        }
-        n += PGSIZE;
-    }
-    sinfo(&info);
-    if (info.freemem != 0) {
-        printf("FAIL: there is no free mem, but sysinfo.freemem=%d\n",
-               info.freemem);
-        exit(1);
-    }
-    sbrk(-((uint64) sbrk(0) - sz0));
-    return n;
-}
-
 void
 testmem() {
+    enum { N = 32 };
     struct sysinfo info;
-    uint64 n = countfree();
+    uint64 before;
+    char *a;
+    int i;
 
-    sinfo(&info);
-
-    if (info.freemem != n) {
-        printf("FAIL: free mem %d (bytes) instead of %d\n", info.freemem, n);
+    // the first touches may also allocate page-table pages,
+    // which stay; take them now so that they aren't counted.
+    if ((a = sbrk(N * PGSIZE)) == (char *) -1) {
+        printf("sbrk failed");
         exit(1);
     }
+    for (i = 0; i < N; i++)
+        a[i * PGSIZE] = 1;
+    sbrk(-N * PGSIZE);
 
-    if ((uint64) sbrk(PGSIZE) == 0xffffffffffffffff) {
+    sinfo(&info);
+    before = info.freemem;
+    if (sbrk(N * PGSIZE) != a) {
         printf("sbrk failed");
         exit(1);
     }
-
     sinfo(&info);
+    if (info.freemem != before) {
+        printf("FAIL: free mem %d (bytes) instead of %d before touching\n", info.freemem, before);
+        exit(1);
+    }
 
-    if (info.freemem != n - PGSIZE) {
-        printf("FAIL: free mem %d (bytes) instead of %d\n", n - PGSIZE, info.freemem);
+    for (i = 0; i < N; i++)
+        a[i * PGSIZE] = 1;
+    sinfo(&info);
+    if (info.freemem != before - N * PGSIZE) {
+        printf("FAIL: free mem %d (bytes) instead of %d\n", info.freemem, before - N * PGSIZE);
         exit(1);
     }
 
-    if ((uint64) sbrk(-PGSIZE) == 0xffffffffffffffff) {
+    if ((uint64) sbrk(-N * PGSIZE) == 0xffffffffffffffff) {
         printf("sbrk failed");
         exit(1);
     }
-
     sinfo(&info);
-
-    if (info.freemem != n) {
-        printf("FAIL: free mem %d (bytes) instead of %d\n", n, info.freemem);
+    if (info.freemem != before) {
+        printf("FAIL: free mem %d (bytes) instead of %d\n", info.freemem, before);
         exit(1);
     }
 }
@@ -121,13 +114,10 @@ void testproc() {
 
 int
 main(int argc, char *argv[]) {
-//  printf("sysinfotest: start\n");
-//  testcall();
-//  testmem();
-//  testproc();
-//  printf("sysinfotest: OK\n");
-    struct sysinfo info;
-    sysinfo(&info);
-    printf("info.freemem is %lu info.nproc is %lu\n", info.freemem, info.nproc);
+    printf("sysinfotest: start\n");
+    testcall();
+    testmem();
+    testproc();
+    printf("sysinfotest: OK\n");
     exit(0);
 }
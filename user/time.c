@@ -0,0 +1,59 @@
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "kernel/time.h"
+#include "user/user.h"
+
+//
+// run a command and report the time it took.
+// usage: time cmd [args...]
+//   real is wall-clock time; user and sys are the CPU time
+//   the command and the children it waited for spent in user
+//   space and in the kernel. Also reports how busy each CPU
+//   was meanwhile.
+//
+
+static void
+show(char *what, uint64 t) {
+    // t is in timer cycles; print seconds with 3 decimals.
+    uint64 ms = t / (TIMEHZ / 1000);
+
+    printf("%s %l.%l%l%ls\n", what, ms / 1000, ms / 100 % 10, ms / 10 % 10, ms % 10);
+}
+
+int
+main(int argc, char *argv[]) {
+    struct sysinfo a, b;
+    struct timespec t0, t1;
+    uint64 real, busy;
+    int i;
+
+    if (argc < 2) {
+        fprintf(2, "usage: time cmd [args...]\n");
+        exit(1);
+    }
+    if (sysinfo(&a) < 0 || clock_gettime(CLOCK_MONOTONIC, &t0) < 0) {
+        fprintf(2, "time: sysinfo failed\n");
+        exit(1);
+    }
+    if (spawn(argv[1], argv + 1, 0) < 0) {
+        fprintf(2, "time: cannot run %s\n", argv[1]);
+        exit(1);
+    }
+    wait(0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    sysinfo(&b);
+
+    real = (t1.sec - t0.sec) * TIMEHZ + t1.nsec / (1000000000 / TIMEHZ) -
+           t0.nsec / (1000000000 / TIMEHZ);
+    show("real", real);
+    show("user", b.cutime - a.cutime);
+    show("sys ", b.cstime - a.cstime);
+    if (real == 0)
+        real = 1;
+    for (i = 0; i < b.ncpu; i++) {
+        busy = (b.utime[i] - a.utime[i]) + (b.stime[i] - a.stime[i]);
+        printf("cpu%d: %l%% busy, %l%% user\n", i, busy * 100 / real,
+               (b.utime[i] - a.utime[i]) * 100 / real);
+    }
+    exit(0);
+}
@@ -1,27 +1,104 @@
 #include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/syscall.h"
+#include "kernel/scstat.h"
+#include "kernel/trace.h"
 #include "user/user.h"
 
+#define NREC 64
+#define NSC  64
+
+struct scstat names[NSC];
+struct tracerec recs[NREC];
+
+// print the records in the trace rings; return 1 if the
+// end marker from pid marker was among them.
+int
+drain(int marker)
+{
+  int i, n, done = 0;
+
+  while((n = traceread(recs, NREC)) > 0){
+    for(i = 0; i < n; i++){
+      struct tracerec *e = &recs[i];
+      if(e->pid == marker){
+        done = 1;
+        continue;
+      }
+      printf("%l %d: syscall %s -> %d\n", e->time, e->pid,
+             e->num < NSC ? names[e->num].name : "?", (int)e->ret);
+    }
+  }
+  return done;
+}
+
+// trace -r: record into the kernel's trace rings instead of
+// printing from the kernel, and print the records from here.
+// a wrapper process waits for the command and then makes a
+// traced trace() call of its own to mark the end.
+void
+ringtrace(int mask, char **nargv)
+{
+  int pid;
+
+  scstat(names, NSC);
+  drain(-1);  // discard stale records
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "trace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(fork() == 0){
+      trace(mask, TRACE_RING);
+      exec(nargv[0], nargv);
+      fprintf(2, "trace: exec %s failed\n", nargv[0]);
+      exit(1);
+    }
+    wait(0);
+    trace(1 << SYS_trace, TRACE_RING);
+    exit(0);
+  }
+
+  while(!drain(pid))
+    sleep(1);
+  drain(pid);  // records from other cpus' rings
+  wait(0);
+  exit(0);
+}
+
 int
 main(int argc, char *argv[])
 {
-  int i;
+  int i, ring = 0;
   char *nargv[MAXARG];
 
+  if(argc > 1 && strcmp(argv[1], "-r") == 0){
+    ring = 1;
+    argc--;
+    argv++;
+  }
+
   if(argc < 3 || (argv[1][0] < '0' || argv[1][0] > '9')){
-    fprintf(2, "Usage: %s mask command\n", argv[0]);
+    fprintf(2, "Usage: trace [-r] mask command\n");
     exit(1);
   }
 
-  if (trace(atoi(argv[1])) < 0) {
+  for(i = 2; i < argc && i < MAXARG; i++){
+    nargv[i-2] = argv[i];
+  }
+  nargv[i-2] = 0;
+
+  if(ring)
+    ringtrace(atoi(argv[1]), nargv);
+
+  if (trace(atoi(argv[1]), 0) < 0) {
     fprintf(2, "%s: trace failed\n", argv[0]);
     exit(1);
   }
   
-  for(i = 2; i < argc && i < MAXARG; i++){
-    nargv[i-2] = argv[i];
-  }
   exec(nargv[0], nargv);
   exit(0);
 }
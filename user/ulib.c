@@ -3,6 +3,35 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// Set by stdio.c once a stream is in use, to flush output
+// before fork(), exit() and exec(). A pointer, so that programs
+// that don't use stdio don't link it.
+void (*stdioflush)(void);
+
+int
+fork(void)
+{
+  if(stdioflush)
+    stdioflush();
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  if(stdioflush)
+    stdioflush();
+  _exit(status);
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(stdioflush)
+    stdioflush();
+  return _exec(path, argv);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -32,14 +61,37 @@ strlen(const char *s)
   return n;
 }
 
+// memset(), memmove() and memcmp() work a uint64 at a time
+// once the pointers are 8-byte aligned; see kernel/string.c.
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = dst;
+  uint64 w, *wd;
+
+  while(n > 0 && ((uint64)d & 7)){
+    *d++ = c;
+    n--;
+  }
+  if(n >= 8){
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wd = (uint64*)d;
+    for(; n >= 32; n -= 32, wd += 4){
+      wd[0] = w;
+      wd[1] = w;
+      wd[2] = w;
+      wd[3] = w;
+    }
+    for(; n >= 8; n -= 8)
+      *wd++ = w;
+    d = (uchar*)wd;
   }
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -52,24 +104,6 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
@@ -98,17 +132,55 @@ atoi(const char *s)
 void*
 memmove(void *vdst, const void *vsrc, int n)
 {
-  char *dst;
-  const char *src;
+  uchar *dst;
+  const uchar *src;
+  uint64 *wd, w0, w1, w2, w3;
+  const uint64 *ws;
+  int words;
 
   dst = vdst;
   src = vsrc;
+  words = (((uint64)src ^ (uint64)dst) & 7) == 0;
   if (src > dst) {
+    if (words) {
+      while (n > 0 && ((uint64)dst & 7)) {
+        *dst++ = *src++;
+        n--;
+      }
+      ws = (const uint64*)src;
+      wd = (uint64*)dst;
+      for (; n >= 32; n -= 32, ws += 4, wd += 4) {
+        w0 = ws[0]; w1 = ws[1]; w2 = ws[2]; w3 = ws[3];
+        wd[0] = w0; wd[1] = w1; wd[2] = w2; wd[3] = w3;
+      }
+      for (; n >= 8; n -= 8)
+        *wd++ = *ws++;
+      src = (const uchar*)ws;
+      dst = (uchar*)wd;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if (words) {
+      while (n > 0 && ((uint64)dst & 7)) {
+        *--dst = *--src;
+        n--;
+      }
+      ws = (const uint64*)src;
+      wd = (uint64*)dst;
+      for (; n >= 32; n -= 32) {
+        ws -= 4;
+        wd -= 4;
+        w3 = ws[3]; w2 = ws[2]; w1 = ws[1]; w0 = ws[0];
+        wd[3] = w3; wd[2] = w2; wd[1] = w1; wd[0] = w0;
+      }
+      for (; n >= 8; n -= 8)
+        *--wd = *--ws;
+      src = (const uchar*)ws;
+      dst = (uchar*)wd;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -119,6 +191,23 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+
+  if ((((uint64)p1 ^ (uint64)p2) & 7) == 0) {
+    while (n > 0 && ((uint64)p1 & 7)) {
+      if (*p1 != *p2) {
+        return *p1 - *p2;
+      }
+      p1++;
+      p2++;
+      n--;
+    }
+    // the bytes of a differing word are compared below.
+    while (n >= 8 && *(uint64*)p1 == *(uint64*)p2) {
+      p1 += 8;
+      p2 += 8;
+      n -= 8;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -134,3 +223,115 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Locks for threads sharing an address space, or processes
+// sharing a MAP_SHARED page. locked is 0 when free, 1 when
+// held, and 2 when held with waiters, who sleep in futex_wait();
+// taking and releasing a lock nobody waits for makes no system
+// call. After Drepper, "Futexes Are Tricky".
+void
+lock_init(struct lock *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(struct lock *lk)
+{
+  uint c;
+  int spins;
+
+  for(spins = 0; spins < 100; spins++){
+    if((c = __sync_val_compare_and_swap(&lk->locked, 0, 1)) == 0)
+      return;
+    if(c == 2)
+      break;
+  }
+  // mark the lock contended, so that its holder wakes us.
+  while(__atomic_exchange_n(&lk->locked, 2, __ATOMIC_ACQUIRE) != 0)
+    futex_wait(&lk->locked, 2);
+}
+
+void
+lock_release(struct lock *lk)
+{
+  if(__sync_fetch_and_sub(&lk->locked, 1) != 1){
+    __atomic_store_n(&lk->locked, 0, __ATOMIC_RELEASE);
+    futex_wake(&lk->locked, 1);
+  }
+}
+
+#define TSTACK 16384   // bytes of stack per thread
+
+struct thread {
+  void (*fn)(void*);
+  void *arg;
+  char *stack;
+  int tid;
+  struct thread *next;
+};
+
+static struct lock tlock;
+static struct thread *threads;
+
+static void
+threadstart(void *a)
+{
+  struct thread *t = a;
+
+  t->fn(t->arg);
+  _exit(0);
+}
+
+// Run fn(arg) in a new thread sharing this address space and
+// return its id, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct thread *t;
+  int tid;
+
+  if((t = malloc(sizeof(*t))) == 0)
+    return -1;
+  if((t->stack = malloc(TSTACK)) == 0){
+    free(t);
+    return -1;
+  }
+  t->fn = fn;
+  t->arg = arg;
+  lock_acquire(&tlock);
+  if((tid = clone(threadstart, t, t->stack + TSTACK)) < 0){
+    lock_release(&tlock);
+    free(t->stack);
+    free(t);
+    return -1;
+  }
+  t->tid = tid;
+  t->next = threads;
+  threads = t;
+  lock_release(&tlock);
+  return tid;
+}
+
+// Wait for thread tid to finish and free its stack.
+int
+thread_join(int tid)
+{
+  struct thread *t, **tp;
+
+  if(join(tid, 0) < 0)
+    return -1;
+  lock_acquire(&tlock);
+  for(tp = &threads; (t = *tp) != 0; tp = &t->next){
+    if(t->tid == tid){
+      *tp = t->next;
+      break;
+    }
+  }
+  lock_release(&tlock);
+  if(t){
+    free(t->stack);
+    free(t);
+  }
+  return 0;
+}
@@ -3,30 +3,47 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Small blocks, up to NSMALL units including the header, come
+// from segregated free lists, one per size in units, and are
+// carved from a bump-pointer arena when their list is empty;
+// malloc() and free() of a small block are O(1) and small
+// blocks are never coalesced.
+//
+// Larger blocks use the memory allocator by Kernighan and
+// Ritchie, The C programming Language, 2nd ed.  Section 8.7,
+// which also supplies the arenas: a first-fit circular free
+// list, coalesced on free().
+//
+// One lock serializes both, for threads made by clone().
 
 typedef long Align;
 
 union header {
   struct {
     union header *ptr;
-    uint size;
+    uint size;      // in units of sizeof(Header), header included
   } s;
   Align x;
 };
 
 typedef union header Header;
 
+#define NSMALL 32         // largest small block, units (512 bytes)
+#define ARENA  1024       // units taken for each small-block arena
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+static Header *smallfree[NSMALL+1];   // free small blocks by size
+static Header *arenap;                // unused part of the arena
+static uint arenaleft;                // its size in units
+static struct lock mlock;
+
+static void
+lfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,6 +60,23 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  Header *bp;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  lock_acquire(&mlock);
+  if(bp->s.size <= NSMALL){
+    bp->s.ptr = smallfree[bp->s.size];
+    smallfree[bp->s.size] = bp;
+  } else
+    lfree(bp);
+  lock_release(&mlock);
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,35 +90,84 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  lfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// First-fit allocation of nunits > NSMALL units, header included.
+static Header*
+lmalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
   }
   for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
     if(p->s.size >= nunits){
-      if(p->s.size == nunits)
+      // never leave a remnant small enough to be
+      // mistaken for a small block.
+      if(p->s.size - nunits <= NSMALL){
+        nunits = p->s.size;
         prevp->s.ptr = p->s.ptr;
-      else {
+      } else {
         p->s.size -= nunits;
         p += p->s.size;
         p->s.size = nunits;
       }
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+// Carve a small block of nunits from the arena, starting a
+// new arena when this one is used up.
+static Header*
+smallalloc(uint nunits)
+{
+  Header *p;
+
+  if(arenaleft < nunits){
+    // file what is left of the old arena as a small block.
+    if(arenaleft > 0){
+      arenap->s.size = arenaleft;
+      arenap->s.ptr = smallfree[arenaleft];
+      smallfree[arenaleft] = arenap;
+    }
+    if((p = lmalloc(ARENA)) == 0)
+      return 0;
+    arenap = p;
+    arenaleft = p->s.size;
+  }
+  p = arenap;
+  arenap += nunits;
+  arenaleft -= nunits;
+  p->s.size = nunits;
+  return p;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  lock_acquire(&mlock);
+  if(nunits <= NSMALL){
+    if((p = smallfree[nunits]) != 0)
+      smallfree[nunits] = p->s.ptr;
+    else
+      p = smallalloc(nunits);
+  } else
+    p = lmalloc(nunits);
+  lock_release(&mlock);
+  if(p == 0)
+    return 0;
+  return (void*)(p + 1);
+}
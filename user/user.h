@@ -2,17 +2,31 @@ struct stat;
 struct rtcdate;
 
 struct sysinfo;
+struct scstat;
+struct tracerec;
+struct lockstat;
+struct lockbench;
+struct waitstat;
+struct iovec;
+struct dirstat;
+struct ioring;
+struct timespec;
+struct profsample;
+
+struct lock {
+  uint locked;
+};
 
 // system calls
-int fork(void);
-int exit(int) __attribute__((noreturn));
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
 int read(int, void*, int);
 int close(int);
 int kill(int);
-int exec(char*, char**);
+int _exec(char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -25,10 +39,40 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
-int trace(int);
+int trace(int, int);
 int sysinfo(struct sysinfo *);
+int scstat(struct scstat *, int);
+int traceread(struct tracerec *, int);
+int setpriority(int, int);
+int splice(int, int, int);
+int pipe2(int*, int);
+void *mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int dmesg(char*, int);
+int lockstat(struct lockstat*, int, int);
+int lockbench(int, int, struct lockbench*);
+int clone(void (*)(void*), void*, void*);
+int join(int, int*);
+int yield(void);
+int futex_wait(uint*, uint);
+int futex_wake(uint*, int);
+int spawn(char*, char**, int*);
+int clock_gettime(int, struct timespec*);
+int profctl(int);
+int profread(struct profsample*, int);
+int waitstat(struct waitstat*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int fsync(int);
+int ioring_enter(struct ioring*);
+int mount(char*, char*);
+int getdents(int, struct dirstat*, int);
 
 // ulib.c
+extern void (*stdioflush)(void);
+int fork(void);
+int exit(int) __attribute__((noreturn));
+int exec(char*, char**);
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
@@ -36,7 +80,6 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
@@ -44,3 +87,24 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void lock_init(struct lock*);
+void lock_acquire(struct lock*);
+void lock_release(struct lock*);
+int thread_create(void (*)(void*), void*);
+int thread_join(int);
+
+// stdio.c
+typedef struct iobuf FILE;
+extern FILE *stdin, *stdout, *stderr;
+FILE* fopen(const char*, const char*);
+FILE* fdopen(int, const char*);
+int fclose(FILE*);
+int fflush(FILE*);
+int fgetc(FILE*);
+char* fgets(char*, int, FILE*);
+int fread(void*, int, int, FILE*);
+int fputc(int, FILE*);
+int fputs(const char*, FILE*);
+int fwrite(const void*, int, int, FILE*);
+FILE* fdstream(int);
+char* gets(char*, int max);
@@ -1,8 +1,13 @@
 #include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/time.h"
+#include "kernel/uio.h"
+#include "kernel/ioring.h"
 #include "user/user.h"
 #include "kernel/fs.h"
+#include "kernel/dirstat.h"
+#include "kernel/sysinfo.h"
 #include "kernel/fcntl.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
@@ -1479,6 +1484,483 @@ bigdir(char *s)
   }
 }
 
+// a small file, kept in its dinode, grows out of it and
+// back in again without losing a byte.
+void
+inlinefile(char *s)
+{
+  static char data[3*NINLINE], back[sizeof(data)];
+  struct stat st;
+  int fd, i, n;
+
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = 'A' + i % 26;
+  unlink("inl");
+  fd = open("inl", O_CREATE|O_RDWR);
+  // up to NINLINE, in pieces; then past it.
+  if(fd < 0 || write(fd, data, 10) != 10 || write(fd, data + 10, NINLINE - 10) != NINLINE - 10){
+    printf("%s: small writes failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inl", O_RDWR);
+  if(read(fd, back, sizeof(back)) != NINLINE || memcmp(back, data, NINLINE) != 0){
+    printf("%s: inline data read back wrong\n", s);
+    exit(1);
+  }
+  if(write(fd, data + NINLINE, sizeof(data) - NINLINE) != sizeof(data) - NINLINE){
+    printf("%s: growing write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inl", O_RDONLY);
+  n = read(fd, back, sizeof(back));
+  if(n != sizeof(data) || memcmp(back, data, sizeof(data)) != 0 || fstat(fd, &st) < 0 ||
+     st.size != sizeof(data)){
+    printf("%s: grown file read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("inl", O_TRUNC|O_RDWR);
+  if(fd < 0 || write(fd, "tiny", 4) != 4){
+    printf("%s: rewrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("inl", O_RDONLY);
+  if(read(fd, back, sizeof(back)) != 4 || memcmp(back, "tiny", 4) != 0){
+    printf("%s: truncated file read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("inl");
+}
+
+// file data read through the page cache stays in step with
+// writes that straddle pages, with truncation, and with a file
+// that is removed and created again under the same name.
+void
+pagecache(char *s)
+{
+  static char data[3*4096+100], back[sizeof(data)];
+  int fd, i, pass;
+
+  for(pass = 0; pass < 2; pass++){
+    for(i = 0; i < sizeof(data); i++)
+      data[i] = 'a' + (i / 7 + pass) % 26;
+    unlink("pgc");
+    fd = open("pgc", O_CREATE|O_RDWR);
+    if(fd < 0 || write(fd, data, sizeof(data)) != sizeof(data)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    fd = open("pgc", O_RDWR);
+    if(read(fd, back, sizeof(back)) != sizeof(data) || memcmp(back, data, sizeof(data)) != 0){
+      printf("%s: read back wrong\n", s);
+      exit(1);
+    }
+    // overwrite across the first page boundary, with the
+    // pages now cached.
+    memset(data + 4000, 'Z', 200);
+    close(fd);
+    fd = open("pgc", O_RDWR);
+    read(fd, back, 4000);
+    if(write(fd, data + 4000, 200) != 200){
+      printf("%s: overwrite failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    fd = open("pgc", O_RDONLY);
+    if(read(fd, back, sizeof(back)) != sizeof(data) || memcmp(back, data, sizeof(data)) != 0){
+      printf("%s: overwritten data read back wrong\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  fd = open("pgc", O_TRUNC|O_RDWR);
+  if(fd < 0 || write(fd, data, 5000) != 5000){
+    printf("%s: rewrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("pgc", O_RDONLY);
+  if(read(fd, back, sizeof(back)) != 5000 || memcmp(back, data, 5000) != 0){
+    printf("%s: truncated file read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pgc");
+}
+
+// a program file can't be written or truncated while a process
+// runs it, whose pages not read in yet would come from the new
+// contents, and can be again once it exits.
+void
+textbusy(char *s)
+{
+  static char buf[1024];
+  int fd, fd2, n, pid, xstatus, in[2], out[2];
+  char *argv[] = { "tbsh", 0 };
+
+  fd = open("sh", O_RDONLY);
+  fd2 = open("tbsh", O_CREATE|O_WRONLY);
+  if(fd < 0 || fd2 < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(fd2, buf, n) != n){
+      printf("%s: copy failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  close(fd2);
+
+  if(pipe(in) != 0 || pipe(out) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // the shell reads commands from in, and prompts on out.
+    close(0);
+    dup(in[0]);
+    close(2);
+    dup(out[1]);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    exec("tbsh", argv);
+    exit(1);
+  }
+  close(in[0]);
+  close(out[1]);
+  if(read(out[0], buf, 1) != 1){
+    printf("%s: no prompt\n", s);
+    exit(1);
+  }
+  fd = open("tbsh", O_WRONLY);
+  if(fd < 0 || write(fd, "x", 1) > 0 || open("tbsh", O_WRONLY|O_TRUNC) >= 0){
+    printf("%s: wrote a running program\n", s);
+    exit(1);
+  }
+  close(in[1]);  // the shell exits at end of input
+  wait(&xstatus);
+  close(out[0]);
+  if(write(fd, "x", 1) != 1){
+    printf("%s: write after exit failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("tbsh");
+}
+
+// files on the tmpfs that init mounts on /tmp: data reads
+// back, paths cross the mount point both ways, and nothing
+// links across it or removes it.
+void
+tmpfs(char *s)
+{
+  static char data[2*4096+100], back[sizeof(data)];
+  struct stat root, st;
+  int fd, i;
+
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = 'a' + i % 23;
+  if(stat("/", &root) < 0 || stat("/tmp", &st) < 0 || st.type != T_DIR || st.dev == root.dev){
+    printf("%s: /tmp is not a tmpfs\n", s);
+    exit(1);
+  }
+  fd = open("/tmp/tf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, sizeof(data)) != sizeof(data)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("/tmp/tf", O_RDONLY);
+  if(read(fd, back, sizeof(back)) != sizeof(data) || memcmp(back, data, sizeof(data)) != 0){
+    printf("%s: read back wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(mkdir("/tmp/td") < 0 || chdir("/tmp/td") < 0){
+    printf("%s: mkdir/chdir failed\n", s);
+    exit(1);
+  }
+  if((fd = open("../tf", O_RDONLY)) < 0){
+    printf("%s: open ../tf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(chdir("../..") < 0 || stat(".", &st) < 0 || st.dev != root.dev || st.ino != root.ino){
+    printf("%s: .. does not leave the tmpfs\n", s);
+    exit(1);
+  }
+
+  if(link("/tmp/tf", "tflink") == 0){
+    printf("%s: link across the mount point worked\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp") == 0){
+    printf("%s: unlinked the mount point\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tf") < 0 || unlink("/tmp/td") < 0 || open("/tmp/tf", O_RDONLY) >= 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+}
+
+// getdents() lists every entry of a directory once, each with
+// the stat of the file it names, and fails on a plain file.
+void
+getdentstest(char *s)
+{
+  enum { N = 40 };
+  static struct dirstat ds[NGETDENTS];
+  char name[8], seen[N];
+  int i, j, n, fd, total = 0;
+
+  if(mkdir("gdd") < 0 || chdir("gdd") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[0] = 'f';
+    name[1] = '0' + i / 10;
+    name[2] = '0' + i % 10;
+    name[3] = 0;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0 || write(fd, name, i) != i){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  memset(seen, 0, sizeof(seen));
+  fd = open(".", O_RDONLY);
+  while((n = getdents(fd, ds, NGETDENTS)) > 0){
+    for(j = 0; j < n; j++){
+      total++;
+      if(ds[j].name[0] != 'f')
+        continue;
+      i = (ds[j].name[1] - '0') * 10 + ds[j].name[2] - '0';
+      if(i < 0 || i >= N || seen[i]++ || ds[j].st.type != T_FILE || ds[j].st.size != i){
+        printf("%s: bad entry %s\n", s, ds[j].name);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(n < 0 || total != N + 2){
+    printf("%s: getdents returned %d entries\n", s, total);
+    exit(1);
+  }
+  fd = open("f01", O_RDONLY);
+  if(getdents(fd, ds, NGETDENTS) >= 0){
+    printf("%s: getdents on a file worked\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 10;
+    name[2] = '0' + i % 10;
+    unlink(name);
+  }
+  if(chdir("..") < 0 || unlink("gdd") < 0){
+    printf("%s: cleanup failed\n", s);
+    exit(1);
+  }
+}
+
+// a heap bigger than free memory works by way of swap, and
+// reads back intact, also in a child of fork() that shares
+// the swapped-out pages.
+void
+swaptest(char *s)
+{
+  enum { EXTRA = 1280 };  // pages more than are free
+  struct sysinfo info;
+  uint64 n, i, out;
+  char *a;
+  int pid, xstatus;
+
+  if(sysinfo(&info) < 0 || info.version != SYSINFO_VERSION){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(info.swappages < 3*EXTRA)
+    return;  // not enough swap to try
+  out = info.stat[ST_SWAPOUT];
+  n = info.freemem / PGSIZE + EXTRA;
+  if((a = sbrk(n * PGSIZE)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    *(uint64*)(a + i*PGSIZE) = i;
+  for(i = 0; i < n; i++){
+    if(*(uint64*)(a + i*PGSIZE) != i){
+      printf("%s: page %d read back wrong\n", s, i);
+      exit(1);
+    }
+  }
+  if(sysinfo(&info) < 0 || info.stat[ST_SWAPOUT] == out){
+    printf("%s: nothing was swapped out\n", s);
+    exit(1);
+  }
+
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i++)
+      if(*(uint64*)(a + i*PGSIZE) != i)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child read pages back wrong\n", s);
+    exit(1);
+  }
+  sbrk(-(n * PGSIZE));
+}
+
+// write() and read() on a pipe copy under the pipe's lock,
+// where a swapped-out page can't be read back: each transfer
+// still moves its whole count, from one such page to another.
+void
+swappipe(char *s)
+{
+  enum { EXTRA = 1280 };  // pages more than are free
+  struct sysinfo info;
+  uint64 n, i, in;
+  char *a;
+  int fds[2];
+
+  if(sysinfo(&info) < 0 || info.version != SYSINFO_VERSION){
+    printf("%s: sysinfo failed\n", s);
+    exit(1);
+  }
+  if(info.swappages < 3*EXTRA)
+    return;  // not enough swap to try
+  n = info.freemem / PGSIZE + EXTRA;
+  if((a = sbrk(n * PGSIZE)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    *(uint64*)(a + i*PGSIZE) = i;
+  sysinfo(&info);
+  in = info.stat[ST_SWAPIN];
+  for(i = 0; i < n; i++){
+    if(write(fds[1], a + i*PGSIZE, 8) != 8){
+      printf("%s: write from page %d failed\n", s, i);
+      exit(1);
+    }
+    if(read(fds[0], a + (i+1)%n*PGSIZE + 8, 8) != 8){
+      printf("%s: read into page %d failed\n", s, (i+1)%n);
+      exit(1);
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(*(uint64*)(a + i*PGSIZE + 8) != (i+n-1)%n){
+      printf("%s: page %d read back wrong\n", s, i);
+      exit(1);
+    }
+  }
+  if(sysinfo(&info) < 0 || info.stat[ST_SWAPIN] == in){
+    printf("%s: nothing was swapped in\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-(n * PGSIZE));
+}
+
+// a directory big enough to need its hash chains: every name
+// is found, reading it shows each entry once, and it can be
+// removed when empty again.
+void
+hashdir(char *s)
+{
+  enum { N = 400 };
+  struct dirent de;
+  char name[8];
+  int i, fd, n;
+
+  if(mkdir("hd") != 0 || chdir("hd") != 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[0] = 'h';
+    name[1] = '0' + i / 100;
+    name[2] = '0' + i / 10 % 10;
+    name[3] = '0' + i % 10;
+    name[4] = '\0';
+    if((fd = open(name, O_CREATE|O_WRONLY)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+  for(i = N - 1; i >= 0; i -= 7){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + i / 10 % 10;
+    name[3] = '0' + i % 10;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  fd = open(".", O_RDONLY);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != N + 2){
+    printf("%s: read %d entries, not %d\n", s, n, N + 2);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i / 100;
+    name[2] = '0' + i / 10 % 10;
+    name[3] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(open("h000", O_RDONLY) >= 0){
+    printf("%s: unlinked h000 still there\n", s);
+    exit(1);
+  }
+  if(chdir("..") != 0 || unlink("hd") != 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -1710,245 +2192,968 @@ bigfile(char *s)
     printf("%s: cannot open bigfile\n", s);
     exit(1);
   }
-  total = 0;
-  for(i = 0; ; i++){
-    cc = read(fd, buf, SZ/2);
-    if(cc < 0){
-      printf("%s: read bigfile failed\n", s);
+  total = 0;
+  for(i = 0; ; i++){
+    cc = read(fd, buf, SZ/2);
+    if(cc < 0){
+      printf("%s: read bigfile failed\n", s);
+      exit(1);
+    }
+    if(cc == 0)
+      break;
+    if(cc != SZ/2){
+      printf("%s: short read bigfile\n", s);
+      exit(1);
+    }
+    if(buf[0] != i/2 || buf[SZ/2-1] != i/2){
+      printf("%s: read bigfile wrong data\n", s);
+      exit(1);
+    }
+    total += cc;
+  }
+  close(fd);
+  if(total != N*SZ){
+    printf("%s: read bigfile wrong total\n", s);
+    exit(1);
+  }
+  unlink("bigfile.dat");
+}
+
+void
+fourteen(char *s)
+{
+  int fd;
+
+  // DIRSIZ is 14.
+
+  if(mkdir("12345678901234") != 0){
+    printf("%s: mkdir 12345678901234 failed\n", s);
+    exit(1);
+  }
+  if(mkdir("12345678901234/123456789012345") != 0){
+    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+    exit(1);
+  }
+  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  if(fd < 0){
+    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  if(fd < 0){
+    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(mkdir("12345678901234/12345678901234") == 0){
+    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+    exit(1);
+  }
+  if(mkdir("123456789012345/12345678901234") == 0){
+    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+    exit(1);
+  }
+
+  // clean up
+  unlink("123456789012345/12345678901234");
+  unlink("12345678901234/12345678901234");
+  unlink("12345678901234/12345678901234/12345678901234");
+  unlink("123456789012345/123456789012345/123456789012345");
+  unlink("12345678901234/123456789012345");
+  unlink("12345678901234");
+}
+
+void
+rmdot(char *s)
+{
+  if(mkdir("dots") != 0){
+    printf("%s: mkdir dots failed\n", s);
+    exit(1);
+  }
+  if(chdir("dots") != 0){
+    printf("%s: chdir dots failed\n", s);
+    exit(1);
+  }
+  if(unlink(".") == 0){
+    printf("%s: rm . worked!\n", s);
+    exit(1);
+  }
+  if(unlink("..") == 0){
+    printf("%s: rm .. worked!\n", s);
+    exit(1);
+  }
+  if(chdir("/") != 0){
+    printf("%s: chdir / failed\n", s);
+    exit(1);
+  }
+  if(unlink("dots/.") == 0){
+    printf("%s: unlink dots/. worked!\n", s);
+    exit(1);
+  }
+  if(unlink("dots/..") == 0){
+    printf("%s: unlink dots/.. worked!\n", s);
+    exit(1);
+  }
+  if(unlink("dots") != 0){
+    printf("%s: unlink dots failed!\n", s);
+    exit(1);
+  }
+}
+
+void
+dirfile(char *s)
+{
+  int fd;
+
+  fd = open("dirfile", O_CREATE);
+  if(fd < 0){
+    printf("%s: create dirfile failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(chdir("dirfile") == 0){
+    printf("%s: chdir dirfile succeeded!\n", s);
+    exit(1);
+  }
+  fd = open("dirfile/xx", 0);
+  if(fd >= 0){
+    printf("%s: create dirfile/xx succeeded!\n", s);
+    exit(1);
+  }
+  fd = open("dirfile/xx", O_CREATE);
+  if(fd >= 0){
+    printf("%s: create dirfile/xx succeeded!\n", s);
+    exit(1);
+  }
+  if(mkdir("dirfile/xx") == 0){
+    printf("%s: mkdir dirfile/xx succeeded!\n", s);
+    exit(1);
+  }
+  if(unlink("dirfile/xx") == 0){
+    printf("%s: unlink dirfile/xx succeeded!\n", s);
+    exit(1);
+  }
+  if(link("README", "dirfile/xx") == 0){
+    printf("%s: link to dirfile/xx succeeded!\n", s);
+    exit(1);
+  }
+  if(unlink("dirfile") != 0){
+    printf("%s: unlink dirfile failed!\n", s);
+    exit(1);
+  }
+
+  fd = open(".", O_RDWR);
+  if(fd >= 0){
+    printf("%s: open . for writing succeeded!\n", s);
+    exit(1);
+  }
+  fd = open(".", 0);
+  if(write(fd, "x", 1) > 0){
+    printf("%s: write . succeeded!\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// test that iput() is called at the end of _namei().
+// also tests empty file names.
+void
+iref(char *s)
+{
+  int i, fd;
+
+  for(i = 0; i < NINODE + 1; i++){
+    if(mkdir("irefd") != 0){
+      printf("%s: mkdir irefd failed\n", s);
+      exit(1);
+    }
+    if(chdir("irefd") != 0){
+      printf("%s: chdir irefd failed\n", s);
+      exit(1);
+    }
+
+    mkdir("");
+    link("README", "");
+    fd = open("", O_CREATE);
+    if(fd >= 0)
+      close(fd);
+    fd = open("xx", O_CREATE);
+    if(fd >= 0)
+      close(fd);
+    unlink("xx");
+  }
+
+  // clean up
+  for(i = 0; i < NINODE + 1; i++){
+    chdir("..");
+    unlink("irefd");
+  }
+
+  chdir("/");
+}
+
+// test that fork fails gracefully
+// the forktest binary also does this, but it runs out of proc entries first.
+// inside the bigger usertests binary, we run out of memory first.
+void
+forktest(char *s)
+{
+  enum{ N = 1000 };
+  int n, pid;
+
+  for(n=0; n<N; n++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0)
+      exit(0);
+  }
+
+  if (n == 0) {
+    printf("%s: no fork at all!\n", s);
+    exit(1);
+  }
+
+  if(n == N){
+    printf("%s: fork claimed to work 1000 times!\n", s);
+    exit(1);
+  }
+
+  for(; n > 0; n--){
+    if(wait(0) < 0){
+      printf("%s: wait stopped early\n", s);
+      exit(1);
+    }
+  }
+
+  if(wait(0) != -1){
+    printf("%s: wait got too many\n", s);
+    exit(1);
+  }
+}
+
+// fork a process holding two thirds of physical memory.
+// only works if fork() shares pages copy-on-write.
+void
+cowfork(char *s)
+{
+  uint64 sz = ((PHYSTOP - KERNBASE) / 3) * 2;
+  int ppid = getpid();
+  int pid, xstatus;
+  char *p, *q;
+
+  p = sbrk(sz);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(%p) failed\n", s, sz);
+    exit(1);
+  }
+  for(q = p; q < p + sz; q += 4096)
+    *(int*)q = ppid;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(q = p; q < p + sz; q += 4096){
+      if(*(int*)q != ppid){
+        printf("%s: child sees wrong value\n", s);
+        exit(1);
+      }
+    }
+    // break sharing on every other page.
+    for(q = p; q < p + sz; q += 2*4096)
+      *(int*)q = getpid();
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  for(q = p; q < p + sz; q += 4096){
+    if(*(int*)q != ppid){
+      printf("%s: child write visible in parent\n", s);
+      exit(1);
+    }
+  }
+  if(sbrk(-sz) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk(-%p) failed\n", s, sz);
+    exit(1);
+  }
+}
+
+// system calls handed pointers into heap that sbrk() reserved
+// but that the program never touched must fault those pages in.
+void
+lazycopy(char *s)
+{
+  int fds[2], i;
+  char *p;
+
+  p = sbrk(10*4096);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  // copyin() from an untouched page, which reads as zeros.
+  if(write(fds[1], p + 3*4096, 16) != 16){
+    printf("%s: write from lazy page failed\n", s);
+    exit(1);
+  }
+  // copyout() to an untouched page.
+  p[7*4096] = 'x';
+  if(read(fds[0], p + 8*4096 - 8, 16) != 16){
+    printf("%s: read into lazy page failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 16; i++){
+    if(p[8*4096 - 8 + i] != 0){
+      printf("%s: lazy page not zeroed\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-10*4096);
+}
+
+// mmap() a file privately and shared; pages past the end of
+// the file read as zeros, shared writes reach the file, and a
+// fork child sees the parent's mappings, with what the parent
+// wrote to private ones, and writes to them apart from it.
+void
+mmaptest(char *s)
+{
+  enum { N = 2*4096 + 100 };
+  static char buf[N];
+  int fd, fd2, i, pid, xstatus;
+  char *p;
+
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 23;
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, 3*4096, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*4096; i++){
+    if(p[i] != (i < N ? 'a' + i % 23 : 0)){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exit(p[4096] != 'a' + 4096 % 23);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong mapping\n", s);
+    exit(1);
+  }
+  if(munmap(p, 3*4096) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: private mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 'P';
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[0] != 'P')
+      exit(1);
+    p[0] = 'C';
+    // and a write by the kernel, through copyout().
+    fd2 = open("mmapfile", O_RDONLY);
+    if(fd2 < 0 || read(fd2, p + 1, 2) != 2 || p[1] != 'a' || p[2] != 'b')
+      exit(1);
+    exit(0);
+  }
+  p[1] = 'Q';
+  wait(&xstatus);
+  if(xstatus != 0 || p[0] != 'P' || p[1] != 'Q' || p[2] != 'a' + 2){
+    printf("%s: private mapping not copied on fork\n", s);
+    exit(1);
+  }
+  if(munmap(p, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: shared mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 'X';
+  p[N-1] = 'Y';
+  if(munmap(p, 4096) < 0){
+    printf("%s: shared munmap failed\n", s);
+    exit(1);
+  }
+  // read() into a mapped page that has not been touched yet.
+  fd2 = open("mmapfile", O_RDONLY);
+  if(fd2 < 0 || read(fd2, p + 4096, 100) != 100){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+  close(fd2);
+  if(munmap(p + 4096, 2*4096) < 0){
+    printf("%s: shared munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, N) != N || buf[0] != 'X' || buf[N-1] != 'Y' ||
+     buf[4096] != 'X' || buf[4097] != 'b' || read(fd, buf, 1) != 0){
+    printf("%s: shared writes lost\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+}
+
+enum { NTHR = 4, TITERS = 1000 };
+static struct lock tcountlock;
+static int tcount;
+static char *tbufs[NTHR];
+
+static void
+threadfn(void *arg)
+{
+  int i, id = (int)(uint64)arg;
+  char *p;
+
+  for(i = 0; i < TITERS; i++){
+    lock_acquire(&tcountlock);
+    tcount++;
+    lock_release(&tcountlock);
+    if((p = malloc(64 + i % 200)) == 0)
+      _exit(1);
+    p[0] = id;
+    free(p);
+  }
+  // left for the main thread to read: the threads share memory.
+  tbufs[id] = malloc(100);
+  if(tbufs[id])
+    memset(tbufs[id], 'a' + id, 100);
+}
+
+// clone()d threads share memory and the heap, and join() waits
+// for each.
+void
+threadtest(char *s)
+{
+  int i, j, tids[NTHR];
+
+  lock_init(&tcountlock);
+  tcount = 0;
+  for(i = 0; i < NTHR; i++){
+    tids[i] = thread_create(threadfn, (void*)(uint64)i);
+    if(tids[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NTHR; i++){
+    if(thread_join(tids[i]) < 0){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+  }
+  if(tcount != NTHR*TITERS){
+    printf("%s: count %d, want %d\n", s, tcount, NTHR*TITERS);
+    exit(1);
+  }
+  for(i = 0; i < NTHR; i++){
+    if(tbufs[i] == 0){
+      printf("%s: thread %d malloc failed\n", s, i);
+      exit(1);
+    }
+    for(j = 0; j < 100; j++){
+      if(tbufs[i][j] != 'a' + i){
+        printf("%s: thread %d memory not shared\n", s, i);
+        exit(1);
+      }
+    }
+    free(tbufs[i]);
+  }
+  if(join(0, 0) >= 0){
+    printf("%s: join with no threads succeeded\n", s);
+    exit(1);
+  }
+}
+
+static uint fword;
+
+static void
+futexfn(void *arg)
+{
+  while(fword == 0)
+    futex_wait(&fword, 0);
+}
+
+// futex_wait() returns at once if the word has changed, and
+// sleeps until futex_wake() otherwise, also when a fork() while
+// it sleeps makes the word's page copy-on-write, or memory
+// pressure swaps the page out.
+void
+futextest(char *s)
+{
+  enum { EXTRA = 1280 };  // pages more than are free
+  struct sysinfo info;
+  uint64 n, i;
+  char *a;
+  int tid, pid, pass;
+
+  fword = 1;
+  if(futex_wait(&fword, 0) >= 0){
+    printf("%s: futex_wait slept on a changed word\n", s);
+    exit(1);
+  }
+  if(futex_wake(&fword, 1) != 0){
+    printf("%s: futex_wake woke a waiter\n", s);
+    exit(1);
+  }
+  for(pass = 0; pass < 3; pass++){
+    fword = 0;
+    if((tid = thread_create(futexfn, 0)) < 0){
+      printf("%s: thread_create failed\n", s);
       exit(1);
     }
-    if(cc == 0)
-      break;
-    if(cc != SZ/2){
-      printf("%s: short read bigfile\n", s);
-      exit(1);
+    sleep(1);
+    if(pass == 1){
+      if((pid = fork()) < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
     }
-    if(buf[0] != i/2 || buf[SZ/2-1] != i/2){
-      printf("%s: read bigfile wrong data\n", s);
+    if(pass == 2 && sysinfo(&info) == 0 && info.swappages >= 3*EXTRA){
+      n = info.freemem / PGSIZE + EXTRA;
+      if((a = sbrk(n * PGSIZE)) == (char*)-1){
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+      }
+      for(i = 0; i < n; i++)
+        a[i*PGSIZE] = 1;
+      sbrk(-(n * PGSIZE));
+    }
+    fword = 1;
+    futex_wake(&fword, 1);
+    if(thread_join(tid) < 0){
+      printf("%s: thread_join failed\n", s);
       exit(1);
     }
-    total += cc;
-  }
-  close(fd);
-  if(total != N*SZ){
-    printf("%s: read bigfile wrong total\n", s);
-    exit(1);
   }
-  unlink("bigfile.dat");
 }
 
+// clock_gettime() moves forward, in whole nanoseconds.
 void
-fourteen(char *s)
+clocktest(char *s)
 {
-  int fd;
-
-  // DIRSIZ is 14.
+  struct timespec a, b;
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
+  if(clock_gettime(CLOCK_MONOTONIC, &a) < 0){
+    printf("%s: clock_gettime failed\n", s);
     exit(1);
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  sleep(1);
+  if(clock_gettime(CLOCK_MONOTONIC, &b) < 0){
+    printf("%s: clock_gettime failed\n", s);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
-  if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+  if(a.nsec >= 1000000000 || b.nsec >= 1000000000 ||
+     b.sec < a.sec || (b.sec == a.sec && b.nsec <= a.nsec)){
+    printf("%s: clock went from %l.%l to %l.%l\n", s, a.sec, a.nsec, b.sec, b.nsec);
     exit(1);
   }
-  close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  if(clock_gettime(-1, &a) >= 0 || clock_gettime(CLOCK_MONOTONIC, 0) >= 0){
+    printf("%s: bad clock_gettime succeeded\n", s);
+    exit(1);
+  }
+}
+
+// writev() and readv() move scattered buffers as one,
+// including segments that span several log transactions.
+void
+iovtest(char *s)
+{
+  static char big[3*BSIZE+17], back[sizeof(big)];
+  char hdr[5], hback[5];
+  struct iovec iov[3];
+  int fd, i, n;
+
+  for(i = 0; i < sizeof(big); i++)
+    big[i] = 'a' + i % 23;
+  memmove(hdr, "head:", 5);
+  iov[0].base = (uint64)hdr;
+  iov[0].len = 5;
+  iov[1].base = (uint64)big;
+  iov[1].len = 0;
+  iov[2].base = (uint64)big;
+  iov[2].len = sizeof(big);
+  fd = open("iovfile", O_CREATE|O_RDWR);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: create iovfile failed\n", s);
+    exit(1);
+  }
+  if((n = writev(fd, iov, 3)) != 5 + sizeof(big)){
+    printf("%s: writev returned %d\n", s, n);
     exit(1);
   }
   close(fd);
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+  fd = open("iovfile", O_RDONLY);
+  iov[0].base = (uint64)hback;
+  iov[1].base = (uint64)back;
+  iov[1].len = sizeof(back);
+  iov[2].base = (uint64)back;
+  if((n = readv(fd, iov, 3)) != 5 + sizeof(back)){
+    printf("%s: readv returned %d\n", s, n);
     exit(1);
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  close(fd);
+  unlink("iovfile");
+  if(memcmp(hback, hdr, 5) != 0 || memcmp(back, big, sizeof(big)) != 0){
+    printf("%s: readv got the wrong data\n", s);
     exit(1);
   }
 
-  // clean up
-  unlink("123456789012345/12345678901234");
-  unlink("12345678901234/12345678901234");
-  unlink("12345678901234/12345678901234/12345678901234");
-  unlink("123456789012345/123456789012345/123456789012345");
-  unlink("12345678901234/123456789012345");
-  unlink("12345678901234");
+  if(writev(1, iov, NIOV+1) >= 0 || writev(1, (struct iovec*)0xffffffffff, 1) >= 0){
+    printf("%s: bad writev succeeded\n", s);
+    exit(1);
+  }
+}
+
+static void
+ioqueue(struct ioring *r, int op, int fd, void *addr, int len)
+{
+  struct iosqe *e = &r->sq[r->sqtail % NIORING];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->len = len;
+  e->data = r->sqtail;
+  r->sqtail++;
 }
 
+// a batch of requests through ioring_enter(), each of which
+// may use the descriptor an earlier one opened.
 void
-rmdot(char *s)
+ioringtest(char *s)
 {
-  if(mkdir("dots") != 0){
-    printf("%s: mkdir dots failed\n", s);
-    exit(1);
-  }
-  if(chdir("dots") != 0){
-    printf("%s: chdir dots failed\n", s);
-    exit(1);
-  }
-  if(unlink(".") == 0){
-    printf("%s: rm . worked!\n", s);
+  static struct ioring r;
+  int want[8] = { 4, 4, 4, 4, 0, 0, 0, -1 };
+  char buf[16];
+  int fd, i, n;
+
+  fd = open("iofile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iofile failed\n", s);
     exit(1);
   }
-  if(unlink("..") == 0){
-    printf("%s: rm .. worked!\n", s);
+  for(i = 0; i < 4; i++)
+    ioqueue(&r, IO_WRITE, fd, "ring", 4);
+  ioqueue(&r, IO_FSYNC, fd, 0, 0);
+  ioqueue(&r, IO_CLOSE, fd, 0, 0);
+  ioqueue(&r, IO_OPEN, 0, "iofile", O_RDONLY);
+  ioqueue(&r, IO_READ, 99, buf, sizeof(buf));
+  if((n = ioring_enter(&r)) != 8 || r.sqhead != 8 || r.cqtail != 8){
+    printf("%s: ioring_enter completed %d\n", s, n);
     exit(1);
   }
-  if(chdir("/") != 0){
-    printf("%s: chdir / failed\n", s);
-    exit(1);
+  // the open gets the descriptor the close freed.
+  want[6] = fd;
+  for(i = 0; i < 8; i++){
+    if(r.cq[i].data != i || r.cq[i].res != want[i]){
+      printf("%s: completion %d: %d\n", s, i, r.cq[i].res);
+      exit(1);
+    }
   }
-  if(unlink("dots/.") == 0){
-    printf("%s: unlink dots/. worked!\n", s);
+  r.cqhead = r.cqtail;
+
+  ioqueue(&r, IO_READ, fd, buf, sizeof(buf));
+  ioqueue(&r, IO_CLOSE, fd, 0, 0);
+  if(ioring_enter(&r) != 2 || r.cq[8].res != 16 || r.cq[9].res != 0 ||
+     memcmp(buf, "ringringringring", 16) != 0){
+    printf("%s: read back through the ring failed\n", s);
     exit(1);
   }
-  if(unlink("dots/..") == 0){
-    printf("%s: unlink dots/.. worked!\n", s);
+  r.cqhead = r.cqtail;
+  unlink("iofile");
+
+  // a full completion queue holds requests back.
+  for(i = 0; i < NIORING; i++)
+    ioqueue(&r, IO_CLOSE, -1, 0, 0);
+  r.cqhead -= 1;
+  if(ioring_enter(&r) != NIORING - 1 || r.sqhead != r.sqtail - 1){
+    printf("%s: ioring_enter overran the completion queue\n", s);
     exit(1);
   }
-  if(unlink("dots") != 0){
-    printf("%s: unlink dots failed!\n", s);
+  if(ioring_enter((struct ioring*)0xffffffffff) >= 0){
+    printf("%s: ioring_enter on a bad ring succeeded\n", s);
     exit(1);
   }
 }
 
+// spawn() runs a program with the descriptors it is given.
 void
-dirfile(char *s)
+spawntest(char *s)
 {
-  int fd;
+  char *args[] = { "echo", "spawned", 0 };
+  char buf[32];
+  int fds[2], sfds[3], i, n, xstatus;
 
-  fd = open("dirfile", O_CREATE);
-  if(fd < 0){
-    printf("%s: create dirfile failed\n", s);
-    exit(1);
-  }
-  close(fd);
-  if(chdir("dirfile") == 0){
-    printf("%s: chdir dirfile succeeded!\n", s);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
     exit(1);
   }
-  fd = open("dirfile/xx", 0);
-  if(fd >= 0){
-    printf("%s: create dirfile/xx succeeded!\n", s);
+  sfds[0] = -1;
+  sfds[1] = fds[1];
+  sfds[2] = 2;
+  if(spawn("echo", args, sfds) < 0){
+    printf("%s: spawn failed\n", s);
     exit(1);
   }
-  fd = open("dirfile/xx", O_CREATE);
-  if(fd >= 0){
-    printf("%s: create dirfile/xx succeeded!\n", s);
+  close(fds[1]);
+  n = 0;
+  while(n < sizeof(buf) && (i = read(fds[0], buf + n, sizeof(buf) - n)) > 0)
+    n += i;
+  close(fds[0]);
+  wait(&xstatus);
+  if(n != 8 || memcmp(buf, "spawned\n", 8) != 0 || xstatus != 0){
+    printf("%s: wrong output from spawned echo\n", s);
     exit(1);
   }
-  if(mkdir("dirfile/xx") == 0){
-    printf("%s: mkdir dirfile/xx succeeded!\n", s);
+  if(spawn("nosuchprogram", args, 0) >= 0){
+    printf("%s: spawned a missing program\n", s);
     exit(1);
   }
-  if(unlink("dirfile/xx") == 0){
-    printf("%s: unlink dirfile/xx succeeded!\n", s);
+  sfds[0] = 15;
+  if(spawn("echo", args, sfds) >= 0){
+    printf("%s: spawn with a bad descriptor succeeded\n", s);
     exit(1);
   }
-  if(link("README", "dirfile/xx") == 0){
-    printf("%s: link to dirfile/xx succeeded!\n", s);
+}
+
+// pipe2() rings hold at least the size asked for.
+void
+pipe2test(char *s)
+{
+  enum { N = 3*4096 };
+  static char buf[N];
+  int fds[2], i, n, tot;
+
+  if(pipe2(fds, -1) >= 0 || pipe2(fds, 1024*1024) >= 0){
+    printf("%s: pipe2 accepted a bad size\n", s);
     exit(1);
   }
-  if(unlink("dirfile") != 0){
-    printf("%s: unlink dirfile failed!\n", s);
+  if(pipe2(fds, N) < 0){
+    printf("%s: pipe2 failed\n", s);
     exit(1);
   }
-
-  fd = open(".", O_RDWR);
-  if(fd >= 0){
-    printf("%s: open . for writing succeeded!\n", s);
+  for(i = 0; i < N; i++)
+    buf[i] = i % 199;
+  // fits in the ring, so must not block with no reader running.
+  if(write(fds[1], buf, N) != N){
+    printf("%s: write failed\n", s);
     exit(1);
   }
-  fd = open(".", 0);
-  if(write(fd, "x", 1) > 0){
-    printf("%s: write . succeeded!\n", s);
-    exit(1);
+  close(fds[1]);
+  memset(buf, 0, N);
+  for(tot = 0; (n = read(fds[0], buf + tot, N - tot)) > 0; tot += n)
+    ;
+  for(i = 0; i < N; i++){
+    if(buf[i] != i % 199){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
   }
-  close(fd);
+  close(fds[0]);
 }
 
-// test that iput() is called at the end of _namei().
-// also tests empty file names.
+// splice() from a file into a pipe delivers the file's bytes
+// in order and advances the file offset.
 void
-iref(char *s)
+splicetest(char *s)
 {
-  int i, fd;
+  enum { N = 3000 };
+  int fd, fds[2], pid, n, tot, i, xstatus;
+  char buf[100];
 
-  for(i = 0; i < NINODE + 1; i++){
-    if(mkdir("irefd") != 0){
-      printf("%s: mkdir irefd failed\n", s);
+  fd = open("splicefile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i;
+  for(i = 0; i < N; i += sizeof(buf)){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
       exit(1);
     }
-    if(chdir("irefd") != 0){
-      printf("%s: chdir irefd failed\n", s);
+  }
+  close(fd);
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fd = open("splicefile", O_RDONLY);
+  if(splice(fds[0], fds[1], 1) >= 0 || splice(fd, fd, 1) >= 0){
+    printf("%s: splice accepted bad fds\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    tot = 0;
+    while((n = splice(fd, fds[1], 1000)) > 0)
+      tot += n;
+    if(n < 0 || tot != N || read(fd, buf, 1) != 0){
+      printf("%s: spliced %d bytes\n", s, tot);
       exit(1);
     }
-
-    mkdir("");
-    link("README", "");
-    fd = open("", O_CREATE);
-    if(fd >= 0)
-      close(fd);
-    fd = open("xx", O_CREATE);
-    if(fd >= 0)
-      close(fd);
-    unlink("xx");
+    exit(0);
   }
-
-  // clean up
-  for(i = 0; i < NINODE + 1; i++){
-    chdir("..");
-    unlink("irefd");
+  close(fds[1]);
+  close(fd);
+  tot = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] != (tot + i) % sizeof(buf)){
+        printf("%s: wrong byte at %d\n", s, tot + i);
+        exit(1);
+      }
+    }
+    tot += n;
   }
-
-  chdir("/");
+  close(fds[0]);
+  wait(&xstatus);
+  if(tot != N || xstatus != 0){
+    printf("%s: read %d bytes\n", s, tot);
+    exit(1);
+  }
+  unlink("splicefile");
 }
 
-// test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// interleaved small and large malloc()s hand out disjoint
+// blocks, and freed blocks are reused.
 void
-forktest(char *s)
+malloctest(char *s)
 {
-  enum{ N = 1000 };
-  int n, pid;
-
-  for(n=0; n<N; n++){
-    pid = fork();
-    if(pid < 0)
-      break;
-    if(pid == 0)
-      exit(0);
+  enum { N = 200 };
+  static char *p[N];
+  int i, j, n;
+
+  for(j = 0; j < 3; j++){
+    for(i = 0; i < N; i++){
+      n = (i % 7 == 0) ? 1000 + i : 1 + (i * 13) % 500;
+      if((p[i] = malloc(n)) == 0){
+        printf("%s: malloc(%d) failed\n", s, n);
+        exit(1);
+      }
+      memset(p[i], i, n);
+    }
+    for(i = 0; i < N; i++){
+      n = (i % 7 == 0) ? 1000 + i : 1 + (i * 13) % 500;
+      if(p[i][0] != (char)i || p[i][n-1] != (char)i){
+        printf("%s: block %d overwritten\n", s, i);
+        exit(1);
+      }
+    }
+    for(i = 0; i < N; i += 2)
+      free(p[i]);
+    for(i = 1; i < N; i += 2)
+      free(p[i]);
   }
+}
 
-  if (n == 0) {
-    printf("%s: no fork at all!\n", s);
-    exit(1);
+// memmove(), memset() and memcmp() agree with byte loops for
+// every alignment, length and direction of overlap.
+void
+memtest(char *s)
+{
+  enum { N = 160 };
+  static char a[N], b[N], t[N];
+  int so, d, n, i;
+
+  for(so = 0; so < 8; so++){
+    for(d = -9; d <= 9; d++){
+      for(n = 0; n < 80; n += 7){
+        if(so + d < 0)
+          continue;
+        for(i = 0; i < N; i++)
+          a[i] = b[i] = i * 7 + 1;
+        for(i = 0; i < n; i++)
+          t[i] = b[so + i];
+        for(i = 0; i < n; i++)
+          b[so + d + i] = t[i];
+        memmove(a + so + d, a + so, n);
+        if(memcmp(a, b, N) != 0){
+          printf("%s: memmove src %d dst %d len %d\n", s, so, so + d, n);
+          exit(1);
+        }
+      }
+    }
   }
 
-  if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
-    exit(1);
+  for(so = 0; so < 8; so++){
+    for(n = 0; n < 70; n += 3){
+      memset(a, 1, N);
+      memset(a + so, 0xab, n);
+      for(i = 0; i < N; i++){
+        if(a[i] != ((i >= so && i < so + n) ? (char)0xab : 1)){
+          printf("%s: memset off %d len %d\n", s, so, n);
+          exit(1);
+        }
+      }
+    }
   }
 
-  for(; n > 0; n--){
-    if(wait(0) < 0){
-      printf("%s: wait stopped early\n", s);
+  memset(a, 'x', N);
+  memset(b, 'x', N);
+  for(i = 0; i < N; i++){
+    b[i] = 'y';
+    if(memcmp(a, b, N) >= 0 || memcmp(b, a, N) <= 0 || memcmp(a, b, i) != 0){
+      printf("%s: memcmp differs at %d\n", s, i);
       exit(1);
     }
-  }
-
-  if(wait(0) != -1){
-    printf("%s: wait got too many\n", s);
-    exit(1);
+    b[i] = 'x';
   }
 }
 
@@ -2339,12 +3544,26 @@ rand()
 }
 
 // check that there's an invalid page beneath
-// the user stack, to catch stack overflow.
+// the user stack, to catch stack overflow,
+// which system calls can't read either.
 void
 stacktest(char *s)
 {
   int pid;
   int xstatus;
+  int fds[2];
+  char *guard = (char *) r_sp() - PGSIZE;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], guard, 1) > 0 || open(guard, O_RDONLY) >= 0){
+    printf("%s: system call read below stack\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
   
   pid = fork();
   if(pid == 0) {
@@ -2670,6 +3889,7 @@ main(int argc, char *argv[])
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
+    {lazycopy, "lazycopy"},
     {sbrkmuch, "sbrkmuch"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
@@ -2685,6 +3905,17 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipe2test, "pipe2test"},
+    {mmaptest, "mmaptest"},
+    {threadtest, "threadtest"},
+    {futextest, "futextest"},
+    {spawntest, "spawntest"},
+    {clocktest, "clocktest"},
+    {iovtest, "iovtest"},
+    {ioringtest, "ioringtest"},
+    {splicetest, "splicetest"},
+    {memtest, "memtest"},
+    {malloctest, "malloctest"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
@@ -2693,7 +3924,16 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {cowfork, "cowfork"},
     {bigdir, "bigdir"}, // slow
+    {hashdir, "hashdir"},
+    {inlinefile, "inlinefile"},
+    {pagecache, "pagecache"},
+    {textbusy, "textbusy"},
+    {tmpfs, "tmpfs"},
+    {getdentstest, "getdents"},
+    {swaptest, "swap"},
+    {swappipe, "swappipe"},
     { 0, 0},
   };
 
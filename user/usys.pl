@@ -6,24 +6,26 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry(name[, symbol]): the stub is called symbol, by default name.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $sym = shift || $name;
+    print ".global $sym\n";
+    print "${sym}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");    # fork(), exit() and exec() in ulib.c flush stdio
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
 entry("close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -38,3 +40,29 @@ entry("sleep");
 entry("uptime");
 entry("trace");
 entry("sysinfo");
+entry("scstat");
+entry("traceread");
+entry("setpriority");
+entry("splice");
+entry("pipe2");
+entry("mmap");
+entry("munmap");
+entry("dmesg");
+entry("lockstat");
+entry("lockbench");
+entry("clone");
+entry("join");
+entry("yield");
+entry("futex_wait");
+entry("futex_wake");
+entry("spawn");
+entry("clock_gettime");
+entry("profctl");
+entry("profread");
+entry("waitstat");
+entry("readv");
+entry("writev");
+entry("fsync");
+entry("ioring_enter");
+entry("mount");
+entry("getdents");
@@ -0,0 +1,82 @@
+#include "kernel/types.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+//
+// report kernel activity every interval ticks.
+// usage: vmstat [interval [count]]
+//   each line after the first covers one interval; the first
+//   covers the time since boot. count 0 runs until killed.
+//
+
+static void
+sample(struct sysinfo *info) {
+    if (sysinfo(info) < 0) {
+        fprintf(2, "vmstat: sysinfo failed\n");
+        exit(1);
+    }
+    if (info->version != SYSINFO_VERSION || info->size != sizeof(*info)) {
+        fprintf(2, "vmstat: kernel has sysinfo version %l, want %d\n",
+                info->version, SYSINFO_VERSION);
+        exit(1);
+    }
+}
+
+// percent of the CPUs' time spent in each state.
+static void
+cpupct(struct sysinfo *a, struct sysinfo *b) {
+    uint64 us = 0, sy = 0, id = 0, tot;
+    int i;
+
+    for (i = 0; i < b->ncpu; i++) {
+        us += b->utime[i] - a->utime[i];
+        sy += b->stime[i] - a->stime[i];
+        id += b->idlecycles[i] - a->idlecycles[i];
+    }
+    tot = us + sy + id;
+    if (tot == 0)
+        tot = 1;
+    printf(" %l %l %l\n", us * 100 / tot, sy * 100 / tot, id * 100 / tot);
+}
+
+static void
+line(struct sysinfo *a, struct sysinfo *b) {
+    uint64 lookups;
+    int i;
+
+    printf("%l %l", b->nproc, b->freemem / 1024);
+    for (i = 0; i < NSTAT; i++)
+        printf(" %l", b->stat[i] - a->stat[i]);
+    lookups = (b->stat[ST_BHIT] - a->stat[ST_BHIT]) +
+              (b->stat[ST_BMISS] - a->stat[ST_BMISS]);
+    printf(" %l", lookups ? (b->stat[ST_BHIT] - a->stat[ST_BHIT]) * 100 / lookups : 100);
+    printf(" %l", b->ncommit - a->ncommit);
+    cpupct(a, b);
+}
+
+int
+main(int argc, char *argv[]) {
+    static struct sysinfo zero;
+    struct sysinfo prev, cur;
+    int interval = 10, count = 0, n;
+
+    if (argc > 1)
+        interval = atoi(argv[1]);
+    if (argc > 2)
+        count = atoi(argv[2]);
+    if (interval < 1 || count < 0) {
+        fprintf(2, "usage: vmstat [interval [count]]\n");
+        exit(1);
+    }
+
+    printf("procs freeKB bhit bmiss dread dwrite cs flt sys intr pchit pcmiss so si hit%% commit us sy id\n");
+    sample(&prev);
+    line(&zero, &prev);
+    for (n = 1; count == 0 || n < count; n++) {
+        sleep(interval);
+        sample(&cur);
+        line(&prev, &cur);
+        prev = cur;
+    }
+    exit(0);
+}
@@ -0,0 +1,116 @@
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+//
+// build and run commands from standard input.
+// usage: xargs [-n maxargs] [-P jobs] cmd [args...]
+//   each command is cmd args... followed by up to maxargs
+//   words read from standard input (default: as many as
+//   MAXARG allows). Up to jobs commands run at once (default
+//   1; 0 means one per CPU); a finished one frees its slot for
+//   the next. The commands' standard input is closed, so that
+//   they cannot eat xargs' input.
+//
+
+#define MAXWORD 512   // longest input word
+
+static char *cmd[MAXARG];
+static int nfixed;
+static int running, failed;
+
+// Wait for one command to finish.
+static void
+reap(void) {
+    int status;
+
+    if (wait(&status) < 0) {
+        fprintf(2, "xargs: wait failed\n");
+        exit(1);
+    }
+    if (status != 0)
+        failed = 1;
+    running--;
+}
+
+// Run cmd with its n input words, once a job slot is free.
+static void
+run(int n, int jobs) {
+    int fds[NSPAWNFD] = {-1, 1, 2};
+    int i;
+
+    while (running >= jobs)
+        reap();
+    cmd[nfixed + n] = 0;
+    if (spawn(cmd[0], cmd, fds) < 0) {
+        fprintf(2, "xargs: cannot run %s\n", cmd[0]);
+        failed = 1;
+    } else {
+        running++;
+    }
+    for (i = nfixed; i < nfixed + n; i++)
+        free(cmd[i]);
+}
+
+// Read the next whitespace-separated word of standard input
+// into w. Returns its length, 0 at the end of the input.
+static int
+word(char *w) {
+    int c, n = 0;
+
+    while ((c = fgetc(stdin)) == ' ' || c == '\t' || c == '\n')
+        ;
+    while (c >= 0 && c != ' ' && c != '\t' && c != '\n') {
+        if (n < MAXWORD - 1)
+            w[n++] = c;
+        c = fgetc(stdin);
+    }
+    w[n] = 0;
+    return n;
+}
+
+int
+main(int argc, char *argv[]) {
+    static char w[MAXWORD];
+    struct sysinfo info;
+    int i, n, len, maxargs = -1, jobs = 1;
+
+    for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if (strcmp(argv[i], "-n") == 0)
+            maxargs = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-P") == 0)
+            jobs = atoi(argv[i + 1]);
+        else
+            break;
+    }
+    nfixed = argc - i;
+    if (nfixed < 1 || nfixed >= MAXARG - 1 || (maxargs != -1 && maxargs < 1) || jobs < 0) {
+        fprintf(2, "usage: xargs [-n maxargs] [-P jobs] cmd [args...]\n");
+        exit(1);
+    }
+    if (jobs == 0)
+        jobs = sysinfo(&info) == 0 && info.ncpu > 0 ? info.ncpu : 1;
+    // exec()'s argv holds at most MAXARG pointers, the last 0.
+    if (maxargs == -1 || maxargs > MAXARG - 1 - nfixed)
+        maxargs = MAXARG - 1 - nfixed;
+    memmove(cmd, argv + i, nfixed * sizeof(char *));
+
+    n = 0;
+    while ((len = word(w)) > 0) {
+        if ((cmd[nfixed + n] = malloc(len + 1)) == 0) {
+            fprintf(2, "xargs: out of memory\n");
+            exit(1);
+        }
+        strcpy(cmd[nfixed + n], w);
+        if (++n == maxargs) {
+            run(n, jobs);
+            n = 0;
+        }
+    }
+    if (n > 0)
+        run(n, jobs);
+    while (running > 0)
+        reap();
+    exit(failed);
+}